@@ -0,0 +1,81 @@
+#include "gltext.hpp"
+
+#include <GL/glut.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+static double now() {
+    LARGE_INTEGER freq, t;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return double(t.QuadPart) / double(freq.QuadPart);
+}
+#else
+#include <time.h>
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+#endif
+
+// Shapes a document with 1 to N threads and reports the speedup over a single thread.
+// usage: bench font.ttf [document.txt] [max threads]
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s font.ttf [document.txt] [max threads]\n", argv[0]);
+        return 1;
+    }
+
+    // Fonts need a GL context, even though shaping never uses it
+    glutInit(&argc, argv);
+    glutInitDisplayMode(GLUT_RGB);
+    glutCreateWindow("gltext benchmark");
+
+    std::string text;
+    if(argc > 2) {
+        std::ifstream in(argv[2], std::ios::binary);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        text = ss.str();
+    } else {
+        for(unsigned i = 0; i < 50000; i++)
+            text += "The quick brown fox jumps over the lazy dog. AVA WAVE office affluent fjord 0123456789\n";
+    }
+    unsigned max_threads = argc > 3 ? atoi(argv[3]) : 16;
+
+    gltext::Font font(argv[1], 16);
+    std::vector<gltext::ShapedText> reference = font.shapeDocument(text, 1);
+    printf("%u lines, %u bytes\n", unsigned(reference.size()), unsigned(text.size()));
+    printf("threads       ms  speedup\n");
+
+    double base = 0.0;
+    for(unsigned threads = 1; threads <= max_threads; threads++) {
+        double best = 0.0;
+        for(unsigned run = 0; run < 3; run++) {
+            double start = now();
+            std::vector<gltext::ShapedText> lines = font.shapeDocument(text, threads);
+            double t = now() - start;
+            if(run == 0 || t < best)
+                best = t;
+            for(unsigned i = 0; i < lines.size(); i++) {
+                if(lines[i].glyphs.size() != reference[i].glyphs.size() || lines[i].x_advance != reference[i].x_advance) {
+                    fprintf(stderr, "line %u differs from the single-threaded result\n", i);
+                    return 1;
+                }
+            }
+        }
+        if(threads == 1)
+            base = best;
+        printf("%7u %8.1f %8.2f\n", threads, best * 1000.0, base / best);
+    }
+    return 0;
+}
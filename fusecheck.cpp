@@ -0,0 +1,157 @@
+#include "harfbuzz/hb.h"
+#include "harfbuzz/hb-ft.h"
+#include "harfbuzz/hb-ot-layout.h"
+#include "itemize.hpp"
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// The plan compiler reads HB_FUSE_LOOKUPS when a face's plans are built, so each pass opens the font again
+static void setFusion(bool on) {
+#ifdef _WIN32
+    _putenv(on ? "HB_FUSE_LOOKUPS=1" : "HB_FUSE_LOOKUPS=0");
+#else
+    setenv("HB_FUSE_LOOKUPS", on ? "1" : "0", 1);
+#endif
+}
+
+struct ShapedGlyph {
+    unsigned index, cluster;
+    int x_advance, y_advance, x_offset, y_offset;
+};
+
+// Every line is shaped once with the default features, and once more with each of these turned on
+static const hb_tag_t pass_features[] = {
+    HB_TAG_NONE, HB_TAG('s','m','c','p'), HB_TAG('c','2','s','c'), HB_TAG('o','n','u','m'), HB_TAG('c','a','s','e')
+};
+static const unsigned num_passes = sizeof(pass_features) / sizeof(pass_features[0]);
+
+// Shapes every line of the corpus in every pass with a fresh face, and returns the glyphs of each line and pass. Lines
+// are split into runs of one script and direction the way gltext splits them.
+static bool shapeCorpus(FT_Library library, const char* font_file, hb_unicode_funcs_t* unicode_funcs,
+                        const std::vector<std::string>& lines, std::vector<std::vector<ShapedGlyph> >& shaped) {
+    FT_Face face;
+    if(FT_New_Face(library, font_file, 0, &face) || FT_Set_Pixel_Sizes(face, 0, 16))
+        return false;
+    hb_font_t* font = hb_ft_font_create(face, 0);
+    hb_buffer_t* buffer = hb_buffer_create();
+    std::vector<gltext::ScriptRun> runs;
+    shaped.clear();
+    for(unsigned p = 0; p < num_passes; p++) {
+        hb_feature_t feature = { pass_features[p], 1, 0, (unsigned)-1 };
+        for(unsigned i = 0; i < lines.size(); i++) {
+            shaped.push_back(std::vector<ShapedGlyph>());
+            runs.clear();
+            gltext::itemizeParagraph(lines[i], 0, lines[i].size(), runs);
+            for(unsigned r = 0; r < runs.size(); r++) {
+                hb_buffer_reset(buffer);
+                hb_buffer_set_unicode_funcs(buffer, unicode_funcs);
+                hb_buffer_set_direction(buffer, (runs[r].level & 1) ? HB_DIRECTION_RTL : HB_DIRECTION_LTR);
+                hb_buffer_set_script(buffer, runs[r].script);
+                hb_buffer_add_utf8(buffer, lines[i].c_str(), lines[i].size(), runs[r].offset, runs[r].length);
+                hb_shape(font, buffer, &feature, feature.tag ? 1 : 0);
+                unsigned len = hb_buffer_get_length(buffer);
+                hb_glyph_info_t* infos = hb_buffer_get_glyph_infos(buffer, 0);
+                hb_glyph_position_t* positions = hb_buffer_get_glyph_positions(buffer, 0);
+                for(unsigned g = 0; g < len; g++) {
+                    ShapedGlyph s = { infos[g].codepoint, infos[g].cluster, positions[g].x_advance, positions[g].y_advance,
+                                      positions[g].x_offset, positions[g].y_offset };
+                    shaped.back().push_back(s);
+                }
+            }
+        }
+    }
+    hb_buffer_destroy(buffer);
+    hb_font_destroy(font);
+    FT_Done_Face(face);
+    return true;
+}
+
+// Shapes a corpus with GSUB lookup fusion on and then off, and reports any line whose glyph ids, clusters or
+// positions differ between the two. It fails as well if no fused run was applied, since then nothing was compared.
+// usage: fusecheck font.ttf [corpus.txt]
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s font.ttf [corpus.txt]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> lines;
+    if(argc > 2) {
+        std::ifstream in(argv[2], std::ios::binary);
+        if(!in) {
+            fprintf(stderr, "cannot open %s\n", argv[2]);
+            return 1;
+        }
+        std::string line;
+        while(std::getline(in, line)) {
+            if(!line.empty() && line[line.size()-1] == '\r')
+                line.erase(line.size()-1);
+            lines.push_back(line);
+        }
+    } else {
+        lines.push_back("The quick brown fox jumps over the lazy dog. AVA WAVE office affluent fjord 0123456789");
+        lines.push_back("To Ty Yo Va LT ffi ffl fi fl 1/2 ->");
+        lines.push_back("a\xcc\x81 e\xcc\x82\xcc\x83 o\xcc\x88 n\xcc\x83 i\xcc\x87\xcc\x81 x\xcc\xa3\xcc\x81");
+        lines.push_back("\xd8\xb3\xd9\x84\xd8\xa7\xd9\x85 \xd8\xb9\xd9\x84\xd9\x8a\xd9\x83\xd9\x85 \xd9\x84\xd8\xa7 \xd8\xa7\xd9\x84\xd9\x84\xd9\x87");
+        lines.push_back("\xd7\xa9\xd7\x9c\xd7\x95\xd7\x9d \xd7\xa2\xd7\x95\xd7\x9c\xd7\x9d");
+        lines.push_back("\xd0\x9f\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82 \xce\x93\xce\xb5\xce\xb9\xce\xac");
+    }
+
+    FT_Library library;
+    if(FT_Init_FreeType(&library)) {
+        fprintf(stderr, "cannot initialize Freetype\n");
+        return 1;
+    }
+    hb_unicode_funcs_t* unicode_funcs = gltext::createUnicodeFuncs();
+    std::vector<std::vector<ShapedGlyph> > fused, unfused;
+    setFusion(true);
+    bool ok = shapeCorpus(library, argv[1], unicode_funcs, lines, fused);
+    unsigned fused_runs = hb_ot_layout_get_fused_run_count();
+    setFusion(false);
+    ok = ok && shapeCorpus(library, argv[1], unicode_funcs, lines, unfused);
+    hb_unicode_funcs_destroy(unicode_funcs);
+    FT_Done_FreeType(library);
+    if(!ok) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    unsigned differ = 0, glyphs = 0;
+    for(unsigned i = 0; i < fused.size(); i++) {
+        glyphs += fused[i].size();
+        bool same = fused[i].size() == unfused[i].size();
+        unsigned g = 0;
+        for(; same && g < fused[i].size(); g++)
+            same = !memcmp(&fused[i][g], &unfused[i][g], sizeof(ShapedGlyph));
+        if(same)
+            continue;
+        if(differ++ < 10) {
+            unsigned line = i % lines.size() + 1;
+            hb_tag_t tag = pass_features[i / lines.size()];
+            char pass[5] = "none";
+            if(tag) {
+                for(unsigned c = 0; c < 4; c++)
+                    pass[c] = char(tag >> (24 - 8*c));
+            }
+            if(fused[i].size() != unfused[i].size())
+                printf("line %u, +%.4s: %u glyphs fused, %u unfused\n", line, pass, unsigned(fused[i].size()),
+                       unsigned(unfused[i].size()));
+            else
+                printf("line %u, +%.4s: glyph %u is %u@%u fused, %u@%u unfused\n", line, pass, g - 1, fused[i][g-1].index,
+                       fused[i][g-1].cluster, unfused[i][g-1].index, unfused[i][g-1].cluster);
+        }
+    }
+    printf("%u lines, %u passes, %u glyphs, %u fused runs, %u differ\n", unsigned(lines.size()), num_passes, glyphs,
+           fused_runs, differ);
+    if(!fused_runs)
+        printf("no fused runs were applied, so fusion was not checked\n");
+    return differ || !fused_runs ? 1 : 0;
+}
@@ -25,8 +25,17 @@
 #include "gltext.hpp"
 
 #include <assert.h>
+#include <limits.h>
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <list>
 #include <map>
+#include <set>
+#include <vector>
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -36,21 +45,227 @@
 static void* glPointer(const char* funcname) {
     return (void*)wglGetProcAddress(funcname);
 }
+
+static unsigned long long nanoTime() {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if(!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (unsigned long long)(now.QuadPart / freq.QuadPart) * 1000000000ull
+         + (unsigned long long)(now.QuadPart % freq.QuadPart) * 1000000000ull / freq.QuadPart;
+}
+
+class Mutex {
+public:
+    Mutex() { InitializeCriticalSection(&cs); }
+    ~Mutex() { DeleteCriticalSection(&cs); }
+    void lock() { EnterCriticalSection(&cs); }
+    void unlock() { LeaveCriticalSection(&cs); }
+private:
+    Mutex(const Mutex&);
+    Mutex& operator=(const Mutex&);
+    CRITICAL_SECTION cs;
+};
+
+class Thread {
+public:
+    Thread() : handle(0) {}
+    // Returns false if the thread could not be created, in which case it must not be joined
+    bool start(void (*func)(void*), void* arg) {
+        this->func = func;
+        this->arg = arg;
+        handle = CreateThread(0, 0, trampoline, this, 0, 0);
+        return handle != 0;
+    }
+    void join() {
+        WaitForSingleObject(handle, INFINITE);
+        CloseHandle(handle);
+    }
+private:
+    static DWORD WINAPI trampoline(LPVOID self) {
+        ((Thread*)self)->func(((Thread*)self)->arg);
+        return 0;
+    }
+    HANDLE handle;
+    void (*func)(void*);
+    void* arg;
+};
+
+static unsigned cpuCount() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+}
+
+static void atomicAdd(unsigned long long& value, unsigned long long amount) {
+    InterlockedExchangeAdd64((volatile LONG64*)&value, (LONG64)amount);
+}
+
+static unsigned long long atomicLoad(unsigned long long& value) {
+    return InterlockedCompareExchange64((volatile LONG64*)&value, 0, 0);
+}
+
+// Maps a whole file read-only. Returns null if it cannot be opened, is empty, or cannot be mapped.
+static const void* mapWholeFile(const std::string& filename, size_t& size) {
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if(file == INVALID_HANDLE_VALUE)
+        return 0;
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file, &file_size) || !file_size.QuadPart) {
+        CloseHandle(file);
+        return 0;
+    }
+    HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+    CloseHandle(file);
+    if(!mapping)
+        return 0;
+    const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    size = file_size.QuadPart;
+    return data;
+}
+
+static void unmapWholeFile(const void* data, size_t) {
+    UnmapViewOfFile(data);
+}
 #else
 #include <GL/glx.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 static void* glPointer(const char* funcname) {
     return (void*)glXGetProcAddress((GLubyte*)funcname);
 }
+
+static unsigned long long nanoTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+class Mutex {
+public:
+    Mutex() { pthread_mutex_init(&m, 0); }
+    ~Mutex() { pthread_mutex_destroy(&m); }
+    void lock() { pthread_mutex_lock(&m); }
+    void unlock() { pthread_mutex_unlock(&m); }
+private:
+    Mutex(const Mutex&);
+    Mutex& operator=(const Mutex&);
+    pthread_mutex_t m;
+};
+
+class Thread {
+public:
+    // Returns false if the thread could not be created, in which case it must not be joined
+    bool start(void (*func)(void*), void* arg) {
+        this->func = func;
+        this->arg = arg;
+        return pthread_create(&handle, 0, trampoline, this) == 0;
+    }
+    void join() {
+        pthread_join(handle, 0);
+    }
+private:
+    static void* trampoline(void* self) {
+        ((Thread*)self)->func(((Thread*)self)->arg);
+        return 0;
+    }
+    pthread_t handle;
+    void (*func)(void*);
+    void* arg;
+};
+
+static unsigned cpuCount() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+static void atomicAdd(unsigned long long& value, unsigned long long amount) {
+    __sync_fetch_and_add(&value, amount);
+}
+
+static unsigned long long atomicLoad(unsigned long long& value) {
+    return __sync_fetch_and_add(&value, 0ull);
+}
+
+// Maps a whole file read-only. Returns null if it cannot be opened, is empty, or cannot be mapped.
+static const void* mapWholeFile(const std::string& filename, size_t& size) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        return 0;
+    struct stat st;
+    if(fstat(fd, &st) || !st.st_size) {
+        close(fd);
+        return 0;
+    }
+    void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+        return 0;
+    size = st.st_size;
+    return data;
+}
+
+static void unmapWholeFile(const void* data, size_t size) {
+    munmap((void*)data, size);
+}
 #endif
 
+class ScopedLock {
+public:
+    ScopedLock(Mutex& m) : m(m) { m.lock(); }
+    ~ScopedLock() { m.unlock(); }
+private:
+    ScopedLock(const ScopedLock&);
+    ScopedLock& operator=(const ScopedLock&);
+    Mutex& m;
+};
+
 // These need to be included after the windows stuff
 #include "gl3.h"
 #include "harfbuzz/hb-ft.h"
+#include FT_MODULE_H
+#include "itemize.hpp"
+
+// Static tracepoints for perf and bpftrace. These compile to nothing unless sys/sdt.h is available
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define GLTEXT_PROBE1(name, a) DTRACE_PROBE1(gltext, name, a)
+#define GLTEXT_PROBE2(name, a, b) DTRACE_PROBE2(gltext, name, a, b)
+#else
+#define GLTEXT_PROBE1(name, a)
+#define GLTEXT_PROBE2(name, a, b)
+#endif
+
+// Fires cache_glyph_entry when made and cache_glyph_return when it goes out of scope, so that every way out of
+// cacheGlyph(), a throw included, pairs with its entry
+struct CacheGlyphProbe {
+    const void* font;
+    unsigned codepoint;
+
+    CacheGlyphProbe(const void* font, unsigned codepoint) : font(font), codepoint(codepoint) {
+        GLTEXT_PROBE2(cache_glyph_entry, font, codepoint);
+    }
+    ~CacheGlyphProbe() {
+        GLTEXT_PROBE2(cache_glyph_return, font, codepoint);
+    }
+};
 
 #define GLYPH_VERT_SIZE (4*4*sizeof(GLfloat))
 #define GLYPH_IDX_SIZE (6*sizeof(GLushort))
 
+// Face coverage is a two-level table over the Unicode range: a page table of 256-codepoint pages,
+// each pointing at a 256-bit block. Pages with no coverage all share the empty block at index 0.
+#define COVERAGE_LIMIT 0x110000
+#define COVERAGE_PAGE_SHIFT 8
+#define COVERAGE_PAGE_WORDS ((1 << COVERAGE_PAGE_SHIFT) / 32)
+
 struct GlyphVert {
     float x;
     float y;
@@ -145,6 +360,207 @@ static void initGlPointers() {
     gltextBindAttribLocation = (PFNGLBINDATTRIBLOCATIONPROC)glPointer("glBindAttribLocation");
 }
 
+// A Freetype face may only be used by one thread at a time. The hb_font that gltext shapes with is a
+// sub-font of the hb-ft font, and its callbacks hold the face's lock while they forward to the parent.
+// Only the Freetype calls are serialized, so the layout work itself runs in parallel.
+static hb_bool_t lockedGlyph(hb_font_t* font, void* lock, hb_codepoint_t unicode, hb_codepoint_t variation_selector,
+                             hb_codepoint_t* glyph, void*) {
+    ScopedLock l(*(Mutex*)lock);
+    return hb_font_get_glyph(hb_font_get_parent(font), unicode, variation_selector, glyph);
+}
+
+static hb_position_t lockedHAdvance(hb_font_t* font, void* lock, hb_codepoint_t glyph, void*) {
+    ScopedLock l(*(Mutex*)lock);
+    return hb_font_get_glyph_h_advance(hb_font_get_parent(font), glyph);
+}
+
+static hb_position_t lockedVAdvance(hb_font_t* font, void* lock, hb_codepoint_t glyph, void*) {
+    ScopedLock l(*(Mutex*)lock);
+    return hb_font_get_glyph_v_advance(hb_font_get_parent(font), glyph);
+}
+
+static hb_bool_t lockedHOrigin(hb_font_t* font, void* lock, hb_codepoint_t glyph, hb_position_t* x, hb_position_t* y, void*) {
+    ScopedLock l(*(Mutex*)lock);
+    return hb_font_get_glyph_h_origin(hb_font_get_parent(font), glyph, x, y);
+}
+
+static hb_bool_t lockedVOrigin(hb_font_t* font, void* lock, hb_codepoint_t glyph, hb_position_t* x, hb_position_t* y, void*) {
+    ScopedLock l(*(Mutex*)lock);
+    return hb_font_get_glyph_v_origin(hb_font_get_parent(font), glyph, x, y);
+}
+
+static hb_position_t lockedHKerning(hb_font_t* font, void* lock, hb_codepoint_t left, hb_codepoint_t right, void*) {
+    ScopedLock l(*(Mutex*)lock);
+    return hb_font_get_glyph_h_kerning(hb_font_get_parent(font), left, right);
+}
+
+static hb_position_t lockedVKerning(hb_font_t* font, void* lock, hb_codepoint_t top, hb_codepoint_t bottom, void*) {
+    ScopedLock l(*(Mutex*)lock);
+    return hb_font_get_glyph_v_kerning(hb_font_get_parent(font), top, bottom);
+}
+
+static hb_bool_t lockedExtents(hb_font_t* font, void* lock, hb_codepoint_t glyph, hb_glyph_extents_t* extents, void*) {
+    ScopedLock l(*(Mutex*)lock);
+    return hb_font_get_glyph_extents(hb_font_get_parent(font), glyph, extents);
+}
+
+static hb_bool_t lockedContourPoint(hb_font_t* font, void* lock, hb_codepoint_t glyph, unsigned int point_index,
+                                    hb_position_t* x, hb_position_t* y, void*) {
+    ScopedLock l(*(Mutex*)lock);
+    return hb_font_get_glyph_contour_point(hb_font_get_parent(font), glyph, point_index, x, y);
+}
+
+static GLuint createCacheTexture(unsigned w, unsigned h) {
+    GLuint tex;
+    gltextActiveTexture(GL_TEXTURE0);
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return tex;
+}
+
+// Where a glyph bitmap is in a cache texture, in texels
+struct AtlasGlyph {
+    unsigned x, y, w, h;
+    int left, top;    // Offset of the bitmap's top-left corner from the pen
+    bool inverse;     // The bitmap was uploaded top row first, so t runs downwards
+};
+
+// Glyphs in the shared atlas belong to a face at a pixel size, not to a Font. Fonts over the same file share them.
+// Font data is identified by FontSystem::newDataId() rather than its address, which a later font may reuse.
+struct AtlasKey {
+    unsigned data;
+    unsigned index;
+    unsigned size;
+    unsigned glyph;
+
+    bool operator<(const AtlasKey& rhs) const {
+        if(data != rhs.data)
+            return data < rhs.data;
+        if(index != rhs.index)
+            return index < rhs.index;
+        if(size != rhs.size)
+            return size < rhs.size;
+        return glyph < rhs.glyph;
+    }
+};
+
+/// A row of the shared atlas. Glyphs are placed left to right in the shortest shelf they fit.
+struct AtlasShelf {
+    unsigned y, height, x;
+};
+
+// Shelf heights are rounded up to this, so that glyphs of similar sizes share shelves
+#define ATLAS_SHELF_ROUNDING 4
+
+struct SharedAtlas {
+    GLuint tex;
+    unsigned w, h;
+    std::vector<AtlasShelf> shelves;
+    std::map<AtlasKey, AtlasGlyph> glyphs;
+
+    // Each glyph gets a texel of space to its right and below it, so glyphs never touch
+    bool allocate(unsigned glyph_w, unsigned glyph_h, unsigned& x, unsigned& y) {
+        glyph_w++;
+        glyph_h++;
+        AtlasShelf* best = 0;
+        for(unsigned i = 0; i < shelves.size(); i++) {
+            AtlasShelf& shelf = shelves[i];
+            if(shelf.height >= glyph_h && shelf.x + glyph_w <= w && (!best || shelf.height < best->height))
+                best = &shelf;
+        }
+        // A shelf much taller than the glyph wastes space, so start a better fitting one while there is room
+        unsigned height = (glyph_h + ATLAS_SHELF_ROUNDING - 1) / ATLAS_SHELF_ROUNDING * ATLAS_SHELF_ROUNDING;
+        unsigned top = shelves.empty() ? 0 : shelves.back().y + shelves.back().height;
+        if((!best || best->height > height + height/2) && top + height <= h && glyph_w <= w) {
+            AtlasShelf shelf = { top, height, 0 };
+            shelves.push_back(shelf);
+            best = &shelves.back();
+        }
+        if(!best)
+            return false;
+        x = best->x;
+        y = best->y;
+        best->x += glyph_w;
+        return true;
+    }
+
+    // Their space stays in use until the next reset()
+    void forget(unsigned data) {
+        AtlasKey first = { data, 0, 0, 0 };
+        AtlasKey last = { data + 1, 0, 0, 0 };
+        glyphs.erase(glyphs.lower_bound(first), glyphs.lower_bound(last));
+    }
+
+    void reset() {
+        if(tex)
+            glDeleteTextures(1, &tex);
+        tex = 0;
+        shelves.clear();
+        glyphs.clear();
+    }
+};
+
+// The FontStats counters only grow between resets. They are updated with atomic adds, so that concurrent
+// shapers never wait for each other; the atlas fields change with the cache and are kept under stats_lock.
+static unsigned long long gltext::FontStats::* const stats_counters[] = {
+    &gltext::FontStats::cache_hits, &gltext::FontStats::cache_misses, &gltext::FontStats::cache_evictions,
+    &gltext::FontStats::glyphs_rasterized, &gltext::FontStats::bytes_uploaded, &gltext::FontStats::draw_calls,
+    &gltext::FontStats::glyphs_culled, &gltext::FontStats::glyphs_deferred, &gltext::FontStats::shape_cache_hits,
+    &gltext::FontStats::shape_cache_misses, &gltext::FontStats::shape_ns, &gltext::FontStats::rasterize_ns,
+    &gltext::FontStats::submit_ns
+};
+
+// Reads the counters atomically and the atlas fields as they are; call with stats_lock held
+static gltext::FontStats loadStats(gltext::FontStats& from) {
+    gltext::FontStats stats = gltext::FontStats();
+    for(unsigned i = 0; i < sizeof(stats_counters)/sizeof(stats_counters[0]); i++)
+        stats.*stats_counters[i] = atomicLoad(from.*stats_counters[i]);
+    stats.atlas_glyphs = from.atlas_glyphs;
+    stats.atlas_capacity = from.atlas_capacity;
+    stats.atlas_pixels_used = from.atlas_pixels_used;
+    stats.atlas_pixels_held = from.atlas_pixels_held;
+    return stats;
+}
+
+// Takes what the counters held when read off them, so that adds racing with the reset are kept
+static void resetCounters(gltext::FontStats& stats) {
+    for(unsigned i = 0; i < sizeof(stats_counters)/sizeof(stats_counters[0]); i++)
+        atomicAdd(stats.*stats_counters[i], 0 - atomicLoad(stats.*stats_counters[i]));
+}
+
+// Freetype's allocations carry their size in front of them, so that the memory Freetype holds can be counted.
+// memory->user points at the count, which is kept with atomic adds since the workers allocate concurrently.
+#define ALLOC_HEADER_SIZE 16
+
+static void* ftAlloc(FT_Memory memory, long size) {
+    char* block = (char*)malloc(ALLOC_HEADER_SIZE + size);
+    if(!block)
+        return 0;
+    *(size_t*)block = size;
+    atomicAdd(*(unsigned long long*)memory->user, size);
+    return block + ALLOC_HEADER_SIZE;
+}
+
+static void ftFree(FT_Memory memory, void* data) {
+    char* block = (char*)data - ALLOC_HEADER_SIZE;
+    atomicAdd(*(unsigned long long*)memory->user, 0 - (unsigned long long)*(size_t*)block);
+    free(block);
+}
+
+static void* ftRealloc(FT_Memory memory, long cur_size, long new_size, void* data) {
+    char* block = (char*)realloc((char*)data - ALLOC_HEADER_SIZE, ALLOC_HEADER_SIZE + new_size);
+    if(!block)
+        return 0;
+    *(size_t*)block = new_size;
+    atomicAdd(*(unsigned long long*)memory->user, (unsigned long long)new_size - (unsigned long long)cur_size);
+    return block + ALLOC_HEADER_SIZE;
+}
+
 struct FontSystem {
 public:
     static FontSystem& instance() {
@@ -153,7 +569,47 @@ public:
     }
     
     FontSystem() {
-        FT_Init_FreeType(&library);
+        totals = gltext::FontStats();
+        ft_bytes = 0;
+        data_ids = 0;
+        ft_memory.user = &ft_bytes;
+        ft_memory.alloc = ftAlloc;
+        ft_memory.free = ftFree;
+        ft_memory.realloc = ftRealloc;
+        FT_New_Library(&ft_memory, &library);
+        FT_Add_Default_Modules(library);
+#if FREETYPE_MAJOR > 2 || (FREETYPE_MAJOR == 2 && FREETYPE_MINOR >= 8)
+        FT_Set_Default_Properties(library);
+#endif
+
+        locked_funcs = hb_font_funcs_create();
+        hb_font_funcs_set_glyph_func(locked_funcs, lockedGlyph, 0, 0);
+        hb_font_funcs_set_glyph_h_advance_func(locked_funcs, lockedHAdvance, 0, 0);
+        hb_font_funcs_set_glyph_v_advance_func(locked_funcs, lockedVAdvance, 0, 0);
+        hb_font_funcs_set_glyph_h_origin_func(locked_funcs, lockedHOrigin, 0, 0);
+        hb_font_funcs_set_glyph_v_origin_func(locked_funcs, lockedVOrigin, 0, 0);
+        hb_font_funcs_set_glyph_h_kerning_func(locked_funcs, lockedHKerning, 0, 0);
+        hb_font_funcs_set_glyph_v_kerning_func(locked_funcs, lockedVKerning, 0, 0);
+        hb_font_funcs_set_glyph_extents_func(locked_funcs, lockedExtents, 0, 0);
+        hb_font_funcs_set_glyph_contour_point_func(locked_funcs, lockedContourPoint, 0, 0);
+        hb_font_funcs_make_immutable(locked_funcs);
+        unicode_funcs = gltext::createUnicodeFuncs();
+        raster_glyph_budget = 0;
+        raster_ns_budget = 0;
+        frame_glyphs = 0;
+        frame_ns = 0;
+        drain_callback = 0;
+        drain_user = 0;
+        memory_budget = 0;
+        use_tick = 0;
+        atlas.tex = 0;
+        atlas.w = 0;
+        atlas.h = 0;
+
+        // HarfBuzz looks up the default language lazily, without any locking. Do it now, before any shaping threads exist.
+        hb_language_get_default();
+
+
         initGlPointers();
         fs = gltextCreateShader(GL_FRAGMENT_SHADER);
         vs = gltextCreateShader(GL_VERTEX_SHADER);
@@ -174,158 +630,810 @@ public:
         col_loc = gltextGetUniformLocation(prog, "color");
     }
     ~FontSystem() {
-        FT_Done_FreeType(library);
+        for(MappedFileMap::iterator i = mapped_files.begin(); i != mapped_files.end(); ++i)
+            unmapWholeFile(i->second.data, i->second.size);
+        hb_unicode_funcs_destroy(unicode_funcs);
+        hb_font_funcs_destroy(locked_funcs);
+        FT_Done_Library(library);
+    }
+
+    // Faces always read their font from memory, so Freetype and HarfBuzz share one copy of it
+    FT_Error newFace(const void* data, size_t size, unsigned index, FT_Face* face) {
+        ScopedLock lock(library_lock);
+        return FT_New_Memory_Face(library, (const FT_Byte*)data, size, index, face);
+    }
+
+    void doneFace(FT_Face face) {
+        ScopedLock lock(library_lock);
+        FT_Done_Face(face);
+    }
+
+    // Identifies font data for as long as it is in use; a mapping gets one id, and caller memory a new one per Font
+    unsigned newDataId() {
+        ScopedLock lock(files_lock);
+        return ++data_ids;
+    }
+
+    // Each font file is mapped once, however many Fonts use it, and unmapped when the last of them is gone
+    bool mapFile(const std::string& filename, const void*& data, size_t& size, unsigned& id) {
+        ScopedLock lock(files_lock);
+        MappedFileMap::iterator i = mapped_files.find(filename);
+        if(i == mapped_files.end()) {
+            MappedFile file;
+            file.data = mapWholeFile(filename, file.size);
+            if(!file.data)
+                return false;
+            file.refs = 0;
+            file.id = ++data_ids;
+            i = mapped_files.insert(std::make_pair(filename, file)).first;
+        }
+        i->second.refs++;
+        data = i->second.data;
+        size = i->second.size;
+        id = i->second.id;
+        return true;
+    }
+
+    // Returns whether that was the last user of the mapping
+    bool unmapFile(const std::string& filename) {
+        ScopedLock lock(files_lock);
+        MappedFileMap::iterator i = mapped_files.find(filename);
+        if(--i->second.refs == 0) {
+            unmapWholeFile(i->second.data, i->second.size);
+            mapped_files.erase(i);
+            return true;
+        }
+        return false;
+    }
+
+    struct MappedFile {
+        const void* data;
+        size_t size;
+        unsigned refs;
+        unsigned id;
+    };
+    typedef std::map<std::string, MappedFile> MappedFileMap;
+
+    // Font data is counted once per file, however many Fonts map it. HarfBuzz's blobs point into the same mapping.
+    size_t mappedBytes() {
+        ScopedLock lock(files_lock);
+        size_t bytes = 0;
+        for(MappedFileMap::iterator i = mapped_files.begin(); i != mapped_files.end(); ++i)
+            bytes += i->second.size;
+        return bytes;
     }
 
+    size_t freetypeBytes() {
+        return atomicLoad(ft_bytes);
+    }
+
+    unsigned long long ft_bytes;
+    FT_MemoryRec_ ft_memory;
     FT_Library library;
+    Mutex library_lock; // FT_New_Memory_Face and FT_Done_Face are not thread-safe on a shared library
+    Mutex files_lock;
+    MappedFileMap mapped_files;
+    unsigned data_ids;
+    hb_font_funcs_t* locked_funcs;
+    hb_unicode_funcs_t* unicode_funcs; // Scripts, mirroring and mark categories for the shaper
     GLuint fs;
     GLuint vs;
     GLuint prog;
     GLuint scale_loc;
     GLuint pos_loc;
     GLuint col_loc;
+
+    Mutex stats_lock; // Guards the atlas fields of totals and of every Font's stats; the counters are atomic
+    gltext::FontStats totals;
+
+    // The rasterization budget is only used by drawing, so it belongs to the GL thread and needs no lock
+    bool rasterBudgetLeft() const {
+        return (!raster_glyph_budget || frame_glyphs < raster_glyph_budget) && (!raster_ns_budget || frame_ns < raster_ns_budget);
+    }
+
+    void spendRaster(unsigned long long ns) {
+        frame_glyphs++;
+        frame_ns += ns;
+    }
+
+    unsigned raster_glyph_budget;
+    unsigned long long raster_ns_budget;
+    unsigned frame_glyphs;
+    unsigned long long frame_ns;
+    std::set<gltext::FontPimpl*> deferred_fonts; // Fonts with glyphs left for a later frame
+    gltext::DrainCallback drain_callback;
+    void* drain_user;
+
+    // Every live font, for the memory budget. Like drawing, this belongs to the GL thread.
+    std::set<gltext::FontPimpl*> fonts;
+    size_t memory_budget;
+    unsigned long long use_tick;
+
+    // Opted into with setSharedAtlas(). Its size is 0 while Fonts use their own textures.
+    SharedAtlas atlas;
 };
 
 
 namespace gltext {
-    
+
+struct FaceCoverage {
+    std::vector<unsigned short> pages;
+    std::vector<unsigned> bits;
+
+    // Walks the face's Unicode cmap once. After this, lookups never touch Freetype.
+    void build(FT_Face face) {
+        pages.assign(COVERAGE_LIMIT >> COVERAGE_PAGE_SHIFT, 0);
+        bits.assign(COVERAGE_PAGE_WORDS, 0);
+        FT_UInt gindex;
+        FT_ULong c = FT_Get_First_Char(face, &gindex);
+        while(gindex) {
+            if(c < COVERAGE_LIMIT) {
+                unsigned short& page = pages[c >> COVERAGE_PAGE_SHIFT];
+                if(!page) {
+                    page = bits.size() / COVERAGE_PAGE_WORDS;
+                    bits.resize(bits.size() + COVERAGE_PAGE_WORDS, 0);
+                }
+                bits[page*COVERAGE_PAGE_WORDS + ((c & 0xff) >> 5)] |= 1u << (c & 31);
+            }
+            c = FT_Get_Next_Char(face, c, &gindex);
+        }
+    }
+
+    bool covers(unsigned c) const {
+        if(c >= COVERAGE_LIMIT)
+            return false;
+        unsigned page = pages[c >> COVERAGE_PAGE_SHIFT];
+        return (bits[page*COVERAGE_PAGE_WORDS + ((c & 0xff) >> 5)] >> (c & 31)) & 1;
+    }
+};
+
+struct FontFace {
+    FT_Face face;
+    const void* data; // The font file, either mapped by FontSystem or owned by the caller
+    size_t data_size;
+    unsigned data_id; // From FontSystem::newDataId()
+    hb_font_t* ft_font;
+    hb_font_t* font; // Locked sub-font of ft_font; this is the one to shape with
+    Mutex* lock;
+    FaceCoverage coverage;
+    int ink_x0, ink_y0, ink_x1, ink_y1; // Bounds of every glyph's bitmap around the pen, in pixels, at the current size
+
+    void createFonts() {
+        ft_font = hb_ft_font_create(face, 0);
+        font = hb_font_create_sub_font(ft_font);
+        hb_font_set_funcs(font, FontSystem::instance().locked_funcs, lock, 0);
+    }
+
+    void destroyFonts() {
+        hb_font_destroy(font);
+        hb_font_destroy(ft_font);
+    }
+
+    // The bounds are a pixel larger than the font's bounding box, to leave room for hinting
+    void measureInk() {
+        if(FT_IS_SCALABLE(face)) {
+            FT_Fixed x_scale = face->size->metrics.x_scale;
+            FT_Fixed y_scale = face->size->metrics.y_scale;
+            ink_x0 = int(floor(FT_MulFix(face->bbox.xMin, x_scale) / 64.0)) - 1;
+            ink_y0 = int(floor(FT_MulFix(face->bbox.yMin, y_scale) / 64.0)) - 1;
+            ink_x1 = int(ceil(FT_MulFix(face->bbox.xMax, x_scale) / 64.0)) + 1;
+            ink_y1 = int(ceil(FT_MulFix(face->bbox.yMax, y_scale) / 64.0)) + 1;
+        } else {
+            // Bitmap fonts have no bounding box, so allow a glyph to reach a whole line beyond its cell
+            int advance = int(face->size->metrics.max_advance >> 6);
+            int height = int(face->size->metrics.height >> 6);
+            ink_x0 = -advance;
+            ink_x1 = 2*advance;
+            ink_y0 = int(face->size->metrics.descender >> 6) - height;
+            ink_y1 = int(face->size->metrics.ascender >> 6) + height;
+        }
+    }
+};
+
+/// A span of UTF-8 text that is shaped with a single face, bidi level and script
+struct TextRun {
+    unsigned face;
+    unsigned offset;
+    unsigned length;
+    unsigned char level;
+    hb_script_t script;
+};
+
+typedef std::pair<unsigned, FT_UInt> GlyphKey;
+typedef std::map<GlyphKey, unsigned> GlyphMap;
+
+// Shaped strings are remembered per font, most recently used first. Only short strings are kept, since
+// those are the labels and UI text that get drawn again every frame.
+#define SHAPE_CACHE_ENTRIES 256
+#define SHAPE_CACHE_MAX_LENGTH 256
+
+typedef std::list<std::string> ShapeCacheOrder;
+
+struct ShapeCacheEntry {
+    ShapedText shaped;
+    ShapeCacheOrder::iterator age;
+};
+
+typedef std::map<std::string, ShapeCacheEntry> ShapeCache;
+
+// A new glyph cache has vertex and index buffers for this many glyphs, and doubles them as it fills
+#define CACHE_INITIAL_GLYPHS 64
+
+struct FontPimpl;
+struct DocumentWorker;
+static void enforceMemoryBudget(FontPimpl* keep);
+
 struct FontPimpl {
-    std::string filename;
+    unsigned refs; // Fonts sharing this one, through Font::share()
+    std::vector<FontSource> sources;
     unsigned size;
-    FT_Face face;
-    hb_font_t* font;
+    std::vector<FontFace> faces;
 
     GLuint vao;
     GLuint vbo;
     GLuint ibo;
     GLuint tex;
+    GLuint trim_vao; // Stream buffer for quads trimmed to a clip rectangle, created on first use
+    GLuint trim_vbo;
+    bool cache_live;         // The texture and buffers above exist
+    bool shared;             // Glyphs go in the FontSystem's shared atlas, and tex is not used
+    unsigned buffer_glyphs;  // Glyphs vbo and ibo have room for
+    unsigned long long last_used;
 
     GLuint texpos_x;
     GLuint texpos_y;
     GLuint num_glyphs_cached;
 
-    unsigned window_w, window_h;
-
     short y_size;
     short x_size;
 
-    unsigned pen_x, pen_y;
-
     unsigned cache_w, cache_h;
 
-    float pen_r, pen_g, pen_b;
+    GlyphMap glyphs;
+    std::set<GlyphKey> deferred;       // Glyphs drawn over the rasterization budget, to be cached in a later frame
+    std::vector<GlyphVert> slot_verts; // The quad of each cache slot, as uploaded to vbo
+    unsigned generation;               // Bumped whenever the cache is rebuilt and its slots change
+
+    ShapeCache shape_cache;
+    ShapeCacheOrder shape_cache_order;
+    Mutex shape_cache_lock;
 
-    std::map<FT_UInt, unsigned> glyphs;
+    // shapeDocument() workers between calls. They keep their faces, and with them HarfBuzz's plans and lookup
+    // tables, so only the first document shaped on each thread pays for building those.
+    std::vector<DocumentWorker*> idle_workers;
+    Mutex workers_lock;
+
+    FontStats stats;
+
+    // Counters are kept per font and for the whole FontSystem
+    void count(unsigned long long FontStats::*counter, unsigned long long amount) {
+        atomicAdd(stats.*counter, amount);
+        atomicAdd(FontSystem::instance().totals.*counter, amount);
+    }
+
+    // In the shared atlas, the glyph count is only limited by the 16-bit indices
+    unsigned maxGlyphs() const {
+        if(shared)
+            return std::min(65536u / 4, (textureWidth() / x_size)*(textureHeight() / y_size));
+        return (cache_w / x_size)*(cache_h / y_size);
+    }
+
+    GLuint texture() const {
+        return shared ? FontSystem::instance().atlas.tex : tex;
+    }
+
+    unsigned textureWidth() const {
+        return shared ? FontSystem::instance().atlas.w : cache_w;
+    }
+
+    unsigned textureHeight() const {
+        return shared ? FontSystem::instance().atlas.h : cache_h;
+    }
     
     void init() {
         FontSystem& system = FontSystem::instance();
-        FT_Error error;
-        error = FT_New_Face(system.library, filename.c_str(), 0, &face);
-        if(error) {
-            throw FtException();
+        faces.clear();
+        clearShapeCache();
+        for(unsigned i = 0; i < sources.size(); i++) {
+            const FontSource& source = sources[i];
+            FontFace f;
+            f.data = source.data;
+            f.data_size = source.size;
+            if(source.filename.empty())
+                f.data_id = system.newDataId();
+            else if(!system.mapFile(source.filename, f.data, f.data_size, f.data_id)) {
+                cleanupFaces();
+                throw FtException();
+            }
+            FT_Error error = system.newFace(f.data, f.data_size, source.index, &f.face);
+            if(!error) {
+                error = FT_Set_Pixel_Sizes(f.face, 0, size);
+                if(error)
+                    system.doneFace(f.face);
+            }
+            if(error) {
+                if(!source.filename.empty())
+                    system.unmapFile(source.filename);
+                cleanupFaces();
+                throw FtException();
+            }
+            f.lock = new Mutex;
+            f.createFonts();
+            f.measureInk();
+            faces.push_back(f);
+            faces.back().coverage.build(f.face);
         }
-        error = FT_Set_Pixel_Sizes(face, 0, size);
-        if(error) {
-            FT_Done_Face(face);
-            throw FtException();
+        initCache();
+    }
+
+    // Glyph slots must be large enough for the largest glyph of any face in the chain
+    void initCache() {
+        FontSystem& system = FontSystem::instance();
+        y_size = 0;
+        x_size = 0;
+        for(unsigned i = 0; i < faces.size(); i++) {
+            FT_Face face = faces[i].face;
+            double size_y = double(face->height) * double(face->size->metrics.y_ppem) / double(face->units_per_EM);
+            double size_x = double(face->max_advance_width) * double(face->size->metrics.y_ppem) / double(face->units_per_EM);
+            if(ceil(size_y) > y_size)
+                y_size = ceil(size_y);
+            if(ceil(size_x) > x_size)
+                x_size = ceil(size_x);
         }
-            
-        font = hb_ft_font_create(face, 0);
-        
-        double size_y = double(face->height) * double(face->size->metrics.y_ppem) / double(face->units_per_EM);
-        double size_x = double(face->max_advance_width) * double(face->size->metrics.y_ppem) / double(face->units_per_EM);
-        y_size = ceil(size_y);
-        x_size = ceil(size_x);
         
         texpos_x = 0;
         texpos_y = 0;
         num_glyphs_cached = 0;
+        slot_verts.clear();
+        generation++;
+        cache_live = false;
+        shared = system.atlas.w != 0;
         
-        short max_glyphs = (cache_w / x_size)*(cache_h / y_size);
-        
+        short max_glyphs = maxGlyphs();
+        {
+            ScopedLock lock(system.stats_lock);
+            stats.atlas_glyphs = 0;
+            stats.atlas_capacity = max_glyphs;
+            stats.atlas_pixels_used = 0;
+            stats.atlas_pixels_held = 0;
+            system.totals.atlas_capacity += max_glyphs;
+        }
+    }
+
+    // The texture and buffers are only created once a glyph is needed, and the buffers start small and grow with the cache.
+    // Fonts that are only used for shaping never allocate any of it.
+    void ensureCache() {
+        if(cache_live)
+            return;
+        buffer_glyphs = std::min<unsigned>(CACHE_INITIAL_GLYPHS, maxGlyphs());
+        trim_vao = 0;
+        trim_vbo = 0;
         gltextGenVertexArrays(1, &vao);
         gltextGenBuffers(1, &vbo);
         gltextGenBuffers(1, &ibo);
         gltextBindVertexArray(vao);
         gltextBindBuffer(GL_ARRAY_BUFFER, vbo);
         gltextBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-        gltextBufferData(GL_ARRAY_BUFFER, GLYPH_VERT_SIZE*max_glyphs, NULL, GL_DYNAMIC_DRAW);
-        gltextBufferData(GL_ELEMENT_ARRAY_BUFFER, GLYPH_IDX_SIZE*max_glyphs, NULL, GL_DYNAMIC_DRAW);
+        gltextBufferData(GL_ARRAY_BUFFER, GLYPH_VERT_SIZE*buffer_glyphs, NULL, GL_DYNAMIC_DRAW);
+        gltextBufferData(GL_ELEMENT_ARRAY_BUFFER, GLYPH_IDX_SIZE*buffer_glyphs, NULL, GL_DYNAMIC_DRAW);
         gltextEnableVertexAttribArray(0);
         gltextEnableVertexAttribArray(1);
         gltextVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), 0);
         gltextVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), (GLvoid*)(2*sizeof(float)));
-        
-        gltextActiveTexture(GL_TEXTURE0);
-        glGenTextures(1, &tex);
-        glBindTexture(GL_TEXTURE_2D, tex);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, cache_w, cache_h, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        SharedAtlas& atlas = FontSystem::instance().atlas;
+        if(!shared)
+            tex = createCacheTexture(cache_w, cache_h);
+        else if(!atlas.tex)
+            atlas.tex = createCacheTexture(atlas.w, atlas.h);
+        cache_live = true;
+        count(&FontStats::bytes_uploaded, cacheBytes());
+        enforceMemoryBudget(this);
+    }
+
+    // Called with vao bound, when the buffers are full. The quads are rewritten from slot_verts, and the indices regenerated.
+    void growBuffers() {
+        buffer_glyphs = std::min(buffer_glyphs*2, maxGlyphs());
+        std::vector<GLushort> indices(buffer_glyphs*6);
+        for(unsigned i = 0; i < buffer_glyphs; i++) {
+            GLushort quad[6] = { GLushort(i*4+0), GLushort(i*4+2), GLushort(i*4+3), GLushort(i*4+0), GLushort(i*4+3), GLushort(i*4+1) };
+            std::copy(quad, quad + 6, &indices[i*6]);
+        }
+        gltextBindBuffer(GL_ARRAY_BUFFER, vbo);
+        gltextBufferData(GL_ARRAY_BUFFER, GLYPH_VERT_SIZE*buffer_glyphs, NULL, GL_DYNAMIC_DRAW);
+        if(!slot_verts.empty())
+            gltextBufferSubData(GL_ARRAY_BUFFER, 0, slot_verts.size()*sizeof(GlyphVert), &slot_verts[0]);
+        gltextBufferData(GL_ELEMENT_ARRAY_BUFFER, GLYPH_IDX_SIZE*buffer_glyphs, &indices[0], GL_DYNAMIC_DRAW);
+        count(&FontStats::bytes_uploaded, slot_verts.size()*sizeof(GlyphVert) + GLYPH_IDX_SIZE*buffer_glyphs);
+        enforceMemoryBudget(this);
+    }
+
+    // GPU memory held by the glyph cache, and its copy of the quads
+    size_t cacheBytes() const {
+        if(!cache_live)
+            return 0;
+        return (shared ? 0 : size_t(cache_w)*cache_h) + (GLYPH_VERT_SIZE + GLYPH_IDX_SIZE)*buffer_glyphs + slot_verts.capacity()*sizeof(GlyphVert);
+    }
+
+    // Empties the glyph cache and frees its memory. It is created again when it is next needed.
+    void dropCache() {
+        if(!cache_live)
+            return;
+        count(&FontStats::cache_evictions, glyphs.size());
+        glyphs.clear();
+        cleanupCache();
+        initCache();
     }
 
     void cleanup() {
-        hb_font_destroy(font);
-        glDeleteTextures(1, &tex);
+        FontSystem& system = FontSystem::instance();
+        system.deferred_fonts.erase(this);
+        system.fonts.erase(this);
+        cleanupCache();
+        closeWorkers();
+        cleanupFaces();
+    }
+
+    DocumentWorker* takeWorker();
+    void returnWorkers(const std::vector<DocumentWorker*>& workers);
+    void closeWorkers();
+
+    // Marks the font as just used, for the memory budget, and makes sure it has a cache
+    void use() {
+        ensureCache();
+        last_used = ++FontSystem::instance().use_tick;
+    }
+
+    // cacheGlyph() renders into the bound texture and writes through the bound buffers
+    void bindCache() {
+        use();
+        gltextActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture());
+        gltextBindVertexArray(vao);
+        gltextBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    }
+
+    void defer(GlyphKey key) {
+        if(deferred.insert(key).second)
+            count(&FontStats::glyphs_deferred, 1);
+        FontSystem::instance().deferred_fonts.insert(this);
+    }
+
+    void cleanupCache() {
+        ScopedLock lock(FontSystem::instance().stats_lock);
+        FontStats& totals = FontSystem::instance().totals;
+        totals.atlas_glyphs -= stats.atlas_glyphs;
+        totals.atlas_capacity -= stats.atlas_capacity;
+        totals.atlas_pixels_used -= stats.atlas_pixels_used;
+        totals.atlas_pixels_held -= stats.atlas_pixels_held;
+        if(!cache_live)
+            return;
+        if(!shared)
+            glDeleteTextures(1, &tex);
         gltextDeleteBuffers(1, &vbo);
         gltextDeleteBuffers(1, &ibo);
         gltextDeleteVertexArrays(1, &vao);
+        if(trim_vao) {
+            gltextDeleteBuffers(1, &trim_vbo);
+            gltextDeleteVertexArrays(1, &trim_vao);
+        }
+        cache_live = false;
     }
 
-    std::map<FT_UInt, unsigned>::iterator cacheGlyph(FT_UInt codepoint)
-    {
-        if(num_glyphs_cached == (cache_w / x_size)*(cache_h / y_size)) {
-            throw CacheOverflowException();
+    // Draws quads given in window pixels as triangles, through the stream buffer
+    void drawTrimmed(const std::vector<GlyphVert>& verts) {
+        if(!trim_vao) {
+            gltextGenVertexArrays(1, &trim_vao);
+            gltextGenBuffers(1, &trim_vbo);
+            gltextBindVertexArray(trim_vao);
+            gltextBindBuffer(GL_ARRAY_BUFFER, trim_vbo);
+            gltextEnableVertexAttribArray(0);
+            gltextEnableVertexAttribArray(1);
+            gltextVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), 0);
+            gltextVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), (GLvoid*)(2*sizeof(float)));
+        } else {
+            gltextBindVertexArray(trim_vao);
+            gltextBindBuffer(GL_ARRAY_BUFFER, trim_vbo);
         }
-        FT_Error error;
-        error = FT_Load_Glyph(face, codepoint, FT_LOAD_RENDER);
-        if(error) {
-            throw FtException();
+        gltextBufferData(GL_ARRAY_BUFFER, verts.size()*sizeof(GlyphVert), &verts[0], GL_STREAM_DRAW);
+        count(&FontStats::bytes_uploaded, verts.size()*sizeof(GlyphVert));
+        gltextUniform2i(FontSystem::instance().pos_loc, 0, 0);
+        glDrawArrays(GL_TRIANGLES, 0, verts.size());
+        gltextBindVertexArray(vao);
+        gltextBindBuffer(GL_ARRAY_BUFFER, vbo);
+    }
+
+    void cleanupFaces() {
+        FontSystem& system = FontSystem::instance();
+        for(unsigned i = 0; i < faces.size(); i++) {
+            faces[i].destroyFonts();
+            delete faces[i].lock;
+            system.doneFace(faces[i].face);
+            // Nothing else can draw this data's glyphs, so they leave the shared atlas with it
+            if(sources[i].filename.empty() || system.unmapFile(sources[i].filename))
+                system.atlas.forget(faces[i].data_id);
         }
-        if(face->glyph->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY) {
-            throw BadFontFormatException();
+        faces.clear();
+    }
+
+    void resize(unsigned new_size) {
+        for(unsigned i = 0; i < faces.size(); i++) {
+            if(FT_Set_Pixel_Sizes(faces[i].face, 0, new_size))
+                throw FtException();
         }
-        int pitch = face->glyph->bitmap.pitch;
-        bool need_inverse_texcoords = true;
-        if(pitch < 0) {
-            pitch = -pitch;
-            need_inverse_texcoords = false;
-        } 
-        glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch);
-        if(texpos_x + face->glyph->bitmap.width > cache_w) {
-            texpos_x = 0;
-            texpos_y += y_size;
+        size = new_size;
+        closeWorkers();
+        for(unsigned i = 0; i < faces.size(); i++) {
+            faces[i].destroyFonts();
+            faces[i].createFonts();
+            faces[i].measureInk();
         }
-        glTexSubImage2D(GL_TEXTURE_2D, 0, texpos_x, texpos_y, face->glyph->bitmap.width, face->glyph->bitmap.rows, GL_RED, GL_UNSIGNED_BYTE, face->glyph->bitmap.buffer);
-    
-        float hori_offset = face->glyph->bitmap_left;
-        float vert_offset = face->glyph->bitmap_top - face->glyph->bitmap.rows;
-    
-        GlyphVert corners[4];
-        GlyphVert& bl = corners[0];
-        GlyphVert& ul = corners[1];
-        GlyphVert& br = corners[2];
-        GlyphVert& ur = corners[3];
-        bl.x = 0.0f + hori_offset;
-        bl.y = 0.0f + vert_offset;
-        bl.s = float(texpos_x)/float(cache_w);
-        if(need_inverse_texcoords)
-            bl.t = float(texpos_y+face->glyph->bitmap.rows)/float(cache_h);
-        else
-            bl.t = float(texpos_y)/float(cache_h);
-        br.x = face->glyph->bitmap.width + hori_offset;
-        br.y = 0.0f + vert_offset;
-        br.s = float(texpos_x+face->glyph->bitmap.width)/float(cache_w);
-        br.t = bl.t;
-        ul.x = 0.0f + hori_offset;
-        ul.y = face->glyph->bitmap.rows + vert_offset;
+        clearShapeCache();
+    }
+
+    // Letters go to the first face that covers them. Spaces, punctuation and combining marks stay
+    // with the current face when it covers them, so they do not break runs. Characters no face
+    // covers stay with the current face.
+    unsigned pickFace(unsigned c, unsigned current) const {
+        if(isNeutral(c) && faces[current].coverage.covers(c))
+            return current;
+        for(unsigned i = 0; i < faces.size(); i++) {
+            if(faces[i].coverage.covers(c))
+                return i;
+        }
+        return current;
+    }
+
+    static bool isNeutral(unsigned c) {
+        if(c < 0x80)
+            return !((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'));
+        return (c >= 0x0300 && c < 0x0370) || (c >= 0x2000 && c < 0x2070) || (c >= 0x3000 && c < 0x3040);
+    }
+
+    // Splits text[offset, offset+length) into runs of a single bidi level and script, then splits those by face
+    void itemize(const std::string& text, unsigned offset, unsigned length, std::vector<ScriptRun>& script_runs,
+                 std::vector<TextRun>& runs) const {
+        itemizeParagraph(text, offset, length, script_runs);
+        splitByFace(text, script_runs, 0, script_runs.size(), runs);
+    }
+
+    // Splits script_runs[first, last) into runs of a single face
+    void splitByFace(const std::string& text, const std::vector<ScriptRun>& script_runs, unsigned first, unsigned last,
+                     std::vector<TextRun>& runs) const {
+        runs.clear();
+        unsigned current = 0;
+        for(unsigned r = first; r < last; r++) {
+            const ScriptRun& sr = script_runs[r];
+            if(faces.size() == 1) {
+                TextRun run = { 0, sr.offset, sr.length, sr.level, sr.script };
+                runs.push_back(run);
+                continue;
+            }
+            size_t i = sr.offset;
+            unsigned start_run = runs.size();
+            while(i < sr.offset + sr.length) {
+                size_t start = i;
+                current = pickFace(decodeUtf8(text, i), current);
+                if(runs.size() == start_run || runs.back().face != current) {
+                    TextRun run = { current, unsigned(start), 0, sr.level, sr.script };
+                    runs.push_back(run);
+                }
+                runs.back().length = i - runs.back().offset;
+            }
+        }
+    }
+
+    // Shapes text[offset, offset+length) and appends the glyphs and runs to shaped. fonts holds one hb_font per face.
+    // Clusters are byte offsets from the start of text.
+    void shapeRange(hb_font_t* const* fonts, hb_buffer_t* buffer, std::vector<ScriptRun>& script_runs, std::vector<TextRun>& runs,
+                    const std::string& text, unsigned offset, unsigned length, ShapedText& shaped) const {
+        itemize(text, offset, length, script_runs, runs);
+        shapeRuns(fonts, buffer, text, runs, shaped);
+    }
+
+    // Shapes already itemized runs and appends the glyphs and runs to shaped
+    void shapeRuns(hb_font_t* const* fonts, hb_buffer_t* buffer, const std::string& text, const std::vector<TextRun>& runs,
+                   ShapedText& shaped) const {
+        hb_unicode_funcs_t* unicode_funcs = FontSystem::instance().unicode_funcs;
+        for(unsigned r = 0; r < runs.size(); r++) {
+            hb_buffer_reset(buffer);
+            hb_buffer_set_unicode_funcs(buffer, unicode_funcs);
+            hb_buffer_set_direction(buffer, (runs[r].level & 1) ? HB_DIRECTION_RTL : HB_DIRECTION_LTR);
+            hb_buffer_set_script(buffer, runs[r].script);
+            hb_buffer_add_utf8(buffer, text.c_str(), text.size(), runs[r].offset, runs[r].length);
+            hb_shape(fonts[runs[r].face], buffer, NULL, 0);
+
+            unsigned len = hb_buffer_get_length(buffer);
+            hb_glyph_info_t* infos = hb_buffer_get_glyph_infos(buffer, 0);
+            hb_glyph_position_t* positions = hb_buffer_get_glyph_positions(buffer, 0);
+            GlyphRun glyph_run = { unsigned(shaped.glyphs.size()), len, runs[r].level };
+            shaped.runs.push_back(glyph_run);
+            for(unsigned i = 0; i < len; i++) {
+                Glyph g;
+                g.face = runs[r].face;
+                g.index = infos[i].codepoint;
+                g.cluster = infos[i].cluster;
+                g.x_offset = positions[i].x_offset >> 6;
+                g.y_offset = positions[i].y_offset >> 6;
+                g.x_advance = positions[i].x_advance >> 6;
+                g.y_advance = positions[i].y_advance >> 6;
+                shaped.x_advance += g.x_advance;
+                shaped.y_advance += g.y_advance;
+                shaped.glyphs.push_back(g);
+            }
+        }
+    }
+
+    // Safe to call from any thread, as long as the font is not being reconfigured at the same time
+    void shape(const std::string& text, ShapedText& shaped) {
+        bool cacheable = text.size() <= SHAPE_CACHE_MAX_LENGTH;
+        if(cacheable && findShaped(text, shaped)) {
+            count(&FontStats::shape_cache_hits, 1);
+            return;
+        }
+        shapeSpan(text, 0, text.size(), shaped);
+        count(&FontStats::shape_cache_misses, 1);
+        if(cacheable)
+            storeShaped(text, shaped);
+    }
+
+    // Shapes text[offset, offset+length) into shaped, bypassing the shape cache. Clusters are byte offsets from the start of text.
+    void shapeSpan(const std::string& text, unsigned offset, unsigned length, ShapedText& shaped) {
+        std::vector<hb_font_t*> fonts(faces.size());
+        for(unsigned i = 0; i < faces.size(); i++)
+            fonts[i] = faces[i].font;
+        std::vector<ScriptRun> script_runs;
+        std::vector<TextRun> runs;
+        shaped.glyphs.clear();
+        shaped.runs.clear();
+        shaped.x_advance = 0;
+        shaped.y_advance = 0;
+
+        hb_buffer_t* buffer = hb_buffer_create();
+        unsigned long long start = nanoTime();
+        shapeRange(&fonts[0], buffer, script_runs, runs, text, offset, length, shaped);
+        count(&FontStats::shape_ns, nanoTime() - start);
+        hb_buffer_destroy(buffer);
+    }
+
+    bool findShaped(const std::string& text, ShapedText& shaped) {
+        ScopedLock lock(shape_cache_lock);
+        ShapeCache::iterator i = shape_cache.find(text);
+        if(i == shape_cache.end())
+            return false;
+        shape_cache_order.splice(shape_cache_order.begin(), shape_cache_order, i->second.age);
+        shaped = i->second.shaped;
+        return true;
+    }
+
+    void storeShaped(const std::string& text, const ShapedText& shaped) {
+        ScopedLock lock(shape_cache_lock);
+        if(shape_cache.count(text))
+            return;
+        if(shape_cache.size() == SHAPE_CACHE_ENTRIES) {
+            shape_cache.erase(shape_cache_order.back());
+            shape_cache_order.pop_back();
+        }
+        shape_cache_order.push_front(text);
+        ShapeCacheEntry& entry = shape_cache[text];
+        entry.shaped = shaped;
+        entry.age = shape_cache_order.begin();
+    }
+
+    void clearShapeCache() {
+        ScopedLock lock(shape_cache_lock);
+        shape_cache.clear();
+        shape_cache_order.clear();
+    }
+
+    // Renders a glyph with Freetype. The face must be locked.
+    FT_GlyphSlot rasterize(GlyphKey key) {
+        FT_Face face = faces[key.first].face;
+        unsigned long long start = nanoTime();
+        FT_Error error = FT_Load_Glyph(face, key.second, FT_LOAD_RENDER);
+        count(&FontStats::rasterize_ns, nanoTime() - start);
+        if(error) {
+            throw FtException();
+        }
+        if(face->glyph->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY) {
+            throw BadFontFormatException();
+        }
+        count(&FontStats::glyphs_rasterized, 1);
+        return face->glyph;
+    }
+
+    // Uploads a rendered glyph to the bound texture at x,y
+    void upload(FT_GlyphSlot slot, unsigned x, unsigned y, AtlasGlyph& placed) {
+        int pitch = slot->bitmap.pitch;
+        placed.inverse = true;
+        if(pitch < 0) {
+            pitch = -pitch;
+            placed.inverse = false;
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, slot->bitmap.width, slot->bitmap.rows, GL_RED, GL_UNSIGNED_BYTE, slot->bitmap.buffer);
+        count(&FontStats::bytes_uploaded, slot->bitmap.width*slot->bitmap.rows);
+        placed.x = x;
+        placed.y = y;
+        placed.w = slot->bitmap.width;
+        placed.h = slot->bitmap.rows;
+        placed.left = slot->bitmap_left;
+        placed.top = slot->bitmap_top;
+    }
+
+    // Puts a glyph in this font's own texture, in the next free slot
+    void placeOwn(GlyphKey key, AtlasGlyph& placed) {
+        FT_GlyphSlot slot = rasterize(key);
+        if(texpos_x + slot->bitmap.width > cache_w) {
+            texpos_x = 0;
+            texpos_y += y_size;
+        }
+        upload(slot, texpos_x, texpos_y, placed);
+        texpos_x += x_size;
+    }
+
+    // Finds a glyph in the shared atlas, or renders it into the shortest shelf it fits
+    void placeShared(GlyphKey key, AtlasGlyph& placed) {
+        SharedAtlas& atlas = FontSystem::instance().atlas;
+        AtlasKey atlas_key = { faces[key.first].data_id, sources[key.first].index, size, key.second };
+        std::map<AtlasKey, AtlasGlyph>::iterator found = atlas.glyphs.find(atlas_key);
+        if(found != atlas.glyphs.end()) {
+            placed = found->second;
+            return;
+        }
+        FT_GlyphSlot slot = rasterize(key);
+        unsigned x, y;
+        if(!atlas.allocate(slot->bitmap.width, slot->bitmap.rows, x, y))
+            throw CacheOverflowException();
+        upload(slot, x, y, placed);
+        atlas.glyphs.insert(std::make_pair(atlas_key, placed));
+    }
+
+    GlyphMap::iterator cacheGlyph(GlyphKey key)
+    {
+        ScopedLock face_lock(*faces[key.first].lock);
+        if(num_glyphs_cached == maxGlyphs()) {
+            throw CacheOverflowException();
+        }
+        CacheGlyphProbe probe(this, key.second);
+        if(num_glyphs_cached == buffer_glyphs)
+            growBuffers();
+        AtlasGlyph placed;
+        if(shared)
+            placeShared(key, placed);
+        else
+            placeOwn(key, placed);
+        count(&FontStats::bytes_uploaded, GLYPH_VERT_SIZE + GLYPH_IDX_SIZE);
+    
+        float hori_offset = placed.left;
+        float vert_offset = placed.top - int(placed.h);
+        float tex_w = textureWidth();
+        float tex_h = textureHeight();
+    
+        GlyphVert corners[4];
+        GlyphVert& bl = corners[0];
+        GlyphVert& ul = corners[1];
+        GlyphVert& br = corners[2];
+        GlyphVert& ur = corners[3];
+        bl.x = 0.0f + hori_offset;
+        bl.y = 0.0f + vert_offset;
+        bl.s = float(placed.x)/tex_w;
+        if(placed.inverse)
+            bl.t = float(placed.y+placed.h)/tex_h;
+        else
+            bl.t = float(placed.y)/tex_h;
+        br.x = placed.w + hori_offset;
+        br.y = 0.0f + vert_offset;
+        br.s = float(placed.x+placed.w)/tex_w;
+        br.t = bl.t;
+        ul.x = 0.0f + hori_offset;
+        ul.y = placed.h + vert_offset;
         ul.s = bl.s;
-        if(need_inverse_texcoords)
-            ul.t = float(texpos_y)/float(cache_h);
+        if(placed.inverse)
+            ul.t = float(placed.y)/tex_h;
         else
-            ul.t = float(texpos_y+face->glyph->bitmap.rows)/float(cache_h);
+            ul.t = float(placed.y+placed.h)/tex_h;
         ur.x = br.x;
         ur.y = ul.y;
         ur.s = br.s;
@@ -333,174 +1441,1394 @@ struct FontPimpl {
         short glyph_offset = num_glyphs_cached * 4;
         unsigned short indices[6] = {glyph_offset+0, glyph_offset+2, glyph_offset+3, glyph_offset+0, glyph_offset+3, glyph_offset+1};
         gltextBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(num_glyphs_cached*GLYPH_VERT_SIZE), GLYPH_VERT_SIZE, corners);
+        slot_verts.insert(slot_verts.end(), corners, corners + 4);
         gltextBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (GLintptr)(num_glyphs_cached*GLYPH_IDX_SIZE), GLYPH_IDX_SIZE, indices);
-        texpos_x += x_size;
         num_glyphs_cached++;
-        return glyphs.insert(std::make_pair(codepoint, num_glyphs_cached-1)).first;
+
+        ScopedLock stats_lock(FontSystem::instance().stats_lock);
+        FontStats& totals = FontSystem::instance().totals;
+        unsigned long long pixels_used = placed.w*placed.h;
+        unsigned long long pixels_held = shared ? (placed.w+1)*(placed.h+1) : x_size*y_size;
+        stats.atlas_glyphs++;
+        stats.atlas_pixels_used += pixels_used;
+        stats.atlas_pixels_held += pixels_held;
+        totals.atlas_glyphs++;
+        totals.atlas_pixels_used += pixels_used;
+        totals.atlas_pixels_held += pixels_held;
+        return glyphs.insert(std::make_pair(key, num_glyphs_cached-1)).first;
+    }
+};
+
+// The part of memoryUsage() that dropping caches can give back. Faces and font files stay while their Fonts do.
+static size_t reclaimableBytes() {
+    FontSystem& system = FontSystem::instance();
+    size_t bytes = 0;
+    for(std::set<FontPimpl*>::iterator f = system.fonts.begin(); f != system.fonts.end(); ++f)
+        bytes += (*f)->cacheBytes();
+    if(system.atlas.tex)
+        bytes += size_t(system.atlas.w)*system.atlas.h;
+    return bytes;
+}
+
+// Drops the glyph caches of the least recently used fonts until the memory budget is met. The font being drawn is kept.
+// Dropping a Font's cache leaves its glyphs in the shared atlas, so once no cache is left to drop, the atlas is emptied
+// along with the caches of every Font using it. That waits for a call where the font being drawn does not use the atlas,
+// such as the one at the start of each frame.
+static void enforceMemoryBudget(FontPimpl* keep) {
+    FontSystem& system = FontSystem::instance();
+    if(!system.memory_budget)
+        return;
+    size_t bytes = reclaimableBytes();
+    while(bytes > system.memory_budget) {
+        FontPimpl* oldest = 0;
+        for(std::set<FontPimpl*>::iterator f = system.fonts.begin(); f != system.fonts.end(); ++f) {
+            if(*f != keep && (*f)->cache_live && (!oldest || (*f)->last_used < oldest->last_used))
+                oldest = *f;
+        }
+        if(!oldest) {
+            SharedAtlas& atlas = system.atlas;
+            if(!atlas.tex || (keep && keep->shared))
+                return;
+            for(std::set<FontPimpl*>::iterator f = system.fonts.begin(); f != system.fonts.end(); ++f) {
+                if((*f)->shared)
+                    (*f)->dropCache();
+            }
+            atlas.reset();
+            return;
+        }
+        oldest->dropCache();
+        size_t left = reclaimableBytes();
+        if(left >= bytes)
+            return;
+        bytes = left;
+    }
+}
+
+// Lines longer than this are split between runs, or at a space inside a long run, so that a single huge line
+// still spreads over the workers
+#define DOCUMENT_PIECE_SIZE 2048
+// Pieces are handed to workers in tasks of about this many bytes
+#define DOCUMENT_TASK_SIZE 8192
+
+/// A span of one line of a document that is shaped on its own
+struct DocumentPiece {
+    unsigned line;
+    unsigned line_start;
+    unsigned offset;
+    unsigned length;
+    unsigned first_run; // Pieces of a split line use the runs [first_run, last_run) of the job, resolved for the
+    unsigned last_run;  // whole line. A line that fits in one piece has no runs and is itemized by its worker.
+};
+
+struct DocumentJob;
+
+/// One shaping thread. Each worker has its own Freetype faces and hb_buffer, so workers never share mutable state.
+struct DocumentWorker {
+    DocumentJob* job;
+    unsigned id;
+    Thread thread;
+    bool started;
+
+    Mutex lock;
+    std::deque<unsigned> tasks;
+
+    std::vector<FT_Face> faces;
+    std::vector<hb_font_t*> fonts;
+    hb_buffer_t* buffer;
+    unsigned long long shape_ns;
+
+    DocumentWorker() : started(false), buffer(0), shape_ns(0) {}
+
+    void open(const FontPimpl& font) {
+        FontSystem& system = FontSystem::instance();
+        for(unsigned i = 0; i < font.faces.size(); i++) {
+            FT_Face face;
+            if(system.newFace(font.faces[i].data, font.faces[i].data_size, font.sources[i].index, &face))
+                throw FtException();
+            faces.push_back(face);
+            if(FT_Set_Pixel_Sizes(face, 0, font.size))
+                throw FtException();
+            fonts.push_back(hb_ft_font_create(face, 0));
+        }
+        buffer = hb_buffer_create();
+    }
+
+    void close() {
+        FontSystem& system = FontSystem::instance();
+        if(buffer)
+            hb_buffer_destroy(buffer);
+        for(unsigned i = 0; i < fonts.size(); i++)
+            hb_font_destroy(fonts[i]);
+        for(unsigned i = 0; i < faces.size(); i++)
+            system.doneFace(faces[i]);
+    }
+};
+
+// Opens a worker for the font's faces and size, or reuses one from an earlier call
+DocumentWorker* FontPimpl::takeWorker() {
+    {
+        ScopedLock lock(workers_lock);
+        if(!idle_workers.empty()) {
+            DocumentWorker* worker = idle_workers.back();
+            idle_workers.pop_back();
+            return worker;
+        }
+    }
+    DocumentWorker* worker = new DocumentWorker;
+    try {
+        worker->open(*this);
+    } catch(Exception&) {
+        worker->close();
+        delete worker;
+        throw;
+    }
+    return worker;
+}
+
+void FontPimpl::returnWorkers(const std::vector<DocumentWorker*>& workers) {
+    ScopedLock lock(workers_lock);
+    for(unsigned w = 0; w < workers.size(); w++) {
+        workers[w]->tasks.clear();
+        workers[w]->started = false;
+        workers[w]->shape_ns = 0;
+        idle_workers.push_back(workers[w]);
+    }
+}
+
+// Called when the faces change size or go away, and by trim()
+void FontPimpl::closeWorkers() {
+    ScopedLock lock(workers_lock);
+    for(unsigned w = 0; w < idle_workers.size(); w++) {
+        idle_workers[w]->close();
+        delete idle_workers[w];
+    }
+    idle_workers.clear();
+}
+
+struct DocumentJob {
+    const FontPimpl* font;
+    const std::string* text;
+    std::vector<DocumentPiece> pieces;
+    std::vector<ScriptRun> script_runs; // Runs of the lines that were split
+    std::vector<unsigned> task_starts; // Task t covers pieces [task_starts[t], task_starts[t+1])
+    std::vector<ShapedText> results;   // One per piece
+    std::vector<DocumentWorker*> workers;
+
+    // Levels are resolved over the whole line first, since the paragraph level and the neutral rules depend on
+    // text that may end up in another piece. Pieces then break only between runs, or inside a run that is too
+    // long by itself, where both halves keep the run's level and script.
+    void splitLine(unsigned line, size_t line_start, size_t content_end) {
+        const std::string& str = *text;
+        std::vector<ScriptRun> line_runs;
+        itemizeParagraph(str, line_start, content_end - line_start, line_runs);
+        unsigned first = script_runs.size();
+        for(unsigned r = 0; r < line_runs.size(); r++) {
+            ScriptRun run = line_runs[r];
+            while(run.length > DOCUMENT_PIECE_SIZE) {
+                size_t end = str.rfind(' ', run.offset + DOCUMENT_PIECE_SIZE);
+                if(end == std::string::npos || end <= run.offset) {
+                    // No space to break at, so break at the nearest character boundary
+                    end = run.offset + DOCUMENT_PIECE_SIZE;
+                    while(end > run.offset + 1 && (str[end] & 0xc0) == 0x80)
+                        end--;
+                } else {
+                    end++;
+                }
+                ScriptRun head = run;
+                head.length = end - run.offset;
+                script_runs.push_back(head);
+                run.offset = end;
+                run.length -= head.length;
+            }
+            script_runs.push_back(run);
+        }
+
+        while(first < script_runs.size()) {
+            unsigned last = first + 1;
+            unsigned length = script_runs[first].length;
+            while(last < script_runs.size() && length + script_runs[last].length <= DOCUMENT_PIECE_SIZE)
+                length += script_runs[last++].length;
+            DocumentPiece piece = { line, unsigned(line_start), script_runs[first].offset, length, first, last };
+            pieces.push_back(piece);
+            first = last;
+        }
+    }
+
+    void split() {
+        const std::string& str = *text;
+        unsigned line = 0;
+        size_t line_start = 0;
+        while(line_start <= str.size()) {
+            size_t line_end = str.find('\n', line_start);
+            if(line_end == std::string::npos)
+                line_end = str.size();
+            size_t content_end = line_end;
+            if(content_end > line_start && str[content_end-1] == '\r')
+                content_end--;
+
+            if(content_end - line_start <= DOCUMENT_PIECE_SIZE) {
+                DocumentPiece piece = { line, unsigned(line_start), unsigned(line_start), unsigned(content_end - line_start), 0, 0 };
+                pieces.push_back(piece);
+            } else {
+                splitLine(line, line_start, content_end);
+            }
+
+            line++;
+            line_start = line_end + 1;
+        }
+
+        unsigned task_bytes = DOCUMENT_TASK_SIZE;
+        for(unsigned i = 0; i < pieces.size(); i++) {
+            if(task_bytes >= DOCUMENT_TASK_SIZE) {
+                task_starts.push_back(i);
+                task_bytes = 0;
+            }
+            task_bytes += pieces[i].length + 1;
+        }
+        task_starts.push_back(pieces.size());
+        results.resize(pieces.size());
+    }
+
+    // Workers take tasks from the front of their own queue, and steal from the back of the others' queues
+    // once theirs is empty. No tasks are added after the workers start, so when every queue is empty the job is done.
+    bool takeTask(unsigned id, unsigned& task) {
+        DocumentWorker* self = workers[id];
+        {
+            ScopedLock lock(self->lock);
+            if(!self->tasks.empty()) {
+                task = self->tasks.front();
+                self->tasks.pop_front();
+                return true;
+            }
+        }
+        for(unsigned n = 1; n < workers.size(); n++) {
+            DocumentWorker* victim = workers[(id + n) % workers.size()];
+            ScopedLock lock(victim->lock);
+            if(!victim->tasks.empty()) {
+                task = victim->tasks.back();
+                victim->tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void run(void* arg) {
+        DocumentWorker* self = (DocumentWorker*)arg;
+        DocumentJob& job = *self->job;
+        std::vector<ScriptRun> script_runs;
+        std::vector<TextRun> runs;
+        unsigned task;
+        unsigned long long start = nanoTime();
+        while(job.takeTask(self->id, task)) {
+            for(unsigned i = job.task_starts[task]; i < job.task_starts[task+1]; i++) {
+                const DocumentPiece& piece = job.pieces[i];
+                ShapedText& shaped = job.results[i];
+                shaped.x_advance = 0;
+                shaped.y_advance = 0;
+                if(piece.first_run != piece.last_run) {
+                    job.font->splitByFace(*job.text, job.script_runs, piece.first_run, piece.last_run, runs);
+                    job.font->shapeRuns(&self->fonts[0], self->buffer, *job.text, runs, shaped);
+                } else if(piece.length) {
+                    job.font->shapeRange(&self->fonts[0], self->buffer, script_runs, runs, *job.text, piece.offset, piece.length, shaped);
+                }
+            }
+        }
+        self->shape_ns = nanoTime() - start;
     }
 };
 
-Font::Font(std::string font_file, unsigned size, unsigned cache_w, unsigned cache_h) {
-    self = new FontPimpl;
-    self->filename = font_file;
+static FontPimpl* createFont(const std::vector<FontSource>& sources, unsigned size, unsigned cache_w, unsigned cache_h) {
+    if(sources.empty())
+        throw Exception("A Font needs at least one font file");
+    FontPimpl* self = new FontPimpl;
+    self->refs = 1;
+    self->generation = 0;
+    self->last_used = 0;
+    self->stats = FontStats();
+    self->sources = sources;
     self->size = size;
     self->cache_w = cache_w;
     self->cache_h = cache_h;
-
-    // These are initialized here so that they work correctly when a font is de-inited and re-inited
-    self->pen_x = 0;
-    self->pen_y = 0;
-    self->pen_r = self->pen_g = self->pen_b = 1.0f;
     try {
         self->init();
     } catch(Exception&) {
         delete self;
-        self = 0;
         throw;
     }
+    FontSystem::instance().fonts.insert(self);
+    return self;
 }
 
+#define PEN_DEFAULTS window_w(0), window_h(0), pen_x(0), pen_y(0), pen_r(1.0f), pen_g(1.0f), pen_b(1.0f), clip(), has_clip(false), placeholder(-1)
+
+Font::Font(std::string font_file, unsigned size, unsigned cache_w, unsigned cache_h)
+    : self(createFont(std::vector<FontSource>(1, FontSource(font_file)), size, cache_w, cache_h)), PEN_DEFAULTS {}
+
+Font::Font(std::vector<std::string> font_files, unsigned size, unsigned cache_w, unsigned cache_h)
+    : self(createFont(std::vector<FontSource>(font_files.begin(), font_files.end()), size, cache_w, cache_h)), PEN_DEFAULTS {}
+
+Font::Font(const unsigned char* data, size_t data_size, unsigned size, unsigned cache_w, unsigned cache_h)
+    : self(createFont(std::vector<FontSource>(1, FontSource(data, data_size)), size, cache_w, cache_h)), PEN_DEFAULTS {}
+
+Font::Font(std::vector<FontSource> sources, unsigned size, unsigned cache_w, unsigned cache_h)
+    : self(createFont(sources, size, cache_w, cache_h)), PEN_DEFAULTS {}
+
 Font::Font()
-    : self(0) {}
+    : self(0), PEN_DEFAULTS {}
 
 Font::~Font() {
-    if(self) {
+    release();
+}
+
+// Only the GL thread creates and destroys Fonts, so the count needs no lock
+void Font::release() {
+    if(self && --self->refs == 0) {
         self->cleanup();
         delete self;
     }
+    self = 0;
 }
 
-Font::Font(const Font& rhs) {
+Font::Font(const Font& rhs)
+    : self(0), PEN_DEFAULTS {
     *this = rhs;
 }
 
-#define COPY_VAL(val) self->val = rhs.self->val
+#define COPY_VAL(val) val = rhs.val
 
+// The copy is built before the current font is released, so a failed copy leaves this Font unchanged
 Font& Font::operator=(const Font& rhs) {
-    if(self) {
-        self->cleanup();
-        if(!rhs.self) {
-            delete self;
-            self = 0;
-            return *this;
-        }
-    } else {
-        if(!rhs.self)
-            return *this;
-        self = new FontPimpl;
-    }
-    COPY_VAL(filename);
-    COPY_VAL(size);
-    COPY_VAL(cache_w);
-    COPY_VAL(cache_h);
+    if(this == &rhs)
+        return *this;
+    FontPimpl* copy = 0;
+    if(rhs.self)
+        copy = createFont(rhs.self->sources, rhs.self->size, rhs.self->cache_w, rhs.self->cache_h);
+    release();
+    self = copy;
+    COPY_VAL(window_w);
+    COPY_VAL(window_h);
     COPY_VAL(pen_x);
     COPY_VAL(pen_y);
     COPY_VAL(pen_r);
     COPY_VAL(pen_g);
     COPY_VAL(pen_b);
-    try {
-        self->init();
-    } catch(Exception&) {
-        delete self;
-        self = 0;
-        throw;
-    }
+    COPY_VAL(clip);
+    COPY_VAL(has_clip);
+    COPY_VAL(placeholder);
     return *this;
 }
 
+Font& Font::share(const Font& rhs) {
+    if(rhs.self == self)
+        return *this;
+    if(rhs.self)
+        rhs.self->refs++;
+    release();
+    self = rhs.self;
+    return *this;
+}
+
+#ifdef GLTEXT_HAS_MOVE
+Font::Font(Font&& rhs) noexcept
+    : self(rhs.self), window_w(rhs.window_w), window_h(rhs.window_h), pen_x(rhs.pen_x), pen_y(rhs.pen_y),
+      pen_r(rhs.pen_r), pen_g(rhs.pen_g), pen_b(rhs.pen_b), clip(rhs.clip), has_clip(rhs.has_clip),
+      placeholder(rhs.placeholder) {
+    rhs.self = 0;
+}
+
+Font& Font::operator=(Font&& rhs) noexcept {
+    if(this == &rhs)
+        return *this;
+    release();
+    self = rhs.self;
+    rhs.self = 0;
+    COPY_VAL(window_w);
+    COPY_VAL(window_h);
+    COPY_VAL(pen_x);
+    COPY_VAL(pen_y);
+    COPY_VAL(pen_r);
+    COPY_VAL(pen_g);
+    COPY_VAL(pen_b);
+    COPY_VAL(clip);
+    COPY_VAL(has_clip);
+    COPY_VAL(placeholder);
+    return *this;
+}
+#endif
+
 void Font::setDisplaySize(unsigned w, unsigned h) {
     if(!self)
         throw EmptyFontException();
-    self->window_w = w;
-    self->window_h = h;
+    window_w = w;
+    window_h = h;
 }
 
 void Font::setPenPosition(unsigned x, unsigned y) {
     if(!self)
         throw EmptyFontException();
-    self->pen_x = x;
-    self->pen_y = y;
+    pen_x = x;
+    pen_y = y;
 }
 
 void Font::setPenColor(float r, float g, float b) {
     if(!self)
         throw EmptyFontException();
-    self->pen_r = r;
-    self->pen_g = g;
-    self->pen_b = b;
+    pen_r = r;
+    pen_g = g;
+    pen_b = b;
+}
+
+void Font::setClipRect(const ClipRect& rect) {
+    if(!self)
+        throw EmptyFontException();
+    clip = rect;
+    has_clip = true;
+}
+
+void Font::clearClipRect() {
+    if(!self)
+        throw EmptyFontException();
+    has_clip = false;
+}
+
+void Font::setPlaceholderGlyph(int glyph) {
+    if(!self)
+        throw EmptyFontException();
+    placeholder = glyph;
 }
 
 void Font::setPointSize(unsigned int size) {
     // TODO: implement this in a slightly more performant fashion
-    self->cleanup();
-    self->size = size;
+    if(!self)
+        throw EmptyFontException();
+    self->resize(size);
+    self->cleanupCache();
+    self->count(&FontStats::cache_evictions, self->glyphs.size());
     self->glyphs.clear();
-    self->init();
+    self->initCache();
 }
 
 void Font::cacheCharacters(std::string chars) {
     if(!self)
         throw EmptyFontException();
-    hb_buffer_t* buffer = hb_buffer_create();
-    hb_buffer_set_direction(buffer, HB_DIRECTION_LTR);
-    hb_buffer_add_utf8(buffer, chars.c_str(), chars.size(), 0, chars.size());
-    hb_shape(self->font, buffer, NULL, 0);
-    
-    unsigned len = hb_buffer_get_length(buffer);
-    hb_glyph_info_t* glyphs = hb_buffer_get_glyph_infos(buffer, 0);
-    hb_glyph_position_t* positions = hb_buffer_get_glyph_positions(buffer, 0);
-
-    gltextActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, self->tex);
-    gltextBindVertexArray(self->vao);
+    ShapedText shaped;
+    self->shape(chars, shaped);
+    self->bindCache();
 
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    
-    for(unsigned i = 0; i < len; i++) {
-        std::map<FT_UInt, unsigned>::iterator g = self->glyphs.find(glyphs[i].codepoint);
+    unsigned long long hits = 0;
+    for(unsigned i = 0; i < shaped.glyphs.size(); i++) {
+        GlyphKey key(shaped.glyphs[i].face, shaped.glyphs[i].index);
+        GlyphMap::iterator g = self->glyphs.find(key);
         if(g == self->glyphs.end()) {
-            self->cacheGlyph(glyphs[i].codepoint);
+            self->count(&FontStats::cache_misses, 1);
+            self->cacheGlyph(key);
+        } else {
+            hits++;
         }
     }
+    self->count(&FontStats::cache_hits, hits);
+}
+
+ShapedText Font::shape(std::string text) const {
+    if(!self)
+        throw EmptyFontException();
+    ShapedText shaped;
+    self->shape(text, shaped);
+    return shaped;
+}
+
+int Font::measure(std::string text) const {
+    return shape(text).x_advance;
+}
+
+std::vector<ShapedText> Font::shapeDocument(const std::string& text, unsigned threads) const {
+    if(!self)
+        throw EmptyFontException();
+    if(!threads)
+        threads = cpuCount();
+
+    DocumentJob job;
+    job.font = self;
+    job.text = &text;
+    job.split();
+    unsigned num_tasks = job.task_starts.size() - 1;
+    if(threads > num_tasks)
+        threads = num_tasks;
+
+    // Each worker starts with a contiguous block of tasks, which keeps neighbouring lines on the same core
+    std::vector<DocumentWorker*>& workers = job.workers;
+    try {
+        for(unsigned w = 0; w < threads; w++) {
+            workers.push_back(self->takeWorker());
+            workers[w]->job = &job;
+            workers[w]->id = w;
+            for(unsigned t = num_tasks * w / threads; t < num_tasks * (w+1) / threads; t++)
+                workers[w]->tasks.push_back(t);
+        }
+    } catch(Exception&) {
+        self->returnWorkers(workers);
+        throw;
+    }
+
+    // The calling thread acts as the first worker. If a thread fails to start, the others steal its tasks.
+    for(unsigned w = 1; w < threads; w++)
+        workers[w]->started = workers[w]->thread.start(DocumentJob::run, workers[w]);
+    DocumentJob::run(workers[0]);
+    for(unsigned w = 1; w < threads; w++) {
+        if(workers[w]->started)
+            workers[w]->thread.join();
+    }
+
+    unsigned long long shape_ns = 0;
+    for(unsigned w = 0; w < threads; w++)
+        shape_ns += workers[w]->shape_ns;
+    self->returnWorkers(workers);
+    self->count(&FontStats::shape_ns, shape_ns);
+
+    std::vector<ShapedText> lines(job.pieces.back().line + 1);
+    for(unsigned i = 0; i < lines.size(); i++) {
+        lines[i].x_advance = 0;
+        lines[i].y_advance = 0;
+    }
+    for(unsigned i = 0; i < job.pieces.size(); i++) {
+        ShapedText& line = lines[job.pieces[i].line];
+        ShapedText& piece = job.results[i];
+        unsigned first = line.glyphs.size();
+        if(first == 0)
+            line.glyphs.swap(piece.glyphs);
+        else
+            line.glyphs.insert(line.glyphs.end(), piece.glyphs.begin(), piece.glyphs.end());
+        for(unsigned g = first; g < line.glyphs.size(); g++)
+            line.glyphs[g].cluster -= job.pieces[i].line_start;
+        for(unsigned r = 0; r < piece.runs.size(); r++) {
+            piece.runs[r].start += first;
+            line.runs.push_back(piece.runs[r]);
+        }
+        line.x_advance += piece.x_advance;
+        line.y_advance += piece.y_advance;
+    }
+    return lines;
 }
 
 void Font::draw(std::string text) {
     if(!self)
         throw EmptyFontException();
-    hb_buffer_t* buffer = hb_buffer_create();
-    hb_buffer_set_direction(buffer, HB_DIRECTION_LTR);
-    hb_buffer_add_utf8(buffer, text.c_str(), text.size(), 0, text.size());
-    hb_shape(self->font, buffer, NULL, 0);
+    ShapedText shaped;
+    self->shape(text, shaped);
+    draw(shaped);
+}
+
+void Font::draw(const ShapedText& text) {
+    drawShaped(text, 0);
+}
+
+void Font::draw(const ShapedText& text, const ClipRect& clip) {
+    drawShaped(text, &clip);
+}
+
+static void intersect(int& x0, int& y0, int& x1, int& y1, const ClipRect& clip) {
+    x0 = std::max(x0, clip.x);
+    y0 = std::max(y0, clip.y);
+    x1 = std::min(x1, clip.x + int(clip.w));
+    y1 = std::min(y1, clip.y + int(clip.h));
+}
+
+// Cuts a cached quad, placed at x,y, down to the clip rectangle. Quad corners and clip edges are whole pixels, so the
+// trimmed texture coordinates still land on texel edges.
+static void trimQuad(const GlyphVert* quad, float x, float y, float x0, float y0, float x1, float y1, std::vector<GlyphVert>& out) {
+    const GlyphVert& bl = quad[0];
+    const GlyphVert& ur = quad[3];
+    float left = std::max(x + bl.x, x0);
+    float right = std::min(x + ur.x, x1);
+    float bottom = std::max(y + bl.y, y0);
+    float top = std::min(y + ur.y, y1);
+    float s_scale = (ur.s - bl.s) / (ur.x - bl.x);
+    float t_scale = (ur.t - bl.t) / (ur.y - bl.y);
+
+    GlyphVert corners[4];
+    for(unsigned k = 0; k < 4; k++) {
+        corners[k].x = (k & 2) ? right : left;
+        corners[k].y = (k & 1) ? top : bottom;
+        corners[k].s = bl.s + (corners[k].x - x - bl.x) * s_scale;
+        corners[k].t = bl.t + (corners[k].y - y - bl.y) * t_scale;
+    }
+    static const unsigned order[6] = {0, 2, 3, 0, 3, 1};
+    for(unsigned k = 0; k < 6; k++)
+        out.push_back(corners[order[k]]);
+}
+
+void Font::drawShaped(const ShapedText& text, const ClipRect* run_clip) {
+    if(!self)
+        throw EmptyFontException();
+    GLTEXT_PROBE2(draw_entry, self, text.glyphs.size());
+
+    self->bindCache();
+    if(gltextBindSampler) {
+        gltextBindSampler(0, 0);
+    }
+    gltextUseProgram(FontSystem::instance().prog);
+    gltextUniform2i(FontSystem::instance().scale_loc, window_w, window_h);
+    gltextUniform3f(FontSystem::instance().col_loc, pen_r, pen_g, pen_b);
+
+    // Nothing outside the display can be seen, so it is the outermost clip. Until the display size is set, it is unknown.
+    int x0 = INT_MIN, y0 = INT_MIN, x1 = INT_MAX, y1 = INT_MAX;
+    if(window_w && window_h)
+        intersect(x0, y0, x1, y1, ClipRect(0, 0, window_w, window_h));
+    if(has_clip)
+        intersect(x0, y0, x1, y1, clip);
+    if(run_clip)
+        intersect(x0, y0, x1, y1, *run_clip);
+
+    // Runs are stored in logical order; put them in visual order. Glyphs within a run already are.
+    // A ShapedText built without runs is drawn as a single left-to-right run.
+    std::vector<GlyphRun> all(1);
+    const std::vector<GlyphRun>* runs = &text.runs;
+    if(runs->empty() && !text.glyphs.empty()) {
+        all[0].start = 0;
+        all[0].count = text.glyphs.size();
+        all[0].level = 0;
+        runs = &all;
+    }
+    std::vector<unsigned char> levels(runs->size());
+    for(unsigned r = 0; r < runs->size(); r++)
+        levels[r] = (*runs)[r].level;
+    std::vector<unsigned> order;
+    reorderRuns(levels, order);
+
+    FontSystem& system = FontSystem::instance();
+    unsigned long long submit = 0;
+    unsigned long long hits = 0;
+    unsigned long long draws = 0;
+    unsigned long long culled = 0;
+    std::vector<GlyphVert> trimmed;
+    for(unsigned r = 0; r < order.size(); r++) {
+        const GlyphRun& run = (*runs)[order[r]];
+        for(unsigned i = run.start; i < run.start + run.count; i++) {
+            const Glyph& glyph = text.glyphs[i];
+            int x = int(pen_x) + glyph.x_offset;
+            int y = int(pen_y) + glyph.y_offset;
+            pen_x += glyph.x_advance;
+            pen_y += glyph.y_advance;
+
+            // Glyphs that cannot reach the clip rectangle are dropped before they are looked up, let alone rendered
+            const FontFace& face = self->faces[glyph.face];
+            if(x + face.ink_x1 <= x0 || x + face.ink_x0 >= x1 || y + face.ink_y1 <= y0 || y + face.ink_y0 >= y1) {
+                culled++;
+                continue;
+            }
+
+            GlyphKey key(glyph.face, glyph.index);
+            GlyphMap::iterator g = self->glyphs.find(key);
+            if(g == self->glyphs.end() && !system.rasterBudgetLeft()) {
+                self->defer(key);
+                if(placeholder < 0)
+                    continue;
+                key = GlyphKey(glyph.face, placeholder);
+                g = self->glyphs.find(key);
+            }
+            if(g == self->glyphs.end()) {
+                // The placeholder is rendered even when it is over budget, but it only happens once
+                self->count(&FontStats::cache_misses, 1);
+                unsigned long long start = nanoTime();
+                g = self->cacheGlyph(key);
+                system.spendRaster(nanoTime() - start);
+            } else {
+                hits++;
+            }
+
+            unsigned slot = g->second;
+            const GlyphVert* quad = &self->slot_verts[slot*4];
+            float left = x + quad[0].x, bottom = y + quad[0].y;
+            float right = x + quad[3].x, top = y + quad[3].y;
+            if(left >= right || bottom >= top)
+                continue; // Blank, like a space
+            if(right <= x0 || left >= x1 || top <= y0 || bottom >= y1) {
+                culled++;
+                continue;
+            }
+            if(left < x0 || right > x1 || bottom < y0 || top > y1) {
+                trimQuad(quad, x, y, x0, y0, x1, y1, trimmed);
+                continue;
+            }
+        
+            unsigned long long start = nanoTime();
+            gltextUniform2i(FontSystem::instance().pos_loc, x, y);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, (GLvoid*)(slot*GLYPH_IDX_SIZE));
+            submit += nanoTime() - start;
+            draws++;
+        }
+    }
+    if(!trimmed.empty()) {
+        unsigned long long start = nanoTime();
+        self->drawTrimmed(trimmed);
+        submit += nanoTime() - start;
+        draws++;
+    }
+    self->count(&FontStats::cache_hits, hits);
+    self->count(&FontStats::submit_ns, submit);
+    self->count(&FontStats::draw_calls, draws);
+    self->count(&FontStats::glyphs_culled, culled);
+    GLTEXT_PROBE2(draw_return, self, text.glyphs.size());
+}
+
+FontStats Font::stats() const {
+    if(!self)
+        throw EmptyFontException();
+    ScopedLock lock(FontSystem::instance().stats_lock);
+    return loadStats(self->stats);
+}
+
+void Font::resetStats() {
+    if(!self)
+        throw EmptyFontException();
+    resetCounters(self->stats);
+}
+
+void Font::dumpAtlas(std::string filename) const {
+    if(!self)
+        throw EmptyFontException();
+    self->ensureCache();
+    unsigned w = self->textureWidth();
+    unsigned h = self->textureHeight();
+    std::vector<unsigned char> pixels(w*h);
+
+    gltextActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, self->texture());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_UNSIGNED_BYTE, &pixels[0]);
+
+    FILE* out = fopen(filename.c_str(), "wb");
+    if(!out)
+        throw Exception("Could not open " + filename + " for writing");
+    fprintf(out, "P5\n%u %u\n255\n", w, h);
+    // Glyph bitmaps are uploaded top row first, so the texture rows are already in PGM order
+    fwrite(&pixels[0], 1, pixels.size(), out);
+    fclose(out);
+}
+
+// Editable text keeps its glyph quads in blocks of up to this many glyphs, each in its own region of the vertex buffer
+#define EDIT_BLOCK_GLYPHS 128
+#define EDIT_BLOCK_VERTS (EDIT_BLOCK_GLYPHS*4)
+
+/// A span of an EditableText's glyphs that is shaped and uploaded as a unit
+struct TextBlock {
+    unsigned bytes; // Length of the text the block was shaped from
+    unsigned count; // Glyphs in the block
+    unsigned slot;  // Region of the vertex buffer that holds the block's quads
+    int x_advance;
+    int y_advance;
+};
+
+struct EditableTextPimpl {
+    Font* font;
+    std::string text;
+    std::vector<TextBlock> blocks;   // In logical order, or in visual order when bidi is set
+    std::vector<unsigned> free_slots;
+    std::vector<GlyphVert> verts;    // Copy of the vertex buffer, so it can grow without being read back
+    unsigned num_slots;
+    unsigned generation;             // The FontPimpl::generation the quads were built against
+    bool bidi;                       // The text has right-to-left runs, and edits reshape all of it
+    int x_advance, y_advance;
+
+    GLuint vao;
+    GLuint vbo;
+    GLuint ibo;
+
+    void init() {
+        num_slots = 0;
+        bidi = false;
+        x_advance = y_advance = 0;
+        std::vector<GLushort> indices(EDIT_BLOCK_GLYPHS*6);
+        for(unsigned i = 0; i < EDIT_BLOCK_GLYPHS; i++) {
+            GLushort quad[6] = { GLushort(i*4+0), GLushort(i*4+2), GLushort(i*4+3), GLushort(i*4+0), GLushort(i*4+3), GLushort(i*4+1) };
+            std::copy(quad, quad + 6, &indices[i*6]);
+        }
+        gltextGenVertexArrays(1, &vao);
+        gltextGenBuffers(1, &vbo);
+        gltextGenBuffers(1, &ibo);
+        gltextBindVertexArray(vao);
+        gltextBindBuffer(GL_ARRAY_BUFFER, vbo);
+        gltextBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+        gltextBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
+        gltextEnableVertexAttribArray(0);
+        gltextEnableVertexAttribArray(1);
+    }
+
+    void cleanup() {
+        gltextDeleteBuffers(1, &vbo);
+        gltextDeleteBuffers(1, &ibo);
+        gltextDeleteVertexArrays(1, &vao);
+    }
+
+    unsigned allocSlot() {
+        if(free_slots.empty()) {
+            unsigned grown = num_slots ? num_slots*2 : 4;
+            for(unsigned i = grown; i > num_slots; i--)
+                free_slots.push_back(i - 1);
+            num_slots = grown;
+            verts.resize(num_slots*EDIT_BLOCK_VERTS);
+            gltextBindBuffer(GL_ARRAY_BUFFER, vbo);
+            gltextBufferData(GL_ARRAY_BUFFER, verts.size()*sizeof(GlyphVert), &verts[0], GL_DYNAMIC_DRAW);
+            font->self->count(&FontStats::bytes_uploaded, verts.size()*sizeof(GlyphVert));
+        }
+        unsigned slot = free_slots.back();
+        free_slots.pop_back();
+        return slot;
+    }
+
+    // A glyph starts a word if it is the first glyph of a character that follows a space
+    bool isWordStart(const std::vector<Glyph>& glyphs, unsigned i) const {
+        return i > 0 && glyphs[i].cluster > glyphs[i-1].cluster && text[glyphs[i].cluster - 1] == ' ';
+    }
+
+    // Splits glyphs, shaped from text[start, end), into blocks and uploads them. Blocks start at words where possible,
+    // so that each of them can be reshaped on its own later.
+    void addBlocks(const std::vector<Glyph>& glyphs, unsigned start, unsigned end, std::vector<TextBlock>& out) {
+        FontPimpl* f = font->self;
+        f->bindCache();
+        std::vector<unsigned> slots(glyphs.size());
+        unsigned long long hits = 0;
+        for(unsigned i = 0; i < glyphs.size(); i++) {
+            GlyphKey key(glyphs[i].face, glyphs[i].index);
+            GlyphMap::iterator g = f->glyphs.find(key);
+            if(g == f->glyphs.end()) {
+                f->count(&FontStats::cache_misses, 1);
+                g = f->cacheGlyph(key);
+            } else {
+                hits++;
+            }
+            slots[i] = g->second;
+        }
+        f->count(&FontStats::cache_hits, hits);
+
+        gltextBindVertexArray(vao);
+        unsigned n = glyphs.size();
+        unsigned begin = 0;
+        unsigned byte = start;
+        do {
+            unsigned stop = std::min(begin + EDIT_BLOCK_GLYPHS, n);
+            if(stop < n && !bidi) {
+                unsigned cut = stop;
+                while(cut > begin && !isWordStart(glyphs, cut))
+                    cut--;
+                if(cut == begin) {
+                    // A very long word; settle for a character boundary
+                    cut = stop;
+                    while(cut > begin && glyphs[cut].cluster == glyphs[cut-1].cluster)
+                        cut--;
+                    if(cut == begin)
+                        cut = stop;
+                }
+                stop = cut;
+            }
+
+            TextBlock block;
+            unsigned next = stop < n ? glyphs[stop].cluster : end;
+            block.bytes = bidi ? 0 : next - byte;
+            byte = next;
+            block.count = stop - begin;
+            block.slot = allocSlot();
+            GlyphVert* v = &verts[block.slot*EDIT_BLOCK_VERTS];
+            int x = 0, y = 0;
+            for(unsigned i = begin; i < stop; i++, v += 4) {
+                const GlyphVert* quad = &f->slot_verts[slots[i]*4];
+                for(unsigned k = 0; k < 4; k++) {
+                    v[k] = quad[k];
+                    v[k].x += x + glyphs[i].x_offset;
+                    v[k].y += y + glyphs[i].y_offset;
+                }
+                x += glyphs[i].x_advance;
+                y += glyphs[i].y_advance;
+            }
+            block.x_advance = x;
+            block.y_advance = y;
+            if(block.count) {
+                gltextBindBuffer(GL_ARRAY_BUFFER, vbo);
+                gltextBufferSubData(GL_ARRAY_BUFFER, block.slot*EDIT_BLOCK_VERTS*sizeof(GlyphVert), block.count*4*sizeof(GlyphVert),
+                                    &verts[block.slot*EDIT_BLOCK_VERTS]);
+                f->count(&FontStats::bytes_uploaded, block.count*4*sizeof(GlyphVert));
+            }
+            x_advance += block.x_advance;
+            y_advance += block.y_advance;
+            out.push_back(block);
+            begin = stop;
+        } while(begin < n);
+    }
+
+    void removeBlocks(unsigned first, unsigned last) {
+        for(unsigned b = first; b < last; b++) {
+            free_slots.push_back(blocks[b].slot);
+            x_advance -= blocks[b].x_advance;
+            y_advance -= blocks[b].y_advance;
+        }
+        blocks.erase(blocks.begin() + first, blocks.begin() + last);
+    }
+
+    static bool hasRtl(const ShapedText& shaped) {
+        for(unsigned r = 0; r < shaped.runs.size(); r++) {
+            if(shaped.runs[r].level)
+                return true;
+        }
+        return false;
+    }
+
+    void rebuild() {
+        FontPimpl* f = font->self;
+        removeBlocks(0, blocks.size());
+        generation = f->generation;
+        ShapedText shaped;
+        f->shapeSpan(text, 0, text.size(), shaped);
+        bidi = hasRtl(shaped);
+        if(!bidi) {
+            addBlocks(shaped.glyphs, 0, text.size(), blocks);
+            return;
+        }
+
+        // Right-to-left text is stored in visual order, so the blocks can simply be drawn one after another
+        std::vector<unsigned char> levels(shaped.runs.size());
+        for(unsigned r = 0; r < shaped.runs.size(); r++)
+            levels[r] = shaped.runs[r].level;
+        std::vector<unsigned> order;
+        reorderRuns(levels, order);
+        std::vector<Glyph> visual;
+        visual.reserve(shaped.glyphs.size());
+        for(unsigned r = 0; r < order.size(); r++) {
+            const GlyphRun& run = shaped.runs[order[r]];
+            visual.insert(visual.end(), shaped.glyphs.begin() + run.start, shaped.glyphs.begin() + run.start + run.count);
+        }
+        addBlocks(visual, 0, text.size(), blocks);
+    }
+
+    void edit(size_t offset, size_t erase_length, const std::string& insert_text) {
+        FontPimpl* f = font->self;
+        if(!f)
+            throw EmptyFontException();
+        if(offset > text.size() || erase_length > text.size() - offset)
+            throw Exception("The requested edit is outside of the text");
+        if(bidi || generation != f->generation || blocks.empty()) {
+            text.replace(offset, erase_length, insert_text);
+            rebuild();
+            return;
+        }
+
+        // The edit touches the block it starts in, or the one before when it starts right at a block boundary, through the
+        // block holding the first character after it. Those blocks begin and end at words, so they can be reshaped alone.
+        size_t end = offset + erase_length;
+        unsigned first = 0;
+        size_t start = 0;
+        while(first + 1 < blocks.size() && start + blocks[first].bytes < offset) {
+            start += blocks[first].bytes;
+            first++;
+        }
+        unsigned last = first;
+        size_t stop = start + blocks[first].bytes;
+        while(last + 1 < blocks.size() && stop <= end) {
+            last++;
+            stop += blocks[last].bytes;
+        }
+
+        text.replace(offset, erase_length, insert_text);
+        stop = stop - erase_length + insert_text.size();
+        ShapedText shaped;
+        f->shapeSpan(text, start, stop - start, shaped);
+        if(hasRtl(shaped)) {
+            rebuild();
+            return;
+        }
+        removeBlocks(first, last + 1);
+        std::vector<TextBlock> fresh;
+        addBlocks(shaped.glyphs, start, stop, fresh);
+        blocks.insert(blocks.begin() + first, fresh.begin(), fresh.end());
+    }
+};
+
+EditableText::EditableText(Font& font, const std::string& text) {
+    if(!font.self)
+        throw EmptyFontException();
+    self = new EditableTextPimpl;
+    self->font = &font;
+    self->text = text;
+    self->init();
+    try {
+        self->rebuild();
+    } catch(Exception&) {
+        self->cleanup();
+        delete self;
+        throw;
+    }
+}
+
+EditableText::~EditableText() {
+    self->cleanup();
+    delete self;
+}
+
+void EditableText::setText(const std::string& text) {
+    if(!self->font->self)
+        throw EmptyFontException();
+    self->text = text;
+    self->rebuild();
+}
 
-    unsigned len = hb_buffer_get_length(buffer);
-    hb_glyph_info_t* glyphs = hb_buffer_get_glyph_infos(buffer, 0);
-    hb_glyph_position_t* positions = hb_buffer_get_glyph_positions(buffer, 0);
+void EditableText::insert(size_t offset, const std::string& text) {
+    self->edit(offset, 0, text);
+}
+
+void EditableText::erase(size_t offset, size_t length) {
+    self->edit(offset, length, std::string());
+}
+
+const std::string& EditableText::text() const {
+    return self->text;
+}
+
+int EditableText::width() const {
+    return self->x_advance;
+}
+
+void EditableText::draw() {
+    Font& font = *self->font;
+    FontPimpl* f = font.self;
+    if(!f)
+        throw EmptyFontException();
+    f->use();
+    if(self->generation != f->generation)
+        self->rebuild();
+    GLTEXT_PROBE2(draw_entry, f, self->blocks.size());
 
     gltextActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, self->tex);
+    glBindTexture(GL_TEXTURE_2D, f->texture());
     if(gltextBindSampler) {
         gltextBindSampler(0, 0);
     }
     gltextBindVertexArray(self->vao);
+    gltextBindBuffer(GL_ARRAY_BUFFER, self->vbo);
     gltextUseProgram(FontSystem::instance().prog);
-    gltextUniform2i(FontSystem::instance().scale_loc, self->window_w, self->window_h);
-    gltextUniform3f(FontSystem::instance().col_loc, self->pen_r, self->pen_g, self->pen_b);
+    gltextUniform2i(FontSystem::instance().scale_loc, font.window_w, font.window_h);
+    gltextUniform3f(FontSystem::instance().col_loc, font.pen_r, font.pen_g, font.pen_b);
+
+    // Each block is drawn at its own offset, which is how the blocks after an edit move without being rewritten
+    unsigned long long start = nanoTime();
+    unsigned long long draws = 0;
+    for(unsigned b = 0; b < self->blocks.size(); b++) {
+        const TextBlock& block = self->blocks[b];
+        if(block.count) {
+            size_t base = block.slot*EDIT_BLOCK_VERTS*sizeof(GlyphVert);
+            gltextVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), (GLvoid*)base);
+            gltextVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), (GLvoid*)(base + 2*sizeof(float)));
+            gltextUniform2i(FontSystem::instance().pos_loc, font.pen_x, font.pen_y);
+            glDrawElements(GL_TRIANGLES, block.count*6, GL_UNSIGNED_SHORT, 0);
+            draws++;
+        }
+        font.pen_x += block.x_advance;
+        font.pen_y += block.y_advance;
+    }
+    f->count(&FontStats::submit_ns, nanoTime() - start);
+    f->count(&FontStats::draw_calls, draws);
+    GLTEXT_PROBE2(draw_return, f, self->blocks.size());
+}
 
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+// A Document remembers where every this many lines start
+#define DOCUMENT_CHECKPOINT_LINES 64
+// Lines longer than this are cut off for display, which bounds the time and memory one line can take
+#define DOCUMENT_MAX_LINE_LENGTH 16384
+// Each draw shapes at most about this many bytes of the prefetch margin, so that a jump does not stall the frame.
+// The rest of the margin is filled in by the draws that follow.
+#define DOCUMENT_PREFETCH_BYTES 16384
 
-    for(unsigned i = 0; i < len; i++) {
-        std::map<FT_UInt, unsigned>::iterator g = self->glyphs.find(glyphs[i].codepoint);
-        if(g == self->glyphs.end()) {
-            g = self->cacheGlyph(glyphs[i].codepoint);
+typedef std::list<size_t> DocumentLineOrder;
+
+struct DocumentLine {
+    ShapedText shaped;
+    DocumentLineOrder::iterator age;
+};
+
+typedef std::map<size_t, DocumentLine> DocumentLineCache;
+
+struct DocumentPimpl {
+    Font* font;
+    const char* data;
+    size_t size;
+    bool mapped;
+    size_t line_count;
+    std::vector<size_t> checkpoints; // Start of every DOCUMENT_CHECKPOINT_LINES'th line
+
+    unsigned line_height;
+    unsigned prefetch;
+    unsigned cache_size;
+    DocumentLineCache lines;
+    DocumentLineOrder line_order;
+    const FontPimpl* shaped_with; // The font and point size the cached lines were shaped for
+    unsigned shaped_size;
+    size_t bytes_shaped;
+
+    static DocumentPimpl* create(Font& font, const char* data, size_t size, bool mapped) {
+        if(!font.self)
+            throw EmptyFontException();
+        DocumentPimpl* self = new DocumentPimpl;
+        self->font = &font;
+        self->data = data;
+        self->size = size;
+        self->mapped = mapped;
+        self->init();
+        return self;
+    }
+
+    void init() {
+        line_height = 0;
+        prefetch = 32;
+        cache_size = 1024;
+        shaped_with = 0;
+        shaped_size = 0;
+        bytes_shaped = 0;
+
+        checkpoints.push_back(0);
+        line_count = 0;
+        const char* p = data;
+        const char* end = data + size;
+        while(const char* newline = (const char*)memchr(p, '\n', end - p)) {
+            p = newline + 1;
+            line_count++;
+            if(line_count % DOCUMENT_CHECKPOINT_LINES == 0)
+                checkpoints.push_back(p - data);
         }
+        if(p != end)
+            line_count++;
+    }
 
-        unsigned glyph = g->second;
-        
-        gltextUniform2i(FontSystem::instance().pos_loc, self->pen_x+positions[i].x_offset, self->pen_y+positions[i].y_offset);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, (GLvoid*)(glyph*GLYPH_IDX_SIZE));
-        self->pen_x += positions[i].x_advance >> 6;
-        self->pen_y += positions[i].y_advance >> 6;
+    void cleanup() {
+        if(mapped)
+            unmapWholeFile(data, size);
+    }
+
+    void lineRange(size_t n, size_t& start, size_t& length) const {
+        start = checkpoints[n / DOCUMENT_CHECKPOINT_LINES];
+        for(size_t skip = n % DOCUMENT_CHECKPOINT_LINES; skip; skip--)
+            start = (const char*)memchr(data + start, '\n', size - start) - data + 1;
+        const char* newline = (const char*)memchr(data + start, '\n', size - start);
+        length = newline ? newline - (data + start) : size - start;
+        if(length && data[start + length - 1] == '\r')
+            length--;
     }
-}    
+
+    const ShapedText& shaped(size_t n, size_t keep) {
+        FontPimpl* f = font->self;
+        if(shaped_with != f || shaped_size != f->size) {
+            lines.clear();
+            line_order.clear();
+            shaped_with = f;
+            shaped_size = f->size;
+        }
+
+        DocumentLineCache::iterator i = lines.find(n);
+        if(i != lines.end()) {
+            line_order.splice(line_order.begin(), line_order, i->second.age);
+            return i->second.shaped;
+        }
+
+        size_t start, length;
+        lineRange(n, start, length);
+        if(length > DOCUMENT_MAX_LINE_LENGTH) {
+            length = DOCUMENT_MAX_LINE_LENGTH;
+            while(length && (data[start + length] & 0xc0) == 0x80)
+                length--;
+        }
+        while(!lines.empty() && lines.size() >= std::max<size_t>(cache_size, keep)) {
+            lines.erase(line_order.back());
+            line_order.pop_back();
+        }
+        i = lines.insert(std::make_pair(n, DocumentLine())).first;
+        f->shapeSpan(std::string(data + start, length), 0, length, i->second.shaped);
+        bytes_shaped += length + 1;
+        line_order.push_front(n);
+        i->second.age = line_order.begin();
+        return i->second.shaped;
+    }
+};
+
+// Empty files cannot be mapped, so they are told apart from missing ones before trying
+static const char* mapDocument(const std::string& filename, size_t& size) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if(!file)
+        throw FileException(filename);
+    int c = fgetc(file);
+    fclose(file);
+    size = 0;
+    if(c == EOF)
+        return 0;
+    const char* data = (const char*)mapWholeFile(filename, size);
+    if(!data)
+        throw FileException(filename);
+    return data;
+}
+
+Document::Document(Font& font, const std::string& filename) : self(0) {
+    size_t size;
+    const char* data = mapDocument(filename, size);
+    try {
+        self = DocumentPimpl::create(font, data, size, data != 0);
+    } catch(Exception&) {
+        if(data)
+            unmapWholeFile(data, size);
+        throw;
+    }
+}
+
+Document::Document(Font& font, const char* data, size_t size)
+    : self(DocumentPimpl::create(font, data, size, false)) {}
+
+Document::~Document() {
+    self->cleanup();
+    delete self;
+}
+
+size_t Document::lineCount() const {
+    return self->line_count;
+}
+
+std::string Document::line(size_t n) const {
+    if(n >= self->line_count)
+        throw Exception("The requested line is past the end of the document");
+    size_t start, length;
+    self->lineRange(n, start, length);
+    return std::string(self->data + start, length);
+}
+
+void Document::setLineHeight(unsigned pixels) {
+    self->line_height = pixels;
+}
+
+void Document::setPrefetch(unsigned lines) {
+    self->prefetch = lines;
+}
+
+void Document::setCacheSize(unsigned lines) {
+    self->cache_size = lines;
+}
+
+void Document::draw(size_t first, unsigned count) {
+    Font& font = *self->font;
+    FontPimpl* f = font.self;
+    if(!f)
+        throw EmptyFontException();
+    unsigned height = self->line_height ? self->line_height : f->y_size;
+    size_t last = std::min<size_t>(first + count, self->line_count);
+    first = std::min(first, last);
+    size_t keep = (last - first) + 2*size_t(self->prefetch);
+
+    unsigned x = font.pen_x;
+    unsigned y = font.pen_y;
+    for(size_t n = first; n < last; n++) {
+        font.pen_x = x;
+        font.pen_y = y - unsigned(n - first)*height;
+        font.drawShaped(self->shaped(n, keep), 0);
+    }
+    font.pen_x = x;
+    font.pen_y = y - unsigned(last - first)*height;
+
+    // The margins are shaped after the visible lines are drawn, nearest lines first
+    size_t before = std::min<size_t>(first, self->prefetch);
+    size_t after = std::min<size_t>(self->line_count - last, self->prefetch);
+    size_t budget_start = self->bytes_shaped;
+    for(size_t n = 1; n <= std::max(before, after) && self->bytes_shaped - budget_start < DOCUMENT_PREFETCH_BYTES; n++) {
+        if(n <= after)
+            self->shaped(last + n - 1, keep);
+        if(n <= before)
+            self->shaped(first - n, keep);
+    }
+}
+
+FontStats globalStats() {
+    ScopedLock lock(FontSystem::instance().stats_lock);
+    return loadStats(FontSystem::instance().totals);
+}
+
+void setRasterBudget(unsigned glyphs, unsigned microseconds) {
+    FontSystem& system = FontSystem::instance();
+    system.raster_glyph_budget = glyphs;
+    system.raster_ns_budget = microseconds * 1000ull;
+}
+
+void beginFrame() {
+    FontSystem& system = FontSystem::instance();
+    system.frame_glyphs = 0;
+    system.frame_ns = 0;
+    enforceMemoryBudget(0);
+    if(system.deferred_fonts.empty())
+        return;
+
+    std::set<FontPimpl*>::iterator f = system.deferred_fonts.begin();
+    while(f != system.deferred_fonts.end() && system.rasterBudgetLeft()) {
+        FontPimpl* font = *f;
+        font->bindCache();
+        while(!font->deferred.empty() && system.rasterBudgetLeft()) {
+            GlyphKey key = *font->deferred.begin();
+            if(font->glyphs.find(key) == font->glyphs.end()) {
+                font->count(&FontStats::cache_misses, 1);
+                unsigned long long start = nanoTime();
+                try {
+                    font->cacheGlyph(key);
+                } catch(CacheOverflowException&) {
+                    // The rest would overflow as well. Drawing them again retries them, and draw() throws if the
+                    // cache is still full.
+                    font->deferred.clear();
+                }
+                system.spendRaster(nanoTime() - start);
+            }
+            font->deferred.erase(key);
+        }
+        if(font->deferred.empty())
+            system.deferred_fonts.erase(f++);
+        else
+            ++f;
+    }
+    if(system.deferred_fonts.empty() && system.drain_callback)
+        system.drain_callback(system.drain_user);
+}
+
+void setDrainCallback(DrainCallback callback, void* user) {
+    FontSystem& system = FontSystem::instance();
+    system.drain_callback = callback;
+    system.drain_user = user;
+}
+
+void setMemoryBudget(size_t bytes) {
+    FontSystem::instance().memory_budget = bytes;
+    enforceMemoryBudget(0);
+}
+
+size_t memoryUsage() {
+    FontSystem& system = FontSystem::instance();
+    return system.mappedBytes() + system.freetypeBytes() + reclaimableBytes();
+}
+
+void trim() {
+    FontSystem& system = FontSystem::instance();
+    for(std::set<FontPimpl*>::iterator f = system.fonts.begin(); f != system.fonts.end(); ++f) {
+        (*f)->dropCache();
+        (*f)->clearShapeCache();
+        (*f)->closeWorkers();
+    }
+    system.atlas.reset();
+}
+
+void setSharedAtlas(unsigned width, unsigned height) {
+    FontSystem& system = FontSystem::instance();
+    for(std::set<FontPimpl*>::iterator f = system.fonts.begin(); f != system.fonts.end(); ++f)
+        (*f)->dropCache();
+    system.atlas.reset();
+    system.atlas.w = width && height ? width : 0;
+    system.atlas.h = width && height ? height : 0;
+    // The caches are empty now; starting them over picks up the new atlas
+    for(std::set<FontPimpl*>::iterator f = system.fonts.begin(); f != system.fonts.end(); ++f) {
+        (*f)->cleanupCache();
+        (*f)->initCache();
+    }
+}
+
+void resetGlobalStats() {
+    resetCounters(FontSystem::instance().totals);
+}
 
 }
@@ -25,11 +25,17 @@
 #ifndef GLTEXT_FONT_HPP
 #define GLTEXT_FONT_HPP
 
+#include <stddef.h>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #define GLTEXT_CACHE_TEXTURE_SIZE 256
 
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#define GLTEXT_HAS_MOVE
+#endif
+
 namespace gltext {
 
     /// The base class for all gltext exceptions
@@ -62,6 +68,211 @@ namespace gltext {
         BadFontFormatException() : Exception("The font glyphs are not in an appropriate bitmap format") {}
     };
 
+    /// Thrown when a file cannot be opened or mapped into memory
+    class FileException : public Exception {
+    public:
+        FileException(std::string filename) : Exception("Unable to open " + filename) {}
+    };
+
+/**
+ * @brief Runtime counters for a Font, or for all Fonts together
+ *
+ * The counters are plain integers that are bumped as the library works, so they are cheap enough to
+ * leave enabled in release builds. Times are wall-clock nanoseconds measured on the calling thread.
+ * The GL submission time covers issuing the commands only, not their execution on the GPU.
+ */
+struct FontStats {
+    unsigned long long cache_hits;        ///< Glyphs found in the glyph cache
+    unsigned long long cache_misses;      ///< Glyphs that had to be rendered into the cache
+    unsigned long long cache_evictions;   ///< Glyphs dropped from the cache
+    unsigned long long glyphs_rasterized; ///< Glyphs rendered by Freetype
+    unsigned long long bytes_uploaded;    ///< Texture and buffer bytes sent to OpenGL
+    unsigned long long draw_calls;        ///< Draw commands issued
+    unsigned long long glyphs_culled;     ///< Glyphs skipped by draw() because they were outside the clip rectangle
+    unsigned long long glyphs_deferred;   ///< Glyphs left for a later frame because the rasterization budget was spent
+    unsigned long long shape_cache_hits;  ///< Strings whose shaping was found in the shape cache
+    unsigned long long shape_cache_misses;///< Strings that had to be itemized and shaped
+
+    unsigned long long shape_ns;          ///< Time spent in hb_shape
+    unsigned long long rasterize_ns;      ///< Time spent in FT_Load_Glyph
+    unsigned long long submit_ns;         ///< Time spent issuing GL draw commands
+
+    unsigned atlas_glyphs;                ///< Glyph slots in use in the cache texture
+    unsigned atlas_capacity;              ///< Glyph slots available in the cache texture
+    unsigned long long atlas_pixels_used; ///< Pixels covered by glyph bitmaps
+    unsigned long long atlas_pixels_held; ///< Pixels reserved by the glyph slots in use
+
+    /// Fraction of the glyph slots that are in use
+    float occupancy() const { return atlas_capacity ? float(atlas_glyphs) / float(atlas_capacity) : 0.0f; }
+    /// Fraction of the reserved slot area that is not covered by glyph bitmaps
+    float fragmentation() const { return atlas_pixels_held ? 1.0f - float(atlas_pixels_used) / float(atlas_pixels_held) : 0.0f; }
+};
+
+/**
+ * @brief Counters aggregated over every Font
+ *
+ * The atlas fields cover the Fonts that are currently alive. The other counters accumulate until reset.
+ */
+FontStats globalStats();
+
+/**
+ * @brief Reset the accumulating global counters to zero
+ */
+void resetGlobalStats();
+
+/**
+ * @brief Limit the glyph rendering done by draw() in each frame
+ *
+ * When a lot of new text appears at once, rendering every new glyph into the cache can take long enough to miss a frame.
+ * With a budget, draw() stops rendering new glyphs once the frame's budget is spent, and leaves them for later frames. In
+ * the meantime they are skipped, or drawn as the Font's placeholder glyph (see Font::setPlaceholderGlyph()).
+ *
+ * With a budget set, beginFrame() must be called once every frame. Glyphs cached by Font::cacheCharacters() and by
+ * EditableText are always rendered immediately, and do not count against the budget.
+ * @param[in] glyphs The most glyphs to render per frame, or 0 for no limit
+ * @param[in] microseconds The most time to spend rendering glyphs per frame, or 0 for no limit. The last glyph rendered in
+ * a frame may run over this.
+ */
+void setRasterBudget(unsigned glyphs, unsigned microseconds);
+
+/**
+ * @brief Start a new frame
+ *
+ * This resets the rasterization budget, then spends it on glyphs that were left over from earlier frames, so that they are
+ * in the cache before anything is drawn. Whatever budget is left over is available to draw(). It must be called from the
+ * GL thread.
+ *
+ * If a Font's cache fills up, its remaining left over glyphs are dropped rather than throwing CacheOverflowException; they
+ * are retried if they are drawn again. Dropped glyphs count as drained for the drain callback.
+ */
+void beginFrame();
+
+/**
+ * @brief Limit the memory held by all Fonts together
+ *
+ * This covers the memory that can be given back: glyph cache textures and vertex buffers. When it is exceeded, the glyph
+ * caches of the least recently drawn Fonts are dropped until it is met again. A dropped cache is rebuilt, empty, the next
+ * time its Font draws. Freetype's faces and sizes and the font files mapped for Freetype and HarfBuzz are held for as long
+ * as their Fonts live, so they are counted by memoryUsage() but not held against the budget.
+ *
+ * With a shared atlas, dropping a Font's cache leaves its glyphs in the atlas. When there are no caches left to drop, the
+ * atlas is emptied as well, by the next beginFrame() or setMemoryBudget(). A budget smaller than the atlas texture
+ * empties it at the start of every frame.
+ *
+ * Glyph caches are only created when a Font first draws or caches characters, and their vertex buffers grow with them,
+ * so a Font used only for shaping and measuring holds no OpenGL memory. This must be called from the GL thread.
+ * @param[in] bytes The budget, or 0 for no limit (the default)
+ */
+void setMemoryBudget(size_t bytes);
+
+/**
+ * @brief Put the glyphs of every Font in one shared texture
+ *
+ * By default, each Font has a texture of its own. With a shared atlas, every Font places its glyphs in a single texture
+ * owned by the library instead, packed on shelves by height, so Fonts of many faces and sizes fill one texture rather than
+ * leaving several partly empty, and drawing one Font after another never switches textures. Glyphs are kept per face and
+ * pixel size, so Fonts that use the same font file at the same size share them. A Font made from font data in memory
+ * does not share its glyphs, and they are dropped from the atlas when it is destroyed.
+ *
+ * Every Font's glyph cache is emptied, and refilled from the new atlas as text is drawn. A full atlas throws
+ * CacheOverflowException, like a full Font cache; trim() empties it, and so may the memory budget. This must be called
+ * from the GL thread.
+ * @param[in] width The width of the atlas texture, or 0 to give each Font its own texture again
+ * @param[in] height The height of the atlas texture
+ */
+void setSharedAtlas(unsigned width, unsigned height);
+
+/// The memory currently held by all Fonts: glyph caches, Freetype's faces and sizes, and mapped font files
+size_t memoryUsage();
+
+/**
+ * @brief Drop every glyph cache and shape cache, and the faces kept by shapeDocument()
+ *
+ * This frees whatever memory can be rebuilt later, for instance when the system is low on memory. Text drawn afterwards
+ * renders its glyphs again. This must be called from the GL thread.
+ */
+void trim();
+
+/// A function to call when deferred glyphs have all been rendered
+typedef void (*DrainCallback)(void* user);
+
+/**
+ * @brief Set the function to call when deferred glyphs have all been rendered
+ *
+ * The callback is called from beginFrame(), in the frame that renders the last deferred glyph. Text drawn with placeholders
+ * can then be drawn again in full.
+ * @param[in] callback The function to call, or 0 for none
+ * @param[in] user Passed to the callback
+ */
+void setDrainCallback(DrainCallback callback, void* user);
+
+/// A positioned glyph, as produced by Font::shape
+struct Glyph {
+    unsigned face;    ///< Index of the font file the glyph comes from, in the order given to the Font
+    unsigned index;   ///< Glyph index within that font file
+    unsigned cluster; ///< Byte offset in the source string of the characters this glyph was produced from
+    int x_offset;     ///< Horizontal offset from the pen position, in pixels
+    int y_offset;     ///< Vertical offset from the pen position, in pixels
+    int x_advance;    ///< Horizontal pen movement after this glyph, in pixels
+    int y_advance;    ///< Vertical pen movement after this glyph, in pixels
+};
+
+/// A span of glyphs that share a bidi level and were shaped together
+struct GlyphRun {
+    unsigned start;      ///< Index of the first glyph of the run in ShapedText::glyphs
+    unsigned count;      ///< Number of glyphs in the run
+    unsigned char level; ///< Bidi embedding level. Odd levels are right-to-left.
+};
+
+/**
+ * @brief A line of text that has been shaped but not yet drawn
+ *
+ * Runs are kept in logical order, and the glyphs within each run are already in visual order. draw() puts the runs
+ * themselves into visual order.
+ *
+ * A ShapedText is only meaningful for the Font that produced it, at the point size that was set at the time.
+ */
+struct ShapedText {
+    std::vector<Glyph> glyphs;
+    std::vector<GlyphRun> runs;
+    int x_advance; ///< Total horizontal pen movement, in pixels
+    int y_advance; ///< Total vertical pen movement, in pixels
+};
+
+/**
+ * @brief A rectangle to clip drawing to
+ *
+ * This is in window pixels, with 0,0 at the bottom-left corner, like the pen position.
+ */
+struct ClipRect {
+    int x;      ///< Left edge
+    int y;      ///< Bottom edge
+    unsigned w; ///< Width, in pixels
+    unsigned h; ///< Height, in pixels
+
+    ClipRect() : x(0), y(0), w(0), h(0) {}
+    ClipRect(int x, int y, unsigned w, unsigned h) : x(x), y(y), w(w), h(h) {}
+};
+
+/**
+ * @brief Where one face of a Font comes from
+ *
+ * A font file is mapped into memory rather than read, and the mapping is shared by every Font that uses the same file.
+ * A memory source is used in place and never copied, so the memory must stay valid and unchanged for as long as any Font
+ * created from it exists. Either way, Freetype and HarfBuzz both read the font straight out of the mapped bytes.
+ */
+struct FontSource {
+    /// A font file. index selects the face within a font collection (.ttc), and is 0 for plain font files.
+    FontSource(std::string filename, unsigned index = 0) : filename(filename), data(0), size(0), index(index) {}
+    /// A font that is already in memory, such as one embedded in an asset pack. The memory is owned by the caller.
+    FontSource(const unsigned char* data, size_t size, unsigned index = 0) : data(data), size(size), index(index) {}
+
+    std::string filename;      ///< Empty for memory sources
+    const unsigned char* data; ///< Null for file sources
+    size_t size;               ///< Size of data, in bytes
+    unsigned index;            ///< Face index within a font collection
+};
+
 /// Internal structure for the Font class
 struct FontPimpl;
 
@@ -75,6 +286,10 @@ struct FontPimpl;
  * other values will not give correct results.
  * 
  * When drawing, this class will output pixels with pre-multiplied alpha. To blend them properly, set the blend mode to (GL_ONE, GL_SRC_ALPHA)
+ * 
+ * shape() and measure() may be called on the same Font from any number of threads at once. Every other function uses OpenGL or
+ * changes the Font, and must only be called from the thread that owns the GL context, while no other thread is using that Font.
+ * Fonts must be created on the GL thread.
  */
 class Font {
 public:
@@ -88,6 +303,45 @@ public:
      * @param[in] cache_h The height of the cache texture, in pixels
      */
     Font(std::string font_file, unsigned size, unsigned cache_w = GLTEXT_CACHE_TEXTURE_SIZE, unsigned cache_h = GLTEXT_CACHE_TEXTURE_SIZE);
+    /**
+     * @brief Create a new fully initialized font with fallbacks
+     * 
+     * Each character is drawn with the first font in the list that contains it. Spaces, punctuation and combining marks stay in
+     * the font of the preceding text when that font contains them, so they do not break up runs. Characters that no font contains
+     * are drawn with the font that is current at that point.
+     * 
+     * If any exceptions are thrown, the new Font object will be placed in the empty state, as if it were built with the default constructor.
+     * @param[in] font_files The paths to the requested font files, in order of preference
+     * @param[in] size The vertical size of the font, in pixels
+     * @param[in] cache_w The width of the cache texture, in pixels
+     * @param[in] cache_h The height of the cache texture, in pixels
+     */
+    Font(std::vector<std::string> font_files, unsigned size, unsigned cache_w = GLTEXT_CACHE_TEXTURE_SIZE, unsigned cache_h = GLTEXT_CACHE_TEXTURE_SIZE);
+    /**
+     * @brief Create a new fully initialized font from a font in memory
+     * 
+     * The font data is used in place, not copied. It is owned by the caller and must outlive the Font and any copies of it.
+     * 
+     * If any exceptions are thrown, the new Font object will be placed in the empty state, as if it were built with the default constructor.
+     * @param[in] data The font file contents
+     * @param[in] data_size The size of the font data, in bytes
+     * @param[in] size The vertical size of the font, in pixels
+     * @param[in] cache_w The width of the cache texture, in pixels
+     * @param[in] cache_h The height of the cache texture, in pixels
+     */
+    Font(const unsigned char* data, size_t data_size, unsigned size, unsigned cache_w = GLTEXT_CACHE_TEXTURE_SIZE, unsigned cache_h = GLTEXT_CACHE_TEXTURE_SIZE);
+    /**
+     * @brief Create a new fully initialized font with fallbacks, from files or memory
+     * 
+     * This is the general form of the other constructors. Fallback works as described for the list of font files.
+     * 
+     * If any exceptions are thrown, the new Font object will be placed in the empty state, as if it were built with the default constructor.
+     * @param[in] sources The faces to use, in order of preference
+     * @param[in] size The vertical size of the font, in pixels
+     * @param[in] cache_w The width of the cache texture, in pixels
+     * @param[in] cache_h The height of the cache texture, in pixels
+     */
+    Font(std::vector<FontSource> sources, unsigned size, unsigned cache_w = GLTEXT_CACHE_TEXTURE_SIZE, unsigned cache_h = GLTEXT_CACHE_TEXTURE_SIZE);
     /**
      * @brief Create an empty font
      */
@@ -102,10 +356,34 @@ public:
     /**
      * @brief deep assignment
      * 
-     * This will clean up the corrent font if needed, then perform a new initialization based on basic parameters from the source.
-     * Importantly, a new cache buffer and texture are created for this object. They are not shared with the source Font.
+     * This performs a new initialization based on basic parameters from the source, then releases the current font. If the
+     * initialization throws, this Font is left unchanged. Importantly, a new cache buffer and texture are created for this object.
+     * They are not shared with the source Font; use share() for that.
      */
     Font& operator=(const Font&);
+#ifdef GLTEXT_HAS_MOVE
+    /**
+     * @brief Move constructor
+     * 
+     * Takes over the font, caches and GL objects of the source, which is left empty. Nothing is initialized or copied.
+     */
+    Font(Font&&) noexcept;
+    /**
+     * @brief Move assignment
+     * 
+     * Releases the current font, then takes over the font of the source, which is left empty.
+     */
+    Font& operator=(Font&&) noexcept;
+#endif
+    /**
+     * @brief cheap copy
+     * 
+     * Makes this Font share the faces, glyph cache, atlas and shape cache of another, instead of building its own. Only the
+     * display size, pen position and pen color are kept separately. The shared state is reference counted and freed with the last
+     * Font using it. Anything that changes the font itself, such as setPointSize(), affects every Font that shares it.
+     * @param[in] rhs The Font to share with. If it is empty, this Font becomes empty.
+     */
+    Font& share(const Font& rhs);
 
     /**
      * @brief cleanup
@@ -137,6 +415,29 @@ public:
      */
     void setPenColor(float r, float g, float b);
 
+    /**
+     * @brief Clip drawing to a rectangle
+     *
+     * Glyphs entirely outside the rectangle are skipped before they are looked up in the cache, so they are never
+     * rendered. Glyphs that straddle its edge are trimmed. Drawing is always clipped to the display size as well.
+     * @param[in] clip The rectangle to draw inside of
+     */
+    void setClipRect(const ClipRect& clip);
+
+    /**
+     * @brief Stop clipping to the rectangle given to setClipRect()
+     */
+    void clearClipRect();
+
+    /**
+     * @brief Set the glyph to draw in place of glyphs deferred by the rasterization budget
+     *
+     * See setRasterBudget(). Glyph 0 is the font's missing-glyph box, which makes a reasonable placeholder. By default,
+     * deferred glyphs are not drawn at all.
+     * @param[in] glyph The glyph index, in the same face as the glyph it stands in for, or -1 to skip deferred glyphs
+     */
+    void setPlaceholderGlyph(int glyph);
+
     /**
      * @brief change the font size
      * This function will cause the font cache to be cleared.
@@ -169,8 +470,237 @@ public:
      * @param[in] text The string to draw
      */
     void draw(std::string text);
+
+    /**
+     * @brief draw a line of text that was shaped earlier
+     * 
+     * Any glyphs that are not yet cached are rendered into the cache, so this must be called from the GL thread.
+     * @param[in] text The shaped text to draw, as returned by shape()
+     */
+    void draw(const ShapedText& text);
+
+    /**
+     * @brief draw a line of shaped text, clipped to a rectangle
+     *
+     * This is the same as draw(), but the text is also clipped to the given rectangle, on top of the one set with setClipRect().
+     * @param[in] text The shaped text to draw, as returned by shape()
+     * @param[in] clip The rectangle to draw inside of
+     */
+    void draw(const ShapedText& text, const ClipRect& clip);
+
+    /**
+     * @brief lay out a line of text without drawing it
+     * 
+     * The text is split into runs of a single bidi level and script, and each run is shaped on its own. Short strings
+     * are remembered, so shaping the same string again is a lookup.
+     * 
+     * This does not touch OpenGL, and may run on any thread, concurrently with other calls to shape() and measure().
+     * @param[in] text The string to shape
+     */
+    ShapedText shape(std::string text) const;
+
+    /**
+     * @brief get the horizontal advance of a line of text, in pixels
+     * 
+     * This is the distance draw() would move the pen by. Like shape(), it may run on any thread.
+     * @param[in] text The string to measure
+     */
+    int measure(std::string text) const;
+
+    /**
+     * @brief lay out a whole document, using several threads
+     * 
+     * The text is split into lines at each '\n' (a '\r' before it is dropped), and long lines are further split between bidi runs.
+     * The pieces are shaped in parallel on a work-stealing pool, and the results are put back together in order. Each worker opens its
+     * own Freetype faces over the same font data, so the workers never wait on each other. The workers' faces are kept for later calls
+     * until the point size changes or trim() is called.
+     * 
+     * Like shape(), this does not touch OpenGL and may be called from any thread.
+     * @param[in] text The document, in UTF-8
+     * @param[in] threads The number of threads to use, or 0 to use one per CPU
+     * @return One ShapedText per line. Glyph clusters are byte offsets from the start of their line.
+     */
+    std::vector<ShapedText> shapeDocument(const std::string& text, unsigned threads = 0) const;
+
+    /**
+     * @brief get the runtime counters for this font
+     */
+    FontStats stats() const;
+
+    /**
+     * @brief reset the accumulating counters for this font to zero
+     *
+     * The atlas fields always reflect the current state of the cache and are not affected.
+     */
+    void resetStats();
+
+    /**
+     * @brief write the glyph cache texture to a binary PGM image
+     *
+     * This is intended for inspecting atlas usage and fragmentation while debugging. It reads the texture back
+     * from OpenGL, so it should not be called every frame.
+     * @param[in] filename The path of the image to write
+     */
+    void dumpAtlas(std::string filename) const;
 private:
+    friend class EditableText;
+    friend struct EditableTextPimpl;
+    friend class Document;
+    friend struct DocumentPimpl;
+
+    void release();
+    void drawShaped(const ShapedText& text, const ClipRect* clip);
+
     FontPimpl* self;
+
+    // Drawing state belongs to each Font object, even when the rest is shared
+    unsigned window_w, window_h;
+    unsigned pen_x, pen_y;
+    float pen_r, pen_g, pen_b;
+    ClipRect clip;
+    bool has_clip;
+    int placeholder;
+};
+
+/// Internal structure for the EditableText class
+struct EditableTextPimpl;
+
+/**
+ * @brief A line of text that is edited in place, such as the contents of a text field or console
+ *
+ * The text is kept shaped, and its glyph quads are kept in a vertex buffer of its own, in blocks of up to 128 glyphs that
+ * start at word boundaries. An edit reshapes only the blocks it touches and rewrites only their part of the buffer. The
+ * blocks after it keep their vertices and are drawn at a shifted offset, so the cost of an edit does not grow with the length
+ * of the text. Text with right-to-left runs is reshaped in full on every edit.
+ *
+ * An EditableText draws with the pen position, color and display size of its Font, and moves the pen like Font::draw. The
+ * Font must outlive the EditableText and must not be moved or reassigned while it is in use. Like drawing, every function
+ * must be called from the GL thread.
+ */
+class EditableText {
+public:
+    /**
+     * @brief Create an editable line of text
+     * @param[in] font The Font to shape and draw with
+     * @param[in] text The initial text, in UTF-8
+     */
+    EditableText(Font& font, const std::string& text = std::string());
+    ~EditableText();
+
+    /// Replace the whole text. This reshapes everything.
+    void setText(const std::string& text);
+
+    /**
+     * @brief Insert text
+     * @param[in] offset Byte offset to insert at. It must be on a character boundary, and no more than the length of the text.
+     * @param[in] text The text to insert, in UTF-8
+     */
+    void insert(size_t offset, const std::string& text);
+
+    /**
+     * @brief Remove text
+     * @param[in] offset Byte offset of the first byte to remove, on a character boundary
+     * @param[in] length Number of bytes to remove. The end must also be on a character boundary.
+     */
+    void erase(size_t offset, size_t length);
+
+    /// The current text
+    const std::string& text() const;
+
+    /// The distance draw() moves the pen horizontally, in pixels
+    int width() const;
+
+    /// Draw the text at the Font's pen position
+    void draw();
+
+private:
+    EditableText(const EditableText&);
+    EditableText& operator=(const EditableText&);
+
+    EditableTextPimpl* self;
+};
+
+/// Internal structure for the Document class
+struct DocumentPimpl;
+
+/**
+ * @brief A large, read-only text, such as a log file, drawn a screenful at a time
+ *
+ * Opening a Document makes one pass over the text to index its lines, remembering where every 64th line starts, so the
+ * index is small and any line can be found by scanning at most 63 others. Lines are shaped only when they are drawn or
+ * are within the prefetch margin around the drawn ones, and a bounded number of shaped lines is kept, least recently used
+ * first out. The cost of drawing a screenful is the same anywhere in the text and does not depend on its size.
+ *
+ * Lines are split at '\n', and a '\r' before it is dropped. Only the first 16KB of a very long line is shaped and drawn.
+ *
+ * A Document draws with the pen position, color, clip rectangle and display size of its Font. The Font must outlive the
+ * Document and must not be moved or reassigned while it is in use. Like drawing, every function must be called from the
+ * GL thread.
+ */
+class Document {
+public:
+    /**
+     * @brief Open a text file
+     *
+     * The file is mapped into memory rather than read, and should not be changed while the Document is open.
+     * @param[in] font The Font to shape and draw with
+     * @param[in] filename The file to open, in UTF-8
+     */
+    Document(Font& font, const std::string& filename);
+
+    /**
+     * @brief Use text already in memory
+     *
+     * The text is used in place and never copied, so it must stay valid and unchanged for the life of the Document.
+     * @param[in] font The Font to shape and draw with
+     * @param[in] data The text, in UTF-8
+     * @param[in] size The length of the text, in bytes
+     */
+    Document(Font& font, const char* data, size_t size);
+    ~Document();
+
+    /// The number of lines. A final line break does not start another line.
+    size_t lineCount() const;
+
+    /// One line of the text, without its line break
+    std::string line(size_t n) const;
+
+    /**
+     * @brief Set the distance between lines
+     * @param[in] pixels The line height, or 0 to use the height of the Font (the default)
+     */
+    void setLineHeight(unsigned pixels);
+
+    /**
+     * @brief Set how many lines to shape ahead of time, both above and below the lines that are drawn
+     *
+     * This keeps scrolling by a few lines from having to shape anything. The default is 32. Each draw() shapes only
+     * about 16KB of the margin, so after a jump the margin is filled in over the next few draws.
+     */
+    void setPrefetch(unsigned lines);
+
+    /**
+     * @brief Set how many shaped lines to keep
+     *
+     * The default is 1024. At least the lines being drawn and prefetched are always kept.
+     */
+    void setCacheSize(unsigned lines);
+
+    /**
+     * @brief Draw a range of lines
+     *
+     * The first line is drawn at the Font's pen position, and each one after it a line height further down. Afterwards,
+     * the pen is left at the start of the line after the last one drawn.
+     * @param[in] first The first line to draw
+     * @param[in] count The number of lines to draw. Lines past the end of the text are ignored.
+     */
+    void draw(size_t first, unsigned count);
+
+private:
+    Document(const Document&);
+    Document& operator=(const Document&);
+
+    DocumentPimpl* self;
 };
 
 }
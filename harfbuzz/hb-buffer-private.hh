@@ -98,6 +98,10 @@ struct _hb_buffer_t {
 
   HB_INTERNAL void swap_buffers (void);
   HB_INTERNAL void clear_output (void);
+  /* Works on info in place, for passes that never change the length.
+   * replace_glyph() then rewrites the glyph at idx and next_glyph() only
+   * advances idx. */
+  inline void clear_output_in_place (void) { have_output = FALSE; }
   HB_INTERNAL void clear_positions (void);
   HB_INTERNAL void replace_glyphs_be16 (unsigned int num_in,
 					unsigned int num_out,
@@ -105,6 +109,8 @@ struct _hb_buffer_t {
   HB_INTERNAL void replace_glyphs (unsigned int num_in,
 				   unsigned int num_out,
 				   const uint16_t *glyph_data);
+  /* Copies glyph at idx to output with a new glyph_index and advances idx.
+   * If there's no output, replaces the glyph in place. */
   HB_INTERNAL void replace_glyph (hb_codepoint_t glyph_index);
   /* Makes a copy of the glyph at idx to output and replace glyph_index */
   HB_INTERNAL void output_glyph (hb_codepoint_t glyph_index);
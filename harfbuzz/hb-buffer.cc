@@ -317,6 +317,13 @@ hb_buffer_t::copy_glyph (void)
 void
 hb_buffer_t::replace_glyph (hb_codepoint_t glyph_index)
 {
+  if (unlikely (!have_output))
+  {
+    info[idx].codepoint = glyph_index;
+    idx++;
+    return;
+  }
+
   out_info[out_len] = info[idx];
   out_info[out_len].codepoint = glyph_index;
 
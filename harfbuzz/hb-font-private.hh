@@ -93,6 +93,7 @@ struct _hb_face_t {
   hb_destroy_func_t          destroy;
 
   struct hb_ot_layout_t *ot_layout;
+  struct hb_ot_shape_plan_cache_entry_t *shape_plans; /* Lock-free list; entries are only ever prepended */
 
   unsigned int index;
   unsigned int upem;
@@ -27,6 +27,7 @@
 #include "hb-private.hh"
 
 #include "hb-ot-layout-private.hh"
+#include "hb-ot-shape-private.hh"
 
 #include "hb-font-private.hh"
 #include "hb-blob.h"
@@ -542,6 +543,7 @@ static hb_face_t _hb_face_nil = {
   NULL, /* destroy */
 
   NULL, /* ot_layout */
+  NULL, /* shape_plans */
 
   0,    /* index */
   1000  /* upem */
@@ -660,6 +662,7 @@ hb_face_destroy (hb_face_t *face)
   if (!hb_object_destroy (face)) return;
 
   _hb_ot_layout_destroy (face->ot_layout);
+  _hb_ot_shape_plans_destroy (face->shape_plans);
 
   if (face->destroy)
     face->destroy (face->user_data);
@@ -729,7 +732,7 @@ hb_face_set_index (hb_face_t    *face,
   if (hb_object_is_inert (face))
     return;
 
-  face->index = 0;
+  face->index = index;
 }
 
 unsigned int
@@ -254,6 +254,8 @@ _hb_ft_get_font_funcs (void)
 }
 
 
+/* The last resort, for fonts FreeType reads through a stream: each table
+ * is copied out.  The copy is ours, so the sanitizer fixes it up in place. */
 static hb_blob_t *
 reference_table  (hb_face_t *face HB_UNUSED, hb_tag_t tag, void *user_data)
 {
@@ -273,8 +275,10 @@ reference_table  (hb_face_t *face HB_UNUSED, hb_tag_t tag, void *user_data)
     return NULL;
 
   error = FT_Load_Sfnt_Table (ft_face, tag, 0, buffer, &length);
-  if (error)
+  if (error) {
+    free (buffer);
     return NULL;
+  }
 
   return hb_blob_create ((const char *) buffer, length,
 			 HB_MEMORY_MODE_WRITABLE,
@@ -288,24 +292,32 @@ hb_ft_face_create (FT_Face           ft_face,
 {
   hb_face_t *face;
 
-  if (ft_face->stream->read == NULL) {
+  /* Newer FreeType keeps the named instance of a variable font in the high
+   * bits; the instances share the font's tables */
+  unsigned int index = ft_face->face_index & 0xFFFF;
+
+  /* FreeType reads without a read function whenever the whole font is in
+   * memory: fonts it maps, fonts it could not map and so loaded, and
+   * memory faces.  All tables are then sub-blobs of one blob of it. */
+  if (ft_face->stream->read == NULL && ft_face->stream->base) {
     hb_blob_t *blob;
 
+    /* The font is in memory that FreeType reads in place: either its own
+     * mapping of the file or memory that belongs to the caller.  Either way
+     * it is not ours to write to, so never try to make it writable in place;
+     * if the sanitizer has to fix a table up, it works on a copy. */
     blob = hb_blob_create ((const char *) ft_face->stream->base,
 			   (unsigned int) ft_face->stream->size,
-			   /* TODO: We assume that it's mmap()'ed, but FreeType code
-			    * suggests that there are cases we reach here but font is
-			    * not mmapped.  For example, when mmap() fails.  No idea
-			    * how to deal with it better here. */
-			   HB_MEMORY_MODE_READONLY_MAY_MAKE_WRITABLE,
+			   HB_MEMORY_MODE_READONLY,
 			   ft_face, destroy);
-    face = hb_face_create (blob, ft_face->face_index);
+    face = hb_face_create (blob, index);
     hb_blob_destroy (blob);
   } else {
+    DEBUG_MSG (FT, ft_face, "Font is read through a stream; copying its tables");
     face = hb_face_create_for_tables (reference_table, ft_face, destroy);
   }
 
-  hb_face_set_index (face, ft_face->face_index);
+  hb_face_set_index (face, index);
   hb_face_set_upem (face, ft_face->units_per_EM);
 
   return face;
@@ -62,6 +62,9 @@ typedef volatile int hb_atomic_int_t;
 #define hb_atomic_int_get(AI)		g_atomic_int_get (&(AI))
 #define hb_atomic_int_set(AI, V)	g_atomic_int_set (&(AI), V)
 
+#define hb_atomic_ptr_get(P)		g_atomic_pointer_get (P)
+#define hb_atomic_ptr_cmpexch(P, O, N)	g_atomic_pointer_compare_and_exchange ((void **) (P), (void *) (O), (void *) (N))
+
 
 #elif _MSC_VER >= 1600
 
@@ -72,6 +75,30 @@ typedef long hb_atomic_int_t;
 #define hb_atomic_int_get(AI)		(_ReadBarrier (), (AI))
 #define hb_atomic_int_set(AI, V)	((void) _InterlockedExchange (&(AI), (V)))
 
+#define hb_atomic_ptr_get(P)		(_ReadBarrier (), *(P))
+#define hb_atomic_ptr_cmpexch(P, O, N)	(_InterlockedCompareExchangePointer ((void * volatile *) (P), (void *) (N), (void *) (O)) == (void *) (O))
+
+
+#elif defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+
+typedef volatile int hb_atomic_int_t;
+#define hb_atomic_int_add(AI, V)	__sync_fetch_and_add (&(AI), V)
+#ifdef __ATOMIC_ACQUIRE
+/* Readers only need an acquire load, which is free on x86 */
+#define hb_atomic_int_get(AI)		__atomic_load_n (&(AI), __ATOMIC_ACQUIRE)
+#else
+#define hb_atomic_int_get(AI)		(__sync_synchronize (), (AI))
+#endif
+#define hb_atomic_int_set(AI, V)	((void) (__sync_synchronize (), (AI) = (V)))
+
+#ifdef __ATOMIC_ACQUIRE
+/* An acquire load is all readers need, and is free on x86 */
+#define hb_atomic_ptr_get(P)		__atomic_load_n ((P), __ATOMIC_ACQUIRE)
+#else
+#define hb_atomic_ptr_get(P)		(__sync_synchronize (), *(P))
+#endif
+#define hb_atomic_ptr_cmpexch(P, O, N)	__sync_bool_compare_and_swap ((P), (O), (N))
+
 
 #else
 
@@ -86,6 +113,9 @@ typedef volatile int hb_atomic_int_t;
 #define hb_atomic_int_get(AI)		(AI)
 #define hb_atomic_int_set(AI, V)	((void) ((AI) = (V)))
 
+#define hb_atomic_ptr_get(P)		(*(P))
+#define hb_atomic_ptr_cmpexch(P, O, N)	(*(P) == (O) ? (*(P) = (N), TRUE) : FALSE)
+
 
 #endif
 
@@ -255,7 +255,9 @@ struct hb_sanitize_context_t
 template <typename Type>
 struct Sanitizer
 {
-  static hb_blob_t *sanitize (hb_blob_t *blob) {
+  /* If clean is given, it is set to whether the table passed as it was,
+   * without edits */
+  static hb_blob_t *sanitize (hb_blob_t *blob, bool *clean = NULL) {
     hb_sanitize_context_t c[1] = {{0}};
     bool sane;
 
@@ -270,6 +272,8 @@ struct Sanitizer
 
     if (unlikely (!c->start)) {
       c->finish ();
+      if (clean)
+	*clean = false;
       return blob;
     }
 
@@ -305,6 +309,9 @@ struct Sanitizer
 
     c->finish ();
 
+    if (clean)
+      *clean = sane && !c->writable;
+
     DEBUG_MSG_FUNC (SANITIZE, blob, sane ? "PASSED" : "FAILED");
     if (sane)
       return blob;
@@ -0,0 +1,261 @@
+/*
+ * Copyright © 2026  The gltext contributors
+ *
+ *  This is part of HarfBuzz, a text shaping library.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the
+ * above copyright notice and the following two paragraphs appear in
+ * all copies of this software.
+ *
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES
+ * ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN
+ * IF THE COPYRIGHT HOLDER HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * THE COPYRIGHT HOLDER SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE COPYRIGHT HOLDER HAS NO OBLIGATION TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ */
+
+#ifndef HB_OT_KERN_TABLE_HH
+#define HB_OT_KERN_TABLE_HH
+
+#include "hb-open-type-private.hh"
+#include "hb-ot-layout-private.hh"
+
+
+
+/*
+ * kern -- The Kerning Table
+ */
+
+#define HB_OT_TAG_kern HB_TAG('k','e','r','n')
+
+
+struct KernPair
+{
+  friend struct KernSubTableFormat0;
+
+  private:
+  GlyphID	left;			/* Glyph index for the left-hand
+					 * glyph in the kerning pair */
+  GlyphID	right;			/* Glyph index for the right-hand
+					 * glyph in the kerning pair */
+  FWORD		value;			/* The kerning value, in design units */
+  public:
+  DEFINE_SIZE_STATIC (6);
+};
+
+struct KernSubTableFormat0
+{
+  friend struct KernSubTable;
+
+  private:
+  inline bool get_pairs (hb_ot_layout_kern_pair_array_t &pairs) const
+  {
+    unsigned int count = nPairs;
+    for (unsigned int i = 0; i < count; i++)
+    {
+      hb_ot_layout_kern_pair_t *pair = pairs.push ();
+      if (unlikely (!pair))
+	return false;
+      pair->key = ((unsigned int) kernPair[i].left << 16) | kernPair[i].right;
+      pair->value = kernPair[i].value;
+    }
+    return true;
+  }
+
+  inline bool sanitize (hb_sanitize_context_t *c) {
+    TRACE_SANITIZE ();
+    return c->check_struct (this)
+	&& c->check_array (kernPair, KernPair::static_size, nPairs);
+  }
+
+  private:
+  USHORT	nPairs;			/* Number of kerning pairs */
+  USHORT	searchRange;		/* Largest power of two <= nPairs,
+					 * times 6 */
+  USHORT	entrySelector;		/* log2 of the above power of two */
+  USHORT	rangeShift;		/* (nPairs - that power of two) * 6 */
+  KernPair	kernPair[VAR];		/* Array of kerning pairs, ordered by
+					 * left then right glyph */
+  public:
+  DEFINE_SIZE_ARRAY (8, kernPair);
+};
+
+struct KernClassTable
+{
+  friend struct KernSubTableFormat2;
+
+  private:
+  inline unsigned int get_class (hb_codepoint_t glyph_id) const
+  {
+    return classes[glyph_id - firstGlyph];
+  }
+
+  public:
+  inline bool sanitize (hb_sanitize_context_t *c) {
+    TRACE_SANITIZE ();
+    return c->check_struct (this)
+	&& classes.sanitize (c);
+  }
+
+  private:
+  GlyphID	firstGlyph;		/* First glyph in class range */
+  ArrayOf<USHORT>
+		classes;		/* Offsets of each glyph's row (left
+					 * table) or column (right table) */
+  public:
+  DEFINE_SIZE_ARRAY (4, classes);
+};
+
+struct KernSubTableFormat2
+{
+  friend struct KernSubTable;
+
+  private:
+  /* Offsets are from the start of the subtable, at base, which is
+   * length bytes long */
+  inline int get_kerning (const void *base,
+			  unsigned int length,
+			  hb_codepoint_t left,
+			  hb_codepoint_t right) const
+  {
+    /* Glyphs outside the left class table land before the array */
+    unsigned int offset = (base+leftClassTable).get_class (left) +
+			  (base+rightClassTable).get_class (right);
+    if (unlikely (offset < array || offset + FWORD::static_size > length))
+      return 0;
+    return StructAtOffset<FWORD> (base, offset);
+  }
+
+  inline bool sanitize (hb_sanitize_context_t *c, void *base) {
+    TRACE_SANITIZE ();
+    return c->check_struct (this)
+	&& leftClassTable.sanitize (c, base)
+	&& rightClassTable.sanitize (c, base);
+  }
+
+  private:
+  USHORT	rowWidth;		/* Width, in bytes, of a row in the
+					 * table */
+  OffsetTo<KernClassTable>
+		leftClassTable;		/* Offset from beginning of this
+					 * subtable to left-hand class table */
+  OffsetTo<KernClassTable>
+		rightClassTable;	/* Offset from beginning of this
+					 * subtable to right-hand class table */
+  Offset	array;			/* Offset from beginning of this
+					 * subtable to the start of the kerning
+					 * array */
+  public:
+  DEFINE_SIZE_STATIC (8);
+};
+
+struct KernSubTable
+{
+  friend struct kern;
+
+  enum {
+    Horizontal	= 0x0001,	/* Horizontal data, rather than vertical */
+    Minimum	= 0x0002,	/* Minimum values, rather than kerning */
+    CrossStream	= 0x0004,	/* Perpendicular to the flow of the text */
+    Override	= 0x0008	/* Replaces the value accumulated so far */
+  };
+
+  inline unsigned int get_format (void) const { return coverage >> 8; }
+
+  /* Whether this is the plain horizontal kerning FreeType applies too */
+  inline bool is_horizontal_kerning (void) const
+  { return (coverage & (Horizontal | Minimum | CrossStream)) == Horizontal; }
+
+  inline bool is_override (void) const { return coverage & Override; }
+
+  inline bool get_pairs (hb_ot_layout_kern_pair_array_t &pairs) const
+  {
+    switch (get_format ()) {
+    case 0: return u.format0.get_pairs (pairs);
+    default:return true;
+    }
+  }
+
+  inline int get_kerning (hb_codepoint_t left, hb_codepoint_t right) const
+  {
+    switch (get_format ()) {
+    case 2: return u.format2.get_kerning (this, length, left, right);
+    default:return 0;
+    }
+  }
+
+  private:
+  inline const KernSubTable &get_next (void) const
+  { return StructAtOffset<KernSubTable> (this, length); }
+
+  inline bool sanitize (hb_sanitize_context_t *c) {
+    TRACE_SANITIZE ();
+    if (!(c->check_struct (this)
+       && length >= min_size
+       && c->check_range (this, length))) return false;
+    switch (get_format ()) {
+    case 0: return u.format0.sanitize (c);
+    case 2: return u.format2.sanitize (c, this);
+    default:return true;
+    }
+  }
+
+  private:
+  USHORT	version;		/* Kern subtable version number */
+  USHORT	length;			/* Length of the subtable, in bytes
+					 * (including this header) */
+  USHORT	coverage;		/* Format in the high byte; flags
+					 * above in the low byte */
+  union {
+  KernSubTableFormat0	format0;
+  KernSubTableFormat2	format2;
+  } u;
+  public:
+  DEFINE_SIZE_MIN (6);
+};
+
+/* Only the Microsoft version 0 table; Apple's version 1 tables are left to
+ * the font funcs */
+struct kern
+{
+  static const hb_tag_t Tag	= HB_OT_TAG_kern;
+
+  inline unsigned int get_subtable_count (void) const { return nTables; }
+
+  /* Subtables are walked in order, as each one's length finds the next */
+  inline const KernSubTable &get_first_subtable (void) const
+  { return StructAtOffset<KernSubTable> (this, min_size); }
+  inline const KernSubTable &get_next_subtable (const KernSubTable &subtable) const
+  { return subtable.get_next (); }
+
+  inline bool sanitize (hb_sanitize_context_t *c) {
+    TRACE_SANITIZE ();
+    if (!(c->check_struct (this) && likely (version == 0))) return false;
+    KernSubTable *subtable = &StructAtOffset<KernSubTable> (this, min_size);
+    unsigned int count = nTables;
+    for (unsigned int i = 0; i < count; i++) {
+      if (!subtable->sanitize (c)) return false;
+      subtable = &StructAtOffset<KernSubTable> (subtable, subtable->length);
+    }
+    return true;
+  }
+
+  private:
+  USHORT	version;		/* Table version number--0 */
+  USHORT	nTables;		/* Number of subtables in the kerning
+					 * table */
+  public:
+  DEFINE_SIZE_MIN (4);
+};
+
+
+
+#endif /* HB_OT_KERN_TABLE_HH */
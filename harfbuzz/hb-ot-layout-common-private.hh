@@ -140,6 +140,41 @@ struct RangeRecord
 };
 DEFINE_NULL_DATA (RangeRecord, "\000\001");
 
+/* Converts sorted RangeRecords to native ranges, merging neighbours.  For
+ * Coverage the value is the index of the range's first glyph; for ClassDef
+ * it is the class of every glyph in the range. */
+static inline bool
+_add_ranges (const SortedArrayOf<RangeRecord> &records,
+	     hb_ot_layout_range_array_t &ranges,
+	     bool incremental)
+{
+  unsigned int count = records.len;
+  for (unsigned int i = 0; i < count; i++) {
+    hb_codepoint_t start = records[i].start, end = records[i].end;
+    unsigned int value = records[i].value;
+    if (unlikely (start > end || (incremental && value + (end - start) >= 0xFFFF)))
+      return false;
+    if (ranges.len) {
+      hb_ot_layout_range_t &last = ranges[ranges.len - 1];
+      /* Overlapping or unsorted records search differently; leave them in place */
+      if (unlikely (start <= last.end))
+        return false;
+      if (start == last.end + 1u &&
+	  value == (incremental ? last.value + (last.end - last.start) + 1u : last.value)) {
+        last.end = end;
+        continue;
+      }
+    }
+    hb_ot_layout_range_t *range = ranges.push ();
+    if (unlikely (!range))
+      return false;
+    range->start = start;
+    range->end = end;
+    range->value = value;
+  }
+  return true;
+}
+
 
 struct IndexArray : ArrayOf<Index>
 {
@@ -350,6 +385,45 @@ struct CoverageFormat1
     return NOT_COVERED;
   }
 
+  inline unsigned int get_search_len (void) const { return glyphArray.len; }
+
+  inline bool add_ranges (hb_ot_layout_range_array_t &ranges) const
+  {
+    unsigned int count = glyphArray.len;
+    for (unsigned int i = 0; i < count; i++) {
+      hb_codepoint_t g = glyphArray[i];
+      if (i && ranges[ranges.len - 1].end + 1 == g) {
+        ranges[ranges.len - 1].end = g;
+        continue;
+      }
+      /* Out of order glyphs search differently; leave them in place */
+      if (unlikely (i && g <= ranges[ranges.len - 1].end))
+        return false;
+      hb_ot_layout_range_t *range = ranges.push ();
+      if (unlikely (!range))
+        return false;
+      range->start = range->end = g;
+      range->value = i;
+    }
+    return true;
+  }
+
+  inline void add_coverage (hb_set_digest_t *digest) const
+  {
+    unsigned int count = glyphArray.len;
+    for (unsigned int i = 0; i < count; i++)
+      digest->add (glyphArray[i]);
+  }
+
+  inline void add_bounds (hb_codepoint_t *first, hb_codepoint_t *last) const
+  {
+    unsigned int count = glyphArray.len;
+    for (unsigned int i = 0; i < count; i++) {
+      *first = MIN (*first, (hb_codepoint_t) glyphArray[i]);
+      *last = MAX (*last, (hb_codepoint_t) glyphArray[i]);
+    }
+  }
+
   inline bool sanitize (hb_sanitize_context_t *c) {
     TRACE_SANITIZE ();
     return glyphArray.sanitize (c);
@@ -378,6 +452,31 @@ struct CoverageFormat2
     return NOT_COVERED;
   }
 
+  inline unsigned int get_search_len (void) const { return rangeRecord.len; }
+
+  inline bool add_ranges (hb_ot_layout_range_array_t &ranges) const
+  {
+    return _add_ranges (rangeRecord, ranges, true);
+  }
+
+  inline void add_coverage (hb_set_digest_t *digest) const
+  {
+    unsigned int count = rangeRecord.len;
+    for (unsigned int i = 0; i < count; i++)
+      if (likely (rangeRecord[i].start <= rangeRecord[i].end))
+        digest->add_range (rangeRecord[i].start, rangeRecord[i].end);
+  }
+
+  inline void add_bounds (hb_codepoint_t *first, hb_codepoint_t *last) const
+  {
+    unsigned int count = rangeRecord.len;
+    for (unsigned int i = 0; i < count; i++)
+      if (likely (rangeRecord[i].start <= rangeRecord[i].end)) {
+	*first = MIN (*first, (hb_codepoint_t) rangeRecord[i].start);
+	*last = MAX (*last, (hb_codepoint_t) rangeRecord[i].end);
+      }
+  }
+
   inline bool sanitize (hb_sanitize_context_t *c) {
     TRACE_SANITIZE ();
     return rangeRecord.sanitize (c);
@@ -406,6 +505,48 @@ struct Coverage
     }
   }
 
+  /* Number of entries get_coverage() binary-searches */
+  inline unsigned int get_search_len (void) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_search_len ();
+    case 2: return u.format2.get_search_len ();
+    default:return 0;
+    }
+  }
+
+  /* Appends the native-endian ranges of the table, or returns false if it
+   * cannot be represented that way with identical lookup results */
+  inline bool add_ranges (hb_ot_layout_range_array_t &ranges) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.add_ranges (ranges);
+    case 2: return u.format2.add_ranges (ranges);
+    default:return true;
+    }
+  }
+
+  /* Adds every glyph get_coverage() could return an index for */
+  inline void add_coverage (hb_set_digest_t *digest) const
+  {
+    switch (u.format) {
+    case 1: u.format1.add_coverage (digest); break;
+    case 2: u.format2.add_coverage (digest); break;
+    default:break;
+    }
+  }
+
+  /* Widens [*first, *last] to include every glyph get_coverage() could
+   * return an index for */
+  inline void add_bounds (hb_codepoint_t *first, hb_codepoint_t *last) const
+  {
+    switch (u.format) {
+    case 1: u.format1.add_bounds (first, last); break;
+    case 2: u.format2.add_bounds (first, last); break;
+    default:break;
+    }
+  }
+
   inline bool sanitize (hb_sanitize_context_t *c) {
     TRACE_SANITIZE ();
     if (!u.format.sanitize (c)) return false;
@@ -470,6 +611,13 @@ struct ClassDefFormat2
     return 0;
   }
 
+  inline unsigned int get_search_len (void) const { return rangeRecord.len; }
+
+  inline bool add_ranges (hb_ot_layout_range_array_t &ranges) const
+  {
+    return _add_ranges (rangeRecord, ranges, false);
+  }
+
   inline bool sanitize (hb_sanitize_context_t *c) {
     TRACE_SANITIZE ();
     return rangeRecord.sanitize (c);
@@ -496,6 +644,23 @@ struct ClassDef
     }
   }
 
+  /* Format 1 is already a direct array; only format 2 is searched */
+  inline unsigned int get_search_len (void) const
+  {
+    switch (u.format) {
+    case 2: return u.format2.get_search_len ();
+    default:return 0;
+    }
+  }
+
+  inline bool add_ranges (hb_ot_layout_range_array_t &ranges) const
+  {
+    switch (u.format) {
+    case 2: return u.format2.add_ranges (ranges);
+    default:return false;
+    }
+  }
+
   inline bool sanitize (hb_sanitize_context_t *c) {
     TRACE_SANITIZE ();
     if (!u.format.sanitize (c)) return false;
@@ -434,10 +434,13 @@ struct SinglePosFormat1
   friend struct SinglePos;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
-    unsigned int index = (this+coverage) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int index = c->get_coverage (this+coverage, c->buffer->info[c->buffer->idx].codepoint);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -474,10 +477,13 @@ struct SinglePosFormat2
   friend struct SinglePos;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
-    unsigned int index = (this+coverage) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int index = c->get_coverage (this+coverage, c->buffer->info[c->buffer->idx].codepoint);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -518,6 +524,15 @@ struct SinglePos
   friend struct PosLookupSubTable;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_coverage ();
+    case 2: return u.format2.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -595,6 +610,23 @@ struct PairSet
     return false;
   }
 
+  /* For PairPosFormat1::get_kern_pairs(), where each record is a glyph and an x advance */
+  inline bool get_kern_pairs (unsigned int index, hb_ot_layout_kern_pair_array_t &pairs) const
+  {
+    unsigned int count = len;
+    const PairValueRecord *record = CastP<PairValueRecord> (array);
+    for (unsigned int i = 0; i < count; i++)
+    {
+      hb_ot_layout_kern_pair_t *pair = pairs.push ();
+      if (unlikely (!pair))
+	return false;
+      pair->key = (index << 16) | record->secondGlyph;
+      pair->value = (int16_t) *CastP<SHORT> (&record->values[0]);
+      record = &StructAtOffset<PairValueRecord> (record, 2 * USHORT::static_size);
+    }
+    return true;
+  }
+
   struct sanitize_closure_t {
     void *base;
     ValueFormat *valueFormats;
@@ -626,6 +658,9 @@ struct PairPosFormat1
   friend struct PairPos;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -633,7 +668,7 @@ struct PairPosFormat1
     if (unlikely (c->buffer->idx + 2 > end))
       return false;
 
-    unsigned int index = (this+coverage) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int index = c->get_coverage (this+coverage, c->buffer->info[c->buffer->idx].codepoint);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -645,9 +680,38 @@ struct PairPosFormat1
       j++;
     }
 
+    const hb_ot_layout_accelerator_t *accel = is_kerning () ? _hb_ot_layout_get_accelerator (c->face, this, hb_ot_layout_accelerator_t::PAIR_POS_1) : NULL;
+    if (accel)
+    {
+      int kern;
+      if (!accel->get_kern_pair (index, c->buffer->info[j].codepoint, &kern))
+	return false;
+      if (likely (HB_DIRECTION_IS_HORIZONTAL (c->direction)))
+	c->buffer->pos[c->buffer->idx].x_advance += c->font->em_scale_x (kern);
+      c->buffer->idx = j;
+      return true;
+    }
+
     return (this+pairSet[index]).apply (c, &valueFormat1, j);
   }
 
+  public:
+  /* Whether the subtable only adjusts the x advance of the first glyph */
+  inline bool is_kerning (void) const
+  { return valueFormat1 == ValueFormat::xAdvance && !valueFormat2; }
+
+  /* For kerning subtables: appends every pair, in the order apply() tries them */
+  inline bool get_kern_pairs (hb_ot_layout_kern_pair_array_t &pairs) const
+  {
+    unsigned int count = pairSet.len;
+    for (unsigned int index = 0; index < count; index++)
+      if (unlikely (!(this+pairSet[index]).get_kern_pairs (index, pairs)))
+	return false;
+    return true;
+  }
+
+  private:
+
   inline bool sanitize (hb_sanitize_context_t *c) {
     TRACE_SANITIZE ();
 
@@ -688,6 +752,9 @@ struct PairPosFormat2
   friend struct PairPos;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -695,7 +762,7 @@ struct PairPosFormat2
     if (unlikely (c->buffer->idx + 2 > end))
       return false;
 
-    unsigned int index = (this+coverage) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int index = c->get_coverage (this+coverage, c->buffer->info[c->buffer->idx].codepoint);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -711,11 +778,20 @@ struct PairPosFormat2
     unsigned int len2 = valueFormat2.get_len ();
     unsigned int record_len = len1 + len2;
 
-    unsigned int klass1 = (this+classDef1) (c->buffer->info[c->buffer->idx].codepoint);
-    unsigned int klass2 = (this+classDef2) (c->buffer->info[j].codepoint);
+    unsigned int klass1 = c->get_class (this+classDef1, c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int klass2 = c->get_class (this+classDef2, c->buffer->info[j].codepoint);
     if (unlikely (klass1 >= class1Count || klass2 >= class2Count))
       return false;
 
+    const hb_ot_layout_accelerator_t *accel = is_kerning () ? _hb_ot_layout_get_accelerator (c->face, this, hb_ot_layout_accelerator_t::PAIR_POS_2) : NULL;
+    if (accel)
+    {
+      if (likely (HB_DIRECTION_IS_HORIZONTAL (c->direction)))
+	c->buffer->pos[c->buffer->idx].x_advance += c->font->em_scale_x (accel->kerns[klass1 * class2Count + klass2]);
+      c->buffer->idx = j;
+      return true;
+    }
+
     const Value *v = &values[record_len * (klass1 * class2Count + klass2)];
     valueFormat1.apply_value (c->font, c->direction, this,
 			      v, c->buffer->pos[c->buffer->idx]);
@@ -729,6 +805,24 @@ struct PairPosFormat2
     return true;
   }
 
+  public:
+  /* Whether the subtable only adjusts the x advance of the first glyph */
+  inline bool is_kerning (void) const
+  { return valueFormat1 == ValueFormat::xAdvance && !valueFormat2; }
+
+  inline unsigned int get_kern_count (void) const
+  { return (unsigned int) class1Count * (unsigned int) class2Count; }
+
+  /* For kerning subtables: the class-pair matrix, get_kern_count() long */
+  inline void get_kerns (int16_t *kerns) const
+  {
+    unsigned int count = get_kern_count ();
+    for (unsigned int i = 0; i < count; i++)
+      kerns[i] = *CastP<SHORT> (&values[i]);
+  }
+
+  private:
+
   inline bool sanitize (hb_sanitize_context_t *c) {
     TRACE_SANITIZE ();
     if (!(c->check_struct (this)
@@ -781,6 +875,15 @@ struct PairPos
   friend struct PosLookupSubTable;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_coverage ();
+    case 2: return u.format2.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -838,6 +941,9 @@ struct CursivePosFormat1
   friend struct CursivePos;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -850,7 +956,7 @@ struct CursivePosFormat1
     if (unlikely (c->buffer->idx + 2 > end))
       return false;
 
-    const EntryExitRecord &this_record = entryExitRecord[(this+coverage) (c->buffer->info[c->buffer->idx].codepoint)];
+    const EntryExitRecord &this_record = entryExitRecord[c->get_coverage (this+coverage, c->buffer->info[c->buffer->idx].codepoint)];
     if (!this_record.exitAnchor)
       return false;
 
@@ -862,7 +968,7 @@ struct CursivePosFormat1
       j++;
     }
 
-    const EntryExitRecord &next_record = entryExitRecord[(this+coverage) (c->buffer->info[j].codepoint)];
+    const EntryExitRecord &next_record = entryExitRecord[c->get_coverage (this+coverage, c->buffer->info[j].codepoint)];
     if (!next_record.entryAnchor)
       return false;
 
@@ -952,6 +1058,14 @@ struct CursivePos
   friend struct PosLookupSubTable;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -988,10 +1102,13 @@ struct MarkBasePosFormat1
   friend struct MarkBasePos;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+markCoverage; }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
-    unsigned int mark_index = (this+markCoverage) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int mark_index = c->get_coverage (this+markCoverage, c->buffer->info[c->buffer->idx].codepoint);
     if (likely (mark_index == NOT_COVERED))
       return false;
 
@@ -1009,7 +1126,7 @@ struct MarkBasePosFormat1
     if (!(property & HB_OT_LAYOUT_GLYPH_CLASS_BASE_GLYPH))
     {/*return false;*/}
 
-    unsigned int base_index = (this+baseCoverage) (c->buffer->info[j].codepoint);
+    unsigned int base_index = c->get_coverage (this+baseCoverage, c->buffer->info[j].codepoint);
     if (base_index == NOT_COVERED)
       return false;
 
@@ -1049,6 +1166,14 @@ struct MarkBasePos
   friend struct PosLookupSubTable;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -1090,10 +1215,13 @@ struct MarkLigPosFormat1
   friend struct MarkLigPos;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+markCoverage; }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
-    unsigned int mark_index = (this+markCoverage) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int mark_index = c->get_coverage (this+markCoverage, c->buffer->info[c->buffer->idx].codepoint);
     if (likely (mark_index == NOT_COVERED))
       return false;
 
@@ -1111,7 +1239,7 @@ struct MarkLigPosFormat1
     if (!(property & HB_OT_LAYOUT_GLYPH_CLASS_LIGATURE))
     {/*return false;*/}
 
-    unsigned int lig_index = (this+ligatureCoverage) (c->buffer->info[j].codepoint);
+    unsigned int lig_index = c->get_coverage (this+ligatureCoverage, c->buffer->info[j].codepoint);
     if (lig_index == NOT_COVERED)
       return false;
 
@@ -1173,6 +1301,14 @@ struct MarkLigPos
   friend struct PosLookupSubTable;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -1209,10 +1345,13 @@ struct MarkMarkPosFormat1
   friend struct MarkMarkPos;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+mark1Coverage; }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
-    unsigned int mark1_index = (this+mark1Coverage) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int mark1_index = c->get_coverage (this+mark1Coverage, c->buffer->info[c->buffer->idx].codepoint);
     if (likely (mark1_index == NOT_COVERED))
       return false;
 
@@ -1236,7 +1375,7 @@ struct MarkMarkPosFormat1
 	(c->buffer->info[j].lig_comp() && c->buffer->info[j].lig_id() != c->buffer->info[c->buffer->idx].lig_id()))
       return false;
 
-    unsigned int mark2_index = (this+mark2Coverage) (c->buffer->info[j].codepoint);
+    unsigned int mark2_index = c->get_coverage (this+mark2Coverage, c->buffer->info[j].codepoint);
     if (mark2_index == NOT_COVERED)
       return false;
 
@@ -1278,6 +1417,14 @@ struct MarkMarkPos
   friend struct PosLookupSubTable;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -1343,6 +1490,8 @@ struct ExtensionPos : Extension
     return StructAtOffset<PosLookupSubTable> (this, offset);
   }
 
+  inline const Coverage &get_coverage (void) const;
+
   inline bool apply (hb_apply_context_t *c) const;
 
   inline bool sanitize (hb_sanitize_context_t *c);
@@ -1371,6 +1520,22 @@ struct PosLookupSubTable
     Extension		= 9
   };
 
+  inline const Coverage &get_coverage (unsigned int lookup_type) const
+  {
+    switch (lookup_type) {
+    case Single:		return u.single.get_coverage ();
+    case Pair:			return u.pair.get_coverage ();
+    case Cursive:		return u.cursive.get_coverage ();
+    case MarkBase:		return u.markBase.get_coverage ();
+    case MarkLig:		return u.markLig.get_coverage ();
+    case MarkMark:		return u.markMark.get_coverage ();
+    case Context:		return u.c.get_coverage ();
+    case ChainContext:		return u.chainContext.get_coverage ();
+    case Extension:		return u.extension.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c, unsigned int lookup_type) const
   {
     TRACE_APPLY ();
@@ -1427,11 +1592,28 @@ struct PosLookup : Lookup
   inline const PosLookupSubTable& get_subtable (unsigned int i) const
   { return this+CastR<OffsetArrayOf<PosLookupSubTable> > (subTable)[i]; }
 
+  /* Fills in one digest per subtable, and their union in lookup_digest */
+  inline void collect_digests (hb_set_digest_t *lookup_digest,
+			       hb_set_digest_t *subtable_digests) const
+  {
+    unsigned int lookup_type = get_type ();
+    unsigned int count = get_subtable_count ();
+    lookup_digest->init ();
+    for (unsigned int i = 0; i < count; i++) {
+      subtable_digests[i].init ();
+      get_subtable (i).get_coverage (lookup_type).add_coverage (&subtable_digests[i]);
+      lookup_digest->add (subtable_digests[i]);
+    }
+  }
+
+  /* subtable_digests, if not NULL, has one digest per subtable; subtables
+   * whose digest cannot have the current glyph are not tried. */
   inline bool apply_once (hb_font_t *font,
 			  hb_buffer_t *buffer,
 			  hb_mask_t lookup_mask,
 			  unsigned int context_length,
-			  unsigned int nesting_level_left) const
+			  unsigned int nesting_level_left,
+			  const hb_set_digest_t *subtable_digests) const
   {
     unsigned int lookup_type = get_type ();
     hb_apply_context_t c[1] = {{0}};
@@ -1448,8 +1630,10 @@ struct PosLookup : Lookup
     if (!_hb_ot_layout_check_glyph_property (c->face, &c->buffer->info[c->buffer->idx], c->lookup_props, &c->property))
       return false;
 
+    hb_codepoint_t glyph = c->buffer->info[c->buffer->idx].codepoint;
     for (unsigned int i = 0; i < get_subtable_count (); i++)
-      if (get_subtable (i).apply (c, lookup_type))
+      if ((!subtable_digests || subtable_digests[i].may_have (glyph)) &&
+	  get_subtable (i).apply (c, lookup_type))
 	return true;
 
     return false;
@@ -1457,7 +1641,8 @@ struct PosLookup : Lookup
 
    inline bool apply_string (hb_font_t   *font,
 			     hb_buffer_t *buffer,
-			     hb_mask_t    mask) const
+			     hb_mask_t    mask,
+			     const hb_set_digest_t *subtable_digests) const
   {
     bool ret = false;
 
@@ -1468,7 +1653,7 @@ struct PosLookup : Lookup
     while (buffer->idx < buffer->len)
     {
       if ((buffer->info[buffer->idx].mask & mask) &&
-	  apply_once (font, buffer, mask, NO_CONTEXT, MAX_NESTING_LEVEL))
+	  apply_once (font, buffer, mask, NO_CONTEXT, MAX_NESTING_LEVEL, subtable_digests))
 	ret = true;
       else
 	buffer->idx++;
@@ -1501,8 +1686,9 @@ struct GPOS : GSUBGPOS
   inline bool position_lookup (hb_font_t    *font,
 			       hb_buffer_t  *buffer,
 			       unsigned int  lookup_index,
-			       hb_mask_t     mask) const
-  { return get_lookup (lookup_index).apply_string (font, buffer, mask); }
+			       hb_mask_t     mask,
+			       const hb_set_digest_t *subtable_digests) const
+  { return get_lookup (lookup_index).apply_string (font, buffer, mask, subtable_digests); }
 
   static inline void position_start (hb_buffer_t *buffer);
   static inline void position_finish (hb_buffer_t *buffer);
@@ -1595,6 +1781,11 @@ GPOS::position_finish (hb_buffer_t *buffer)
 
 /* Out-of-class implementation for methods recursing */
 
+inline const Coverage &ExtensionPos::get_coverage (void) const
+{
+  return get_subtable ().get_coverage (get_type ());
+}
+
 inline bool ExtensionPos::apply (hb_apply_context_t *c) const
 {
   TRACE_APPLY ();
@@ -1621,7 +1812,9 @@ static inline bool position_lookup (hb_apply_context_t *c, unsigned int lookup_i
   if (unlikely (c->context_length < 1))
     return false;
 
-  return l.apply_once (c->font, c->buffer, c->lookup_mask, c->context_length, c->nesting_level_left - 1);
+  const hb_ot_layout_lookup_digests_t *digests = _hb_ot_layout_get_lookup_digests (c->face, 1);
+  return l.apply_once (c->font, c->buffer, c->lookup_mask, c->context_length, c->nesting_level_left - 1,
+		       digests ? digests->get_subtable_digests (lookup_index) : NULL);
 }
 
 
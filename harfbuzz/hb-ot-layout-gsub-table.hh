@@ -39,11 +39,14 @@ struct SingleSubstFormat1
 
   private:
 
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
     hb_codepoint_t glyph_id = c->buffer->info[c->buffer->idx].codepoint;
-    unsigned int index = (this+coverage) (glyph_id);
+    unsigned int index = c->get_coverage (this+coverage, glyph_id);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -55,6 +58,15 @@ struct SingleSubstFormat1
     return true;
   }
 
+  inline bool get_substitute (hb_codepoint_t glyph_id, hb_codepoint_t *substitute) const
+  {
+    if (likely ((this+coverage) (glyph_id) == NOT_COVERED))
+      return false;
+
+    *substitute = (glyph_id + deltaGlyphID) & 0xFFFF;
+    return true;
+  }
+
   inline bool sanitize (hb_sanitize_context_t *c) {
     TRACE_SANITIZE ();
     return coverage.sanitize (c, this)
@@ -78,11 +90,14 @@ struct SingleSubstFormat2
 
   private:
 
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
     hb_codepoint_t glyph_id = c->buffer->info[c->buffer->idx].codepoint;
-    unsigned int index = (this+coverage) (glyph_id);
+    unsigned int index = c->get_coverage (this+coverage, glyph_id);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -95,6 +110,19 @@ struct SingleSubstFormat2
     return true;
   }
 
+  inline bool get_substitute (hb_codepoint_t glyph_id, hb_codepoint_t *substitute_out) const
+  {
+    unsigned int index = (this+coverage) (glyph_id);
+    if (likely (index == NOT_COVERED))
+      return false;
+
+    if (unlikely (index >= substitute.len))
+      return false;
+
+    *substitute_out = substitute[index];
+    return true;
+  }
+
   inline bool sanitize (hb_sanitize_context_t *c) {
     TRACE_SANITIZE ();
     return coverage.sanitize (c, this)
@@ -119,6 +147,15 @@ struct SingleSubst
 
   private:
 
+  inline const Coverage &get_coverage (void) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_coverage ();
+    case 2: return u.format2.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -129,6 +166,17 @@ struct SingleSubst
     }
   }
 
+  /* What apply() would replace glyph_id with, without a buffer; the
+   * Coverage is searched in place */
+  inline bool get_substitute (hb_codepoint_t glyph_id, hb_codepoint_t *substitute) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_substitute (glyph_id, substitute);
+    case 2: return u.format2.get_substitute (glyph_id, substitute);
+    default:return false;
+    }
+  }
+
   inline bool sanitize (hb_sanitize_context_t *c) {
     TRACE_SANITIZE ();
     if (!u.format.sanitize (c)) return false;
@@ -185,11 +233,14 @@ struct MultipleSubstFormat1
 
   private:
 
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
 
-    unsigned int index = (this+coverage) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int index = c->get_coverage (this+coverage, c->buffer->info[c->buffer->idx].codepoint);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -220,6 +271,14 @@ struct MultipleSubst
 
   private:
 
+  inline const Coverage &get_coverage (void) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -255,6 +314,9 @@ struct AlternateSubstFormat1
 
   private:
 
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -262,7 +324,7 @@ struct AlternateSubstFormat1
     hb_mask_t glyph_mask = c->buffer->info[c->buffer->idx].mask;
     hb_mask_t lookup_mask = c->lookup_mask;
 
-    unsigned int index = (this+coverage) (glyph_id);
+    unsigned int index = c->get_coverage (this+coverage, glyph_id);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -309,6 +371,14 @@ struct AlternateSubst
 
   private:
 
+  inline const Coverage &get_coverage (void) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -434,6 +504,30 @@ struct LigatureSet
   {
     TRACE_APPLY ();
     unsigned int num_ligs = ligature.len;
+    if (num_ligs >= HB_OT_LAYOUT_LIGATURE_TRIE_MIN_LEN)
+    {
+      const hb_ot_layout_accelerator_t *accel = _hb_ot_layout_get_accelerator (c->face, this, hb_ot_layout_accelerator_t::LIGATURE_SET);
+      if (likely (accel))
+      {
+	/* Walk the glyphs Ligature::apply() would compare, skipping the
+	 * same marks, for the most preferred ligature that matches */
+	unsigned int end = MIN (c->buffer->len, c->buffer->idx + c->context_length);
+	const hb_ot_layout_trie_node_t *node = accel->nodes;
+	unsigned int best = 0xFFFF;
+	for (unsigned int j = c->buffer->idx + 1; j < end && node->min_ligature < best; j++)
+	{
+	  if (_hb_ot_layout_skip_mark (c->face, &c->buffer->info[j], c->lookup_props, NULL))
+	    continue;
+	  node = accel->get_child (node, c->buffer->info[j].codepoint);
+	  if (!node)
+	    break;
+	  best = MIN (best, (unsigned int) node->ligature);
+	}
+
+	return best != 0xFFFF && (this+ligature[best]).apply (c);
+      }
+    }
+
     for (unsigned int i = 0; i < num_ligs; i++)
     {
       const Ligature &lig = this+ligature[i];
@@ -445,6 +539,25 @@ struct LigatureSet
   }
 
   public:
+  /* Appends the ligatures apply() could match, for building a trie */
+  inline bool get_ligatures (hb_ot_layout_ligature_array_t &ligatures) const
+  {
+    unsigned int num_ligs = ligature.len;
+    for (unsigned int i = 0; i < num_ligs; i++)
+    {
+      const Ligature &lig = this+ligature[i];
+      if (lig.component.len < 2)
+        continue;
+      hb_ot_layout_ligature_t *entry = ligatures.push ();
+      if (unlikely (!entry))
+        return false;
+      entry->components_be = (const uint16_t *) &lig.component[1];
+      entry->num_components = lig.component.len - 1;
+      entry->index = i;
+    }
+    return true;
+  }
+
   inline bool sanitize (hb_sanitize_context_t *c) {
     TRACE_SANITIZE ();
     return ligature.sanitize (c, this);
@@ -463,12 +576,15 @@ struct LigatureSubstFormat1
   friend struct LigatureSubst;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
     hb_codepoint_t glyph_id = c->buffer->info[c->buffer->idx].codepoint;
 
-    unsigned int index = (this+coverage) (glyph_id);
+    unsigned int index = c->get_coverage (this+coverage, glyph_id);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -499,6 +615,14 @@ struct LigatureSubst
   friend struct SubstLookupSubTable;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -565,11 +689,15 @@ struct ExtensionSubst : Extension
     return StructAtOffset<SubstLookupSubTable> (this, offset);
   }
 
+  inline const Coverage &get_coverage (void) const;
+
   inline bool apply (hb_apply_context_t *c) const;
 
   inline bool sanitize (hb_sanitize_context_t *c);
 
   inline bool is_reverse (void) const;
+
+  inline bool get_single_substitute (hb_codepoint_t glyph_id, hb_codepoint_t *substitute) const;
 };
 
 
@@ -578,13 +706,16 @@ struct ReverseChainSingleSubstFormat1
   friend struct ReverseChainSingleSubst;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
     if (unlikely (c->context_length != NO_CONTEXT))
       return false; /* No chaining to this type */
 
-    unsigned int index = (this+coverage) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int index = c->get_coverage (this+coverage, c->buffer->info[c->buffer->idx].codepoint);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -644,6 +775,14 @@ struct ReverseChainSingleSubst
   friend struct SubstLookupSubTable;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c) const
   {
     TRACE_APPLY ();
@@ -690,6 +829,21 @@ struct SubstLookupSubTable
     ReverseChainSingle	= 8
   };
 
+  inline const Coverage &get_coverage (unsigned int lookup_type) const
+  {
+    switch (lookup_type) {
+    case Single:		return u.single.get_coverage ();
+    case Multiple:		return u.multiple.get_coverage ();
+    case Alternate:		return u.alternate.get_coverage ();
+    case Ligature:		return u.ligature.get_coverage ();
+    case Context:		return u.c.get_coverage ();
+    case ChainContext:		return u.chainContext.get_coverage ();
+    case Extension:		return u.extension.get_coverage ();
+    case ReverseChainSingle:	return u.reverseChainContextSingle.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c, unsigned int lookup_type) const
   {
     TRACE_APPLY ();
@@ -706,6 +860,17 @@ struct SubstLookupSubTable
     }
   }
 
+  inline bool get_single_substitute (unsigned int lookup_type,
+				     hb_codepoint_t glyph_id,
+				     hb_codepoint_t *substitute) const
+  {
+    switch (lookup_type) {
+    case Single:		return u.single.get_substitute (glyph_id, substitute);
+    case Extension:		return u.extension.get_single_substitute (glyph_id, substitute);
+    default:return false;
+    }
+  }
+
   inline bool sanitize (hb_sanitize_context_t *c, unsigned int lookup_type) {
     TRACE_SANITIZE ();
     switch (lookup_type) {
@@ -746,6 +911,53 @@ struct SubstLookup : Lookup
   inline static bool lookup_type_is_reverse (unsigned int lookup_type)
   { return lookup_type == SubstLookupSubTable::ReverseChainSingle; }
 
+  /* Single and alternate substitutions replace one glyph with one glyph */
+  inline static bool lookup_type_is_one_to_one (unsigned int lookup_type)
+  { return lookup_type == SubstLookupSubTable::Single || lookup_type == SubstLookupSubTable::Alternate; }
+
+  inline static bool lookup_type_is_single (unsigned int lookup_type)
+  { return lookup_type == SubstLookupSubTable::Single; }
+
+  /* Whether pred holds for the lookup type, or for the type of every
+   * subtable of an extension lookup */
+  inline bool type_is (bool (*pred) (unsigned int lookup_type)) const
+  {
+    unsigned int type = get_type ();
+    if (unlikely (type == SubstLookupSubTable::Extension))
+    {
+      unsigned int count = get_subtable_count ();
+      for (unsigned int i = 0; i < count; i++)
+        if (!pred (get_subtable (i).u.extension.get_type ()))
+	  return false;
+      return count > 0;
+    }
+    return pred (type);
+  }
+
+  inline bool is_one_to_one (void) const { return type_is (lookup_type_is_one_to_one); }
+  inline bool is_single (void) const { return type_is (lookup_type_is_single); }
+
+  /* For single substitution lookups: what apply_once() would replace glyph
+   * with, ignoring lookup flags */
+  inline bool get_single_substitute (hb_codepoint_t glyph, hb_codepoint_t *substitute) const
+  {
+    unsigned int lookup_type = get_type ();
+    unsigned int count = get_subtable_count ();
+    for (unsigned int i = 0; i < count; i++)
+      if (get_subtable (i).get_single_substitute (lookup_type, glyph, substitute))
+	return true;
+    return false;
+  }
+
+  /* Widens [*first, *last] to include every glyph the lookup's subtables cover */
+  inline void add_bounds (hb_codepoint_t *first, hb_codepoint_t *last) const
+  {
+    unsigned int lookup_type = get_type ();
+    unsigned int count = get_subtable_count ();
+    for (unsigned int i = 0; i < count; i++)
+      get_subtable (i).get_coverage (lookup_type).add_bounds (first, last);
+  }
+
   inline bool is_reverse (void) const
   {
     unsigned int type = get_type ();
@@ -755,11 +967,28 @@ struct SubstLookup : Lookup
   }
 
 
+  /* Fills in one digest per subtable, and their union in lookup_digest */
+  inline void collect_digests (hb_set_digest_t *lookup_digest,
+			       hb_set_digest_t *subtable_digests) const
+  {
+    unsigned int lookup_type = get_type ();
+    unsigned int count = get_subtable_count ();
+    lookup_digest->init ();
+    for (unsigned int i = 0; i < count; i++) {
+      subtable_digests[i].init ();
+      get_subtable (i).get_coverage (lookup_type).add_coverage (&subtable_digests[i]);
+      lookup_digest->add (subtable_digests[i]);
+    }
+  }
+
+  /* subtable_digests, if not NULL, has one digest per subtable; subtables
+   * whose digest cannot have the current glyph are not tried. */
   inline bool apply_once (hb_face_t *face,
 			  hb_buffer_t *buffer,
 			  hb_mask_t lookup_mask,
 			  unsigned int context_length,
-			  unsigned int nesting_level_left) const
+			  unsigned int nesting_level_left,
+			  const hb_set_digest_t *subtable_digests) const
   {
     unsigned int lookup_type = get_type ();
     hb_apply_context_t c[1] = {{0}};
@@ -789,9 +1018,11 @@ struct SubstLookup : Lookup
 	  return false;
     }
 
+    hb_codepoint_t glyph = c->buffer->info[c->buffer->idx].codepoint;
     unsigned int count = get_subtable_count ();
     for (unsigned int i = 0; i < count; i++)
-      if (get_subtable (i).apply (c, lookup_type))
+      if ((!subtable_digests || subtable_digests[i].may_have (glyph)) &&
+	  get_subtable (i).apply (c, lookup_type))
 	return true;
 
     return false;
@@ -799,14 +1030,29 @@ struct SubstLookup : Lookup
 
   inline bool apply_string (hb_face_t   *face,
 			    hb_buffer_t *buffer,
-			    hb_mask_t    mask) const
+			    hb_mask_t    mask,
+			    const hb_set_digest_t *subtable_digests) const
   {
     bool ret = false;
 
     if (unlikely (!buffer->len))
       return false;
 
-    if (likely (!is_reverse ()))
+    if (is_one_to_one ())
+    {
+	/* in-place forward substitution; the length never changes */
+	buffer->clear_output_in_place ();
+	buffer->idx = 0;
+	while (buffer->idx < buffer->len)
+	{
+	  if ((buffer->info[buffer->idx].mask & mask) &&
+	      apply_once (face, buffer, mask, NO_CONTEXT, MAX_NESTING_LEVEL, subtable_digests))
+	    ret = true;
+	  else
+	    buffer->idx++;
+	}
+    }
+    else if (likely (!is_reverse ()))
     {
 	/* in/out forward substitution */
 	buffer->clear_output ();
@@ -814,7 +1060,7 @@ struct SubstLookup : Lookup
 	while (buffer->idx < buffer->len)
 	{
 	  if ((buffer->info[buffer->idx].mask & mask) &&
-	      apply_once (face, buffer, mask, NO_CONTEXT, MAX_NESTING_LEVEL))
+	      apply_once (face, buffer, mask, NO_CONTEXT, MAX_NESTING_LEVEL, subtable_digests))
 	    ret = true;
 	  else
 	    buffer->next_glyph ();
@@ -830,7 +1076,7 @@ struct SubstLookup : Lookup
 	do
 	{
 	  if ((buffer->info[buffer->idx].mask & mask) &&
-	      apply_once (face, buffer, mask, NO_CONTEXT, MAX_NESTING_LEVEL))
+	      apply_once (face, buffer, mask, NO_CONTEXT, MAX_NESTING_LEVEL, subtable_digests))
 	    ret = true;
 	  else
 	    buffer->idx--;
@@ -866,8 +1112,9 @@ struct GSUB : GSUBGPOS
   inline bool substitute_lookup (hb_face_t    *face,
 				 hb_buffer_t  *buffer,
 			         unsigned int  lookup_index,
-				 hb_mask_t     mask) const
-  { return get_lookup (lookup_index).apply_string (face, buffer, mask); }
+				 hb_mask_t     mask,
+				 const hb_set_digest_t *subtable_digests) const
+  { return get_lookup (lookup_index).apply_string (face, buffer, mask, subtable_digests); }
 
   static inline void substitute_start (hb_buffer_t *buffer);
   static inline void substitute_finish (hb_buffer_t *buffer);
@@ -903,12 +1150,22 @@ GSUB::substitute_finish (hb_buffer_t *buffer)
 
 /* Out-of-class implementation for methods recursing */
 
+inline const Coverage &ExtensionSubst::get_coverage (void) const
+{
+  return get_subtable ().get_coverage (get_type ());
+}
+
 inline bool ExtensionSubst::apply (hb_apply_context_t *c) const
 {
   TRACE_APPLY ();
   return get_subtable ().apply (c, get_type ());
 }
 
+inline bool ExtensionSubst::get_single_substitute (hb_codepoint_t glyph_id, hb_codepoint_t *substitute) const
+{
+  return get_subtable ().get_single_substitute (get_type (), glyph_id, substitute);
+}
+
 inline bool ExtensionSubst::sanitize (hb_sanitize_context_t *c)
 {
   TRACE_SANITIZE ();
@@ -937,7 +1194,9 @@ static inline bool substitute_lookup (hb_apply_context_t *c, unsigned int lookup
   if (unlikely (c->context_length < 1))
     return false;
 
-  return l.apply_once (c->face, c->buffer, c->lookup_mask, c->context_length, c->nesting_level_left - 1);
+  const hb_ot_layout_lookup_digests_t *digests = _hb_ot_layout_get_lookup_digests (c->face, 0);
+  return l.apply_once (c->face, c->buffer, c->lookup_mask, c->context_length, c->nesting_level_left - 1,
+		       digests ? digests->get_subtable_digests (lookup_index) : NULL);
 }
 
 
@@ -81,6 +81,26 @@ struct hb_apply_context_t
     buffer->replace_glyphs_be16 (num_in, num_out, glyph_data_be);
   }
 
+  /* Coverage and ClassDef lookups go through the face's accelerators */
+  inline unsigned int get_coverage (const Coverage &coverage, hb_codepoint_t glyph_id) const
+  {
+    if (coverage.get_search_len () >= HB_OT_LAYOUT_ACCELERATOR_MIN_LEN) {
+      const hb_ot_layout_accelerator_t *accel = _hb_ot_layout_get_accelerator (face, &coverage, hb_ot_layout_accelerator_t::COVERAGE);
+      if (likely (accel))
+        return accel->get (glyph_id);
+    }
+    return coverage.get_coverage (glyph_id);
+  }
+  inline unsigned int get_class (const ClassDef &class_def, hb_codepoint_t glyph_id) const
+  {
+    if (class_def.get_search_len () >= HB_OT_LAYOUT_ACCELERATOR_MIN_LEN) {
+      const hb_ot_layout_accelerator_t *accel = _hb_ot_layout_get_accelerator (face, &class_def, hb_ot_layout_accelerator_t::CLASS_DEF);
+      if (likely (accel))
+        return accel->get (glyph_id);
+    }
+    return class_def.get_class (glyph_id);
+  }
+
   inline void guess_glyph_class (unsigned int klass)
   {
     /* XXX if ! has gdef */
@@ -97,7 +117,7 @@ struct hb_apply_context_t
 
 
 
-typedef bool (*match_func_t) (hb_codepoint_t glyph_id, const USHORT &value, const void *data);
+typedef bool (*match_func_t) (const hb_apply_context_t *c, hb_codepoint_t glyph_id, const USHORT &value, const void *data);
 typedef bool (*apply_lookup_func_t) (hb_apply_context_t *c, unsigned int lookup_index);
 
 struct ContextFuncs
@@ -107,21 +127,21 @@ struct ContextFuncs
 };
 
 
-static inline bool match_glyph (hb_codepoint_t glyph_id, const USHORT &value, const void *data HB_UNUSED)
+static inline bool match_glyph (const hb_apply_context_t *c HB_UNUSED, hb_codepoint_t glyph_id, const USHORT &value, const void *data HB_UNUSED)
 {
   return glyph_id == value;
 }
 
-static inline bool match_class (hb_codepoint_t glyph_id, const USHORT &value, const void *data)
+static inline bool match_class (const hb_apply_context_t *c, hb_codepoint_t glyph_id, const USHORT &value, const void *data)
 {
   const ClassDef &class_def = *reinterpret_cast<const ClassDef *>(data);
-  return class_def.get_class (glyph_id) == value;
+  return c->get_class (class_def, glyph_id) == value;
 }
 
-static inline bool match_coverage (hb_codepoint_t glyph_id, const USHORT &value, const void *data)
+static inline bool match_coverage (const hb_apply_context_t *c, hb_codepoint_t glyph_id, const USHORT &value, const void *data)
 {
   const OffsetTo<Coverage> &coverage = (const OffsetTo<Coverage>&)value;
-  return (data+coverage) (glyph_id) != NOT_COVERED;
+  return c->get_coverage (data+coverage, glyph_id) != NOT_COVERED;
 }
 
 
@@ -146,7 +166,7 @@ static inline bool match_input (hb_apply_context_t *c,
       j++;
     }
 
-    if (likely (!match_func (c->buffer->info[j].codepoint, input[i - 1], match_data)))
+    if (likely (!match_func (c, c->buffer->info[j].codepoint, input[i - 1], match_data)))
       return false;
   }
 
@@ -173,7 +193,7 @@ static inline bool match_backtrack (hb_apply_context_t *c,
       j--;
     }
 
-    if (likely (!match_func (c->buffer->out_info[j].codepoint, backtrack[i], match_data)))
+    if (likely (!match_func (c, c->buffer->out_info[j].codepoint, backtrack[i], match_data)))
       return false;
   }
 
@@ -201,7 +221,7 @@ static inline bool match_lookahead (hb_apply_context_t *c,
       j++;
     }
 
-    if (likely (!match_func (c->buffer->info[j].codepoint, lookahead[i], match_data)))
+    if (likely (!match_func (c, c->buffer->info[j].codepoint, lookahead[i], match_data)))
       return false;
   }
 
@@ -383,10 +403,13 @@ struct ContextFormat1
   friend struct Context;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c, apply_lookup_func_t apply_func) const
   {
     TRACE_APPLY ();
-    unsigned int index = (this+coverage) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int index = c->get_coverage (this+coverage, c->buffer->info[c->buffer->idx].codepoint);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -422,15 +445,18 @@ struct ContextFormat2
   friend struct Context;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c, apply_lookup_func_t apply_func) const
   {
     TRACE_APPLY ();
-    unsigned int index = (this+coverage) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int index = c->get_coverage (this+coverage, c->buffer->info[c->buffer->idx].codepoint);
     if (likely (index == NOT_COVERED))
       return false;
 
     const ClassDef &class_def = this+classDef;
-    index = class_def (c->buffer->info[c->buffer->idx].codepoint);
+    index = c->get_class (class_def, c->buffer->info[c->buffer->idx].codepoint);
     const RuleSet &rule_set = this+ruleSet[index];
     struct ContextLookupContext lookup_context = {
       {match_class, apply_func},
@@ -467,10 +493,13 @@ struct ContextFormat3
   friend struct Context;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage[0]; }
+
   inline bool apply (hb_apply_context_t *c, apply_lookup_func_t apply_func) const
   {
     TRACE_APPLY ();
-    unsigned int index = (this+coverage[0]) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int index = c->get_coverage (this+coverage[0], c->buffer->info[c->buffer->idx].codepoint);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -513,6 +542,16 @@ struct ContextFormat3
 struct Context
 {
   protected:
+  inline const Coverage &get_coverage (void) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_coverage ();
+    case 2: return u.format2.get_coverage ();
+    case 3: return u.format3.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c, apply_lookup_func_t apply_func) const
   {
     TRACE_APPLY ();
@@ -670,10 +709,13 @@ struct ChainContextFormat1
   friend struct ChainContext;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c, apply_lookup_func_t apply_func) const
   {
     TRACE_APPLY ();
-    unsigned int index = (this+coverage) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int index = c->get_coverage (this+coverage, c->buffer->info[c->buffer->idx].codepoint);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -708,10 +750,13 @@ struct ChainContextFormat2
   friend struct ChainContext;
 
   private:
+  inline const Coverage &get_coverage (void) const
+  { return this+coverage; }
+
   inline bool apply (hb_apply_context_t *c, apply_lookup_func_t apply_func) const
   {
     TRACE_APPLY ();
-    unsigned int index = (this+coverage) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int index = c->get_coverage (this+coverage, c->buffer->info[c->buffer->idx].codepoint);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -719,7 +764,7 @@ struct ChainContextFormat2
     const ClassDef &input_class_def = this+inputClassDef;
     const ClassDef &lookahead_class_def = this+lookaheadClassDef;
 
-    index = input_class_def (c->buffer->info[c->buffer->idx].codepoint);
+    index = c->get_class (input_class_def, c->buffer->info[c->buffer->idx].codepoint);
     const ChainRuleSet &rule_set = this+ruleSet[index];
     struct ChainContextLookupContext lookup_context = {
       {match_class, apply_func},
@@ -769,12 +814,18 @@ struct ChainContextFormat3
 
   private:
 
+  inline const Coverage &get_coverage (void) const
+  {
+    const OffsetArrayOf<Coverage> &input = StructAfter<OffsetArrayOf<Coverage> > (backtrack);
+    return this+input[0];
+  }
+
   inline bool apply (hb_apply_context_t *c, apply_lookup_func_t apply_func) const
   {
     TRACE_APPLY ();
     const OffsetArrayOf<Coverage> &input = StructAfter<OffsetArrayOf<Coverage> > (backtrack);
 
-    unsigned int index = (this+input[0]) (c->buffer->info[c->buffer->idx].codepoint);
+    unsigned int index = c->get_coverage (this+input[0], c->buffer->info[c->buffer->idx].codepoint);
     if (likely (index == NOT_COVERED))
       return false;
 
@@ -827,6 +878,16 @@ struct ChainContextFormat3
 struct ChainContext
 {
   protected:
+  inline const Coverage &get_coverage (void) const
+  {
+    switch (u.format) {
+    case 1: return u.format1.get_coverage ();
+    case 2: return u.format2.get_coverage ();
+    case 3: return u.format3.get_coverage ();
+    default:return Null(Coverage);
+    }
+  }
+
   inline bool apply (hb_apply_context_t *c, apply_lookup_func_t apply_func) const
   {
     TRACE_APPLY ();
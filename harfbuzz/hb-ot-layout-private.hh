@@ -71,12 +71,361 @@ _hb_ot_layout_skip_mark (hb_face_t    *face,
 
 
 
+/*
+ * Set digests
+ */
+
+/* A digest is a tiny, lossy summary of a set of glyphs: three bit masks,
+ * each indexed by a different slice of the glyph id's bits.  may_have()
+ * never gives false negatives, so a miss means the glyph is definitely not
+ * in the set and the Coverage search can be skipped. */
+struct hb_set_digest_t
+{
+  typedef unsigned long mask_t;
+
+  inline void init (void) { mask[0] = mask[1] = mask[2] = 0; }
+
+  inline void add (hb_codepoint_t g)
+  {
+    for (unsigned int i = 0; i < 3; i++)
+      mask[i] |= bit (g, shift (i));
+  }
+
+  inline void add_range (hb_codepoint_t a, hb_codepoint_t b)
+  {
+    for (unsigned int i = 0; i < 3; i++) {
+      unsigned int s = shift (i);
+      if ((b >> s) - (a >> s) >= MASK_BITS - 1)
+        mask[i] = (mask_t) -1;
+      else {
+        mask_t ma = bit (a, s);
+        mask_t mb = bit (b, s);
+        mask[i] |= mb + (mb - ma) - (mb < ma);
+      }
+    }
+  }
+
+  inline void add (const hb_set_digest_t &o)
+  {
+    for (unsigned int i = 0; i < 3; i++)
+      mask[i] |= o.mask[i];
+  }
+
+  inline bool may_have (hb_codepoint_t g) const
+  {
+    return (mask[0] & bit (g, shift (0))) &&
+	   (mask[1] & bit (g, shift (1))) &&
+	   (mask[2] & bit (g, shift (2)));
+  }
+
+  private:
+  enum { MASK_BITS = sizeof (mask_t) * 8 };
+
+  static inline unsigned int shift (unsigned int i) { return i == 0 ? 4 : i == 1 ? 0 : 9; }
+  static inline mask_t bit (hb_codepoint_t g, unsigned int s) { return ((mask_t) 1) << ((g >> s) & (MASK_BITS - 1)); }
+
+  mask_t mask[3];
+};
+
+/* Per-face digests of every GSUB or GPOS lookup, built on first use */
+struct hb_ot_layout_lookup_digests_t
+{
+  unsigned int num_lookups;
+  hb_set_digest_t *digests;		/* Per lookup: all glyphs it could apply at */
+  unsigned int *first_subtable;		/* Per lookup: index of its first entry in subtable_digests */
+  hb_set_digest_t *subtable_digests;	/* Per subtable: all glyphs its Coverage may match */
+
+  inline const hb_set_digest_t *get_subtable_digests (unsigned int lookup_index) const
+  { return likely (lookup_index < num_lookups) ? subtable_digests + first_subtable[lookup_index] : NULL; }
+};
+
+/* table_index is 0 for GSUB and 1 for GPOS.  Returns NULL if the digests
+ * could not be built, in which case lookups are applied unfiltered. */
+HB_INTERNAL const hb_ot_layout_lookup_digests_t *
+_hb_ot_layout_get_lookup_digests (hb_face_t *face, unsigned int table_index);
+
+
+
+/*
+ * Accelerators
+ */
+
+/* Coverage and ClassDef tables that lookups hit are converted, once per
+ * face, into native-endian forms: an array indexed by glyph when the table is
+ * dense, or its ranges in Eytzinger order (a binary search tree laid out
+ * breadth-first, so searches walk forward through memory) when it is sparse.
+ * Large LigatureSets get a trie of their ligatures' components, so the most
+ * preferred match is found in one walk over the following glyphs.  PairPos
+ * subtables that only kern, ie. adjust the x advance of the first glyph,
+ * keep their adjustments in native integers: a hash of the glyph pairs for
+ * format 1, and the class-pair matrix for format 2.  Tables
+ * with few entries are searched in place, as is everything once a face's
+ * accelerators use HB_OT_LAYOUT_MAX_ACCELERATOR_BYTES. */
+
+#define HB_OT_LAYOUT_ACCELERATOR_MIN_LEN	16
+#define HB_OT_LAYOUT_MAX_ACCELERATOR_BYTES	(256 * 1024)
+#define HB_OT_LAYOUT_ACCELERATOR_SLOTS		1024 /* Power of two */
+#define HB_OT_LAYOUT_LIGATURE_TRIE_MIN_LEN	8
+
+struct hb_ot_layout_range_t
+{
+  uint16_t start;
+  uint16_t end;
+  uint16_t value;
+};
+
+typedef hb_prealloced_array_t<hb_ot_layout_range_t, 32> hb_ot_layout_range_array_t;
+
+/* One ligature of a LigatureSet, as input to the trie builder */
+struct hb_ot_layout_ligature_t
+{
+  const uint16_t *components_be;	/* Big-endian components after the first */
+  unsigned int num_components;		/* Not counting the first */
+  unsigned int index;			/* Position in the set, i.e. preference */
+
+  /* Orders by components, a prefix first, then by preference */
+  static int cmp (const hb_ot_layout_ligature_t *a, const hb_ot_layout_ligature_t *b)
+  {
+    unsigned int count = MIN (a->num_components, b->num_components);
+    for (unsigned int i = 0; i < count; i++)
+      if (a->components_be[i] != b->components_be[i])
+	return hb_be_uint16 (a->components_be[i]) < hb_be_uint16 (b->components_be[i]) ? -1 : 1;
+    if (a->num_components != b->num_components)
+      return a->num_components < b->num_components ? -1 : 1;
+    return a->index < b->index ? -1 : a->index > b->index ? 1 : 0;
+  }
+};
+
+typedef hb_prealloced_array_t<hb_ot_layout_ligature_t, 32> hb_ot_layout_ligature_array_t;
+
+struct hb_ot_layout_kern_pair_t
+{
+  uint32_t key;		/* First << 16 | second glyph; 0xFFFFFFFF if empty */
+  int32_t value;	/* In design units */
+};
+
+typedef hb_prealloced_array_t<hb_ot_layout_kern_pair_t, 32> hb_ot_layout_kern_pair_array_t;
+
+/* Open addressing, at most half full */
+struct hb_ot_layout_kern_pair_map_t
+{
+  unsigned int bits;
+  hb_ot_layout_kern_pair_t *pairs; /* 1 << bits of them, or NULL */
+
+  inline unsigned int get_size (void) const { return pairs ? 1u << bits : 0; }
+
+  inline bool get (uint32_t key, int *value) const
+  {
+    unsigned int mask = (1u << bits) - 1;
+    for (unsigned int i = (key * 2654435761u) >> (32 - bits); ; i = (i + 1) & mask) {
+      if (pairs[i].key == key) {
+	*value = pairs[i].value;
+	return true;
+      }
+      if (pairs[i].key == 0xFFFFFFFF)
+	return false;
+    }
+  }
+};
+
+/* Hashes pairs, the first of duplicate keys winning.  Fails, leaving
+ * map->pairs NULL, if the map would take more than budget bytes. */
+HB_INTERNAL bool
+_hb_ot_layout_kern_pair_map_init (hb_ot_layout_kern_pair_map_t *map,
+				  const hb_ot_layout_kern_pair_array_t &pairs,
+				  unsigned int budget);
+
+struct hb_ot_layout_trie_node_t
+{
+  uint16_t glyph;		/* Component leading here from the parent */
+  uint16_t ligature;		/* Ligature whose components end here, or 0xFFFF */
+  uint16_t min_ligature;	/* Smallest ligature here or below, or 0xFFFF */
+  uint16_t num_children;	/* Sorted by glyph */
+  unsigned int first_child;
+};
+
+struct hb_ot_layout_accelerator_t
+{
+  enum kind_t { COVERAGE, CLASS_DEF, LIGATURE_SET, PAIR_POS_1, PAIR_POS_2 };
+
+  const void *table;		/* The Coverage, ClassDef, LigatureSet or PairPos this was built from */
+  kind_t kind;
+  bool in_place;		/* Over budget; the table is searched directly */
+  bool incremental;		/* Values count up through each range (Coverage) */
+  unsigned int miss;		/* NOT_COVERED, or class 0 */
+
+  /* Dense form: values[glyph - first], with 0xFFFF for glyphs not in the table */
+  hb_codepoint_t first;
+  unsigned int span;
+  uint16_t *values;
+
+  /* Sparse form: ranges[1..num_ranges], where the children of k are 2k and 2k+1 */
+  unsigned int num_ranges;
+  hb_ot_layout_range_t *ranges;
+
+  /* LigatureSet: nodes[0] is the root, standing for the covered first glyph */
+  unsigned int num_nodes;
+  hb_ot_layout_trie_node_t *nodes;
+
+  inline const hb_ot_layout_trie_node_t *get_child (const hb_ot_layout_trie_node_t *node,
+						    hb_codepoint_t glyph_id) const
+  {
+    const hb_ot_layout_trie_node_t *children = nodes + node->first_child;
+    int min = 0, max = (int) node->num_children - 1;
+    while (min <= max) {
+      int mid = (min + max) / 2;
+      if (glyph_id < children[mid].glyph)
+	max = mid - 1;
+      else if (glyph_id > children[mid].glyph)
+	min = mid + 1;
+      else
+	return &children[mid];
+    }
+    return NULL;
+  }
+
+  /* PairPosFormat1: keyed by the first glyph's Coverage index, the first
+   * record of a PairSet winning */
+  hb_ot_layout_kern_pair_map_t pair_map;
+
+  inline bool get_kern_pair (unsigned int index, hb_codepoint_t second, int *value) const
+  {
+    if (unlikely (second > 0xFFFF))
+      return false;
+    return pair_map.get ((index << 16) | second, value);
+  }
+
+  /* PairPosFormat2: kerns[class1 * class2Count + class2] */
+  unsigned int num_kerns;
+  int16_t *kerns;
+
+  inline unsigned int get (hb_codepoint_t glyph_id) const
+  {
+    if (values) {
+      unsigned int i = glyph_id - first;
+      unsigned int v = i < span ? values[i] : 0xFFFF;
+      return v == 0xFFFF ? miss : v;
+    }
+
+    /* Find the first range that ends at or after glyph_id */
+    unsigned int k = 1, found = 0;
+    while (k <= num_ranges) {
+      unsigned int right = ranges[k].end < glyph_id;
+      found = right ? found : k;
+      k = 2 * k + right;
+    }
+    if (!found || ranges[found].start > glyph_id)
+      return miss;
+    const hb_ot_layout_range_t &range = ranges[found];
+    return incremental ? range.value + (glyph_id - range.start) : range.value;
+  }
+};
+
+struct hb_ot_layout_accelerators_t
+{
+  hb_atomic_int_t bytes;
+  hb_ot_layout_accelerator_t *slots[HB_OT_LAYOUT_ACCELERATOR_SLOTS]; /* Open addressing; filled with compare-and-swap */
+};
+
+static inline unsigned int
+_hb_ot_layout_accelerator_hash (const void *table, hb_ot_layout_accelerator_t::kind_t kind)
+{
+  return ((unsigned int) (((uintptr_t) table >> 1) * 2654435761u) + kind) & (HB_OT_LAYOUT_ACCELERATOR_SLOTS - 1);
+}
+
+/* Builds and publishes the accelerator for table on a miss in the first slot.
+ * Returns NULL if table should be searched in place. */
+HB_INTERNAL const hb_ot_layout_accelerator_t *
+_hb_ot_layout_get_accelerator_slow (hb_face_t *face,
+				    const void *table,
+				    hb_ot_layout_accelerator_t::kind_t kind);
+
+
+
+/*
+ * Fused single substitutions
+ */
+
+/* Consecutive GSUB lookups that are all plain single substitutions under the
+ * same mask compose into one glyph-to-glyph map, applied in a single pass
+ * over the buffer.  Runs whose coverage spans more than
+ * HB_OT_LAYOUT_MAX_FUSED_GLYPHS glyphs are applied lookup by lookup. */
+
+#define HB_OT_LAYOUT_MAX_FUSED_GLYPHS	16384
+
+struct hb_ot_layout_fused_subst_t
+{
+  hb_codepoint_t first;		/* First glyph of the map */
+  unsigned int num_glyphs;	/* 0 if the run is not fused */
+  uint16_t map[1];		/* num_glyphs entries: the run's result for glyphs first.. */
+};
+
+/* Whether a GSUB lookup is a single substitution whose lookup flags can
+ * never skip a glyph */
+HB_INTERNAL hb_bool_t
+_hb_ot_layout_lookup_is_fusable (hb_face_t    *face,
+				 unsigned int  lookup_index);
+
+/* Composes the given GSUB lookups, in order; returns NULL on allocation
+ * failure */
+HB_INTERNAL hb_ot_layout_fused_subst_t *
+_hb_ot_layout_fused_subst_create (hb_face_t          *face,
+				  const unsigned int *lookup_indices,
+				  unsigned int        num_lookups);
+
+HB_INTERNAL void
+_hb_ot_layout_fused_subst_destroy (hb_ot_layout_fused_subst_t *fused);
+
+/* Returns FALSE, leaving the buffer untouched, if the run is not fused */
+HB_INTERNAL hb_bool_t
+_hb_ot_layout_substitute_fused (const hb_ot_layout_fused_subst_t *fused,
+				hb_buffer_t  *buffer,
+				hb_mask_t     mask);
+
+
+
+/*
+ * kern
+ */
+
+/* The 'kern' table the fallback positioning reads when there is no GPOS.
+ * Format 0 subtables are hashed like PairPos; format 2 is class-based and
+ * read in place. */
+
+struct hb_ot_layout_kern_subtable_t
+{
+  bool override;				/* Replaces the sum so far */
+  hb_ot_layout_kern_pair_map_t pair_map;	/* Format 0 */
+  const struct KernSubTable *table;		/* Format 2, or NULL */
+};
+
+struct hb_ot_layout_kern_t
+{
+  hb_blob_t *blob;
+  unsigned int num_subtables;
+  hb_ot_layout_kern_subtable_t *subtables;
+};
+
+/* Built on first use; returns NULL if the face has no horizontal kerning
+ * we can read */
+HB_INTERNAL const hb_ot_layout_kern_t *
+_hb_ot_layout_get_kern (hb_face_t *face);
+
+/* In design units */
+HB_INTERNAL int
+_hb_ot_layout_get_kerning (const hb_ot_layout_kern_t *kern,
+			   hb_codepoint_t             left,
+			   hb_codepoint_t             right);
+
+
+
 /*
  * hb_ot_layout_t
  */
 
 struct hb_ot_layout_t
 {
+  /* Sanitized on first use and published with a compare-and-swap */
   hb_blob_t *gdef_blob;
   hb_blob_t *gsub_blob;
   hb_blob_t *gpos_blob;
@@ -84,6 +433,14 @@ struct hb_ot_layout_t
   const struct GDEF *gdef;
   const struct GSUB *gsub;
   const struct GPOS *gpos;
+
+  hb_ot_layout_lookup_digests_t *digests[2]; /* GSUB/GPOS; published with a compare-and-swap */
+  hb_ot_layout_accelerators_t *accelerators; /* Created on first use, like digests */
+  hb_ot_layout_kern_t *kern; /* Created on first use, like digests */
+
+  /* GDEF glyph props of glyphs 0..65535, filled a page of 256 glyphs at a
+   * time on first use and published with a compare-and-swap */
+  uint16_t *glyph_props[256];
 };
 
 
@@ -93,6 +450,21 @@ _hb_ot_layout_create (hb_face_t *face);
 HB_INTERNAL void
 _hb_ot_layout_destroy (hb_ot_layout_t *layout);
 
+/* Returns NULL if table should be searched in place */
+static inline const hb_ot_layout_accelerator_t *
+_hb_ot_layout_get_accelerator (hb_face_t *face,
+			       const void *table,
+			       hb_ot_layout_accelerator_t::kind_t kind)
+{
+  hb_ot_layout_accelerators_t *accelerators = likely (face->ot_layout) ? (hb_ot_layout_accelerators_t *) hb_atomic_ptr_get (&face->ot_layout->accelerators) : NULL;
+  if (likely (accelerators)) {
+    const hb_ot_layout_accelerator_t *accel = (const hb_ot_layout_accelerator_t *) hb_atomic_ptr_get (&accelerators->slots[_hb_ot_layout_accelerator_hash (table, kind)]);
+    if (likely (accel && accel->table == table && accel->kind == kind))
+      return accel->in_place ? NULL : accel;
+  }
+  return _hb_ot_layout_get_accelerator_slow (face, table, kind);
+}
+
 
 
 #endif /* HB_OT_LAYOUT_PRIVATE_HH */
@@ -31,56 +31,928 @@
 #include "hb-ot-layout-gdef-table.hh"
 #include "hb-ot-layout-gsub-table.hh"
 #include "hb-ot-layout-gpos-table.hh"
+#include "hb-ot-kern-table.hh"
 #include "hb-ot-maxp-table.hh"
+#include "hb-probe-private.hh"
+#include "hb-version.h"
 
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 
 
+/*
+ * Shared sanitization
+ */
+
+/* A table that passes the sanitizer untouched is recorded by tag, length
+ * and content hash, so other faces with the same table, such as the same
+ * font opened at several sizes, skip sanitizing it.  A record keeps the
+ * table of the face that last used it to compare contents with, and goes
+ * with that face: the table may live in memory only the face keeps alive.
+ *
+ * If HB_SANITIZE_CACHE names a file, verdicts are also kept there, keyed
+ * by the SHA-256 of the table, and trusted in later runs without the table
+ * to compare with.  The file starts with a line naming its format and the
+ * HarfBuzz version; a file written by any other version is started over. */
+
+#define HB_OT_LAYOUT_SANITIZE_CACHE_HEADER "hb-sanitize-cache 2 " HB_VERSION_STRING
+
+struct hb_ot_layout_sanitized_t
+{
+  hb_tag_t tag;
+  unsigned int length;
+  bool in_file;		/* Read from the cache file: digest is set, blob and hash are not */
+  uint64_t hash;
+  uint8_t digest[32];
+  hb_blob_t *blob;	/* Table to compare with, or NULL */
+};
+
+/* Plain data, never torn down, so faces may outlive static destructors */
+static struct hb_ot_layout_sanitized_set_t
+{
+  hb_mutex_t lock;
+  hb_ot_layout_sanitized_t *items;
+  unsigned int len;
+  unsigned int allocated;
+  char *cache_file;
+  bool loaded;
+  bool file_current;	/* The file exists and has our header */
+
+  inline hb_ot_layout_sanitized_t *find (hb_tag_t tag, unsigned int length, uint64_t hash)
+  {
+    for (unsigned int i = 0; i < len; i++)
+      if (!items[i].in_file && items[i].hash == hash && items[i].tag == tag && items[i].length == length)
+	return &items[i];
+    return NULL;
+  }
+
+  inline hb_ot_layout_sanitized_t *find_digest (hb_tag_t tag, unsigned int length, const uint8_t *digest)
+  {
+    for (unsigned int i = 0; i < len; i++)
+      if (items[i].in_file && items[i].tag == tag && items[i].length == length &&
+	  0 == memcmp (items[i].digest, digest, sizeof (items[i].digest)))
+	return &items[i];
+    return NULL;
+  }
+
+  inline hb_ot_layout_sanitized_t *push (hb_tag_t tag, unsigned int length)
+  {
+    if (unlikely (len == allocated)) {
+      unsigned int new_allocated = allocated + (allocated >> 1) + 8;
+      hb_ot_layout_sanitized_t *new_items = (hb_ot_layout_sanitized_t *) realloc (items, new_allocated * sizeof (items[0]));
+      if (unlikely (!new_items))
+	return NULL;
+      items = new_items;
+      allocated = new_allocated;
+    }
+    hb_ot_layout_sanitized_t *item = &items[len++];
+    memset (item, 0, sizeof (*item));
+    item->tag = tag;
+    item->length = length;
+    return item;
+  }
+} sanitized = {HB_MUTEX_INIT};
+
+static uint64_t
+_hb_ot_layout_table_hash (const char *data, unsigned int length)
+{
+  /* FNV-1a, eight bytes at a time */
+  uint64_t h = 0xcbf29ce484222325ull;
+  unsigned int i = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t v;
+    memcpy (&v, data + i, 8);
+    h = (h ^ v) * 0x100000001b3ull;
+  }
+  for (; i < length; i++)
+    h = (h ^ (uint8_t) data[i]) * 0x100000001b3ull;
+  return h ^ (h >> 29);
+}
+
+/* SHA-256 (FIPS 180-4), for the cache file */
+
+#define HB_SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void
+_hb_sha256_block (uint32_t *state, const uint8_t *block)
+{
+  static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+  uint32_t w[64];
+  for (unsigned int i = 0; i < 16; i++)
+    w[i] = ((uint32_t) block[i * 4] << 24) | ((uint32_t) block[i * 4 + 1] << 16) |
+	   ((uint32_t) block[i * 4 + 2] << 8) | block[i * 4 + 3];
+  for (unsigned int i = 16; i < 64; i++) {
+    uint32_t s0 = HB_SHA256_ROTR (w[i - 15], 7) ^ HB_SHA256_ROTR (w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = HB_SHA256_ROTR (w[i - 2], 17) ^ HB_SHA256_ROTR (w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+  for (unsigned int i = 0; i < 64; i++) {
+    uint32_t t1 = h + (HB_SHA256_ROTR (e, 6) ^ HB_SHA256_ROTR (e, 11) ^ HB_SHA256_ROTR (e, 25)) +
+		  ((e & f) ^ (~e & g)) + k[i] + w[i];
+    uint32_t t2 = (HB_SHA256_ROTR (a, 2) ^ HB_SHA256_ROTR (a, 13) ^ HB_SHA256_ROTR (a, 22)) +
+		  ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+  state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void
+_hb_sha256 (const char *data, unsigned int length, uint8_t *digest)
+{
+  uint32_t state[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+  unsigned int i = 0;
+  for (; i + 64 <= length; i += 64)
+    _hb_sha256_block (state, (const uint8_t *) data + i);
+
+  /* The rest, a one bit, zeros, and the length in bits, in one or two blocks */
+  uint8_t tail[128];
+  unsigned int rest = length - i;
+  memcpy (tail, data + i, rest);
+  tail[rest] = 0x80;
+  unsigned int tail_len = rest + 9 <= 64 ? 64 : 128;
+  memset (tail + rest + 1, 0, tail_len - rest - 1);
+  uint64_t bits = (uint64_t) length * 8;
+  for (unsigned int j = 0; j < 8; j++)
+    tail[tail_len - 1 - j] = (uint8_t) (bits >> (j * 8));
+  for (unsigned int j = 0; j < tail_len; j += 64)
+    _hb_sha256_block (state, tail + j);
+
+  for (unsigned int j = 0; j < 8; j++) {
+    digest[j * 4] = (uint8_t) (state[j] >> 24);
+    digest[j * 4 + 1] = (uint8_t) (state[j] >> 16);
+    digest[j * 4 + 2] = (uint8_t) (state[j] >> 8);
+    digest[j * 4 + 3] = (uint8_t) state[j];
+  }
+}
+
+#undef HB_SHA256_ROTR
+
+static bool
+_hb_ot_layout_parse_digest (const char *hex, uint8_t *digest)
+{
+  if (strlen (hex) != 64)
+    return false;
+  for (unsigned int i = 0; i < 64; i++) {
+    char c = hex[i];
+    unsigned int v;
+    if (c >= '0' && c <= '9') v = c - '0';
+    else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+    else return false;
+    if (i & 1)
+      digest[i / 2] |= v;
+    else
+      digest[i / 2] = v << 4;
+  }
+  return true;
+}
+
+/* Called with the lock held */
+static void
+_hb_ot_layout_load_sanitize_cache (void)
+{
+  if (likely (sanitized.loaded))
+    return;
+  sanitized.loaded = true;
+
+  const char *env = getenv ("HB_SANITIZE_CACHE");
+  if (!env || !*env)
+    return;
+  sanitized.cache_file = strdup (env);
+
+  FILE *f = fopen (env, "r");
+  if (!f)
+    return;
+  /* Verdicts from another format or sanitizer are not trusted */
+  char line[128];
+  if (fgets (line, sizeof (line), f) && 0 == strcmp (line, HB_OT_LAYOUT_SANITIZE_CACHE_HEADER "\n"))
+  {
+    sanitized.file_current = true;
+    unsigned int tag, length;
+    char hex[65];
+    uint8_t digest[32];
+    while (fscanf (f, "%x %u %64s", &tag, &length, hex) == 3) {
+      if (!_hb_ot_layout_parse_digest (hex, digest) || sanitized.find_digest (tag, length, digest))
+	continue;
+      hb_ot_layout_sanitized_t *item = sanitized.push (tag, length);
+      if (unlikely (!item))
+	break;
+      item->in_file = true;
+      memcpy (item->digest, digest, sizeof (digest));
+    }
+  }
+  fclose (f);
+}
+
+/* Called with the lock held */
+static void
+_hb_ot_layout_save_verdict (hb_tag_t tag, unsigned int length, const uint8_t *digest)
+{
+  if (sanitized.find_digest (tag, length, digest))
+    return;
+  hb_ot_layout_sanitized_t *item = sanitized.push (tag, length);
+  if (unlikely (!item))
+    return;
+  item->in_file = true;
+  memcpy (item->digest, digest, 32);
+
+  /* A missing or outdated file is started over with our header */
+  FILE *f = fopen (sanitized.cache_file, sanitized.file_current ? "a" : "w");
+  if (!f)
+    return;
+  if (!sanitized.file_current)
+    fputs (HB_OT_LAYOUT_SANITIZE_CACHE_HEADER "\n", f);
+  fprintf (f, "%08x %u ", tag, length);
+  for (unsigned int i = 0; i < 32; i++)
+    fprintf (f, "%02x", digest[i]);
+  fputc ('\n', f);
+  if (fclose (f) == 0)
+    sanitized.file_current = true;
+}
+
+template <typename Type>
+static hb_blob_t *
+_hb_ot_layout_sanitize_shared (hb_face_t *face)
+{
+  hb_blob_t *blob = hb_face_reference_table (face, Type::Tag);
+  unsigned int length;
+  const char *data = hb_blob_get_data (blob, &length);
+  if (!length)
+    return blob;
+  uint64_t hash = _hb_ot_layout_table_hash (data, length);
+
+  hb_mutex_lock (&sanitized.lock);
+  _hb_ot_layout_load_sanitize_cache ();
+  bool use_file = sanitized.cache_file != NULL;
+  hb_ot_layout_sanitized_t *item = sanitized.find (Type::Tag, length, hash);
+  if (item && 0 == memcmp (hb_blob_get_data (item->blob, NULL), data, length)) {
+    /* Passes untouched; this face holds the record from now on */
+    hb_blob_make_immutable (blob);
+    hb_blob_destroy (item->blob);
+    item->blob = hb_blob_reference (blob);
+    hb_mutex_unlock (&sanitized.lock);
+    return blob;
+  }
+  hb_mutex_unlock (&sanitized.lock);
+
+  /* The digest is only worth its cost when there is a file to check */
+  uint8_t digest[32];
+  bool clean;
+  if (use_file) {
+    _hb_sha256 (data, length, digest);
+    hb_mutex_lock (&sanitized.lock);
+    clean = sanitized.find_digest (Type::Tag, length, digest) != NULL;
+    hb_mutex_unlock (&sanitized.lock);
+    if (!clean)
+      blob = Sanitizer<Type>::sanitize (blob, &clean);
+  } else
+    blob = Sanitizer<Type>::sanitize (blob, &clean);
+  if (!clean)
+    return blob;
+  hb_blob_make_immutable (blob);
+
+  hb_mutex_lock (&sanitized.lock);
+  if (!sanitized.find (Type::Tag, length, hash) &&
+      likely (item = sanitized.push (Type::Tag, length)))
+  {
+    item->hash = hash;
+    item->blob = hb_blob_reference (blob);
+  }
+  if (use_file)
+    _hb_ot_layout_save_verdict (Type::Tag, length, digest);
+  hb_mutex_unlock (&sanitized.lock);
+
+  return blob;
+}
+
+/* Destroys a table from _hb_ot_layout_sanitize_shared, dropping the record
+ * it holds */
+static void
+_hb_ot_layout_destroy_shared (hb_blob_t *blob)
+{
+  if (!blob)
+    return;
+
+  hb_mutex_lock (&sanitized.lock);
+  for (unsigned int i = 0; i < sanitized.len; i++)
+    if (sanitized.items[i].blob == blob) {
+      hb_blob_destroy (blob);
+      sanitized.items[i] = sanitized.items[--sanitized.len];
+      break;
+    }
+  hb_mutex_unlock (&sanitized.lock);
+
+  hb_blob_destroy (blob);
+}
+
+
+
 hb_ot_layout_t *
-_hb_ot_layout_create (hb_face_t *face)
+_hb_ot_layout_create (hb_face_t *face HB_UNUSED)
 {
   /* TODO Remove this object altogether */
+  /* Tables are sanitized on first use */
   hb_ot_layout_t *layout = (hb_ot_layout_t *) calloc (1, sizeof (hb_ot_layout_t));
 
-  layout->gdef_blob = Sanitizer<GDEF>::sanitize (hb_face_reference_table (face, HB_OT_TAG_GDEF));
-  layout->gdef = Sanitizer<GDEF>::lock_instance (layout->gdef_blob);
+  return layout;
+}
 
-  layout->gsub_blob = Sanitizer<GSUB>::sanitize (hb_face_reference_table (face, HB_OT_TAG_GSUB));
-  layout->gsub = Sanitizer<GSUB>::lock_instance (layout->gsub_blob);
+static void
+_hb_ot_layout_lookup_digests_destroy (hb_ot_layout_lookup_digests_t *digests)
+{
+  if (!digests)
+    return;
+  free (digests->digests);
+  free (digests->first_subtable);
+  free (digests->subtable_digests);
+  free (digests);
+}
 
-  layout->gpos_blob = Sanitizer<GPOS>::sanitize (hb_face_reference_table (face, HB_OT_TAG_GPOS));
-  layout->gpos = Sanitizer<GPOS>::lock_instance (layout->gpos_blob);
+static void
+_hb_ot_layout_accelerator_destroy (hb_ot_layout_accelerator_t *accel)
+{
+  free (accel->values);
+  free (accel->ranges);
+  free (accel->nodes);
+  free (accel->pair_map.pairs);
+  free (accel->kerns);
+  free (accel);
+}
 
-  return layout;
+static void
+_hb_ot_layout_accelerators_destroy (hb_ot_layout_accelerators_t *accelerators)
+{
+  if (!accelerators)
+    return;
+  for (unsigned int i = 0; i < HB_OT_LAYOUT_ACCELERATOR_SLOTS; i++)
+    if (accelerators->slots[i])
+      _hb_ot_layout_accelerator_destroy (accelerators->slots[i]);
+  free (accelerators);
+}
+
+static void
+_hb_ot_layout_kern_destroy (hb_ot_layout_kern_t *kern)
+{
+  if (!kern)
+    return;
+  _hb_ot_layout_destroy_shared (kern->blob);
+  for (unsigned int i = 0; i < kern->num_subtables; i++)
+    free (kern->subtables[i].pair_map.pairs);
+  free (kern->subtables);
+  free (kern);
 }
 
 void
 _hb_ot_layout_destroy (hb_ot_layout_t *layout)
 {
-  hb_blob_destroy (layout->gdef_blob);
-  hb_blob_destroy (layout->gsub_blob);
-  hb_blob_destroy (layout->gpos_blob);
+  _hb_ot_layout_destroy_shared (layout->gdef_blob);
+  _hb_ot_layout_destroy_shared (layout->gsub_blob);
+  _hb_ot_layout_destroy_shared (layout->gpos_blob);
+
+  _hb_ot_layout_lookup_digests_destroy (layout->digests[0]);
+  _hb_ot_layout_lookup_digests_destroy (layout->digests[1]);
+  _hb_ot_layout_accelerators_destroy (layout->accelerators);
+  _hb_ot_layout_kern_destroy (layout->kern);
+  for (unsigned int i = 0; i < ARRAY_LENGTH (layout->glyph_props); i++)
+    free (layout->glyph_props[i]);
 
   free (layout);
 }
 
+template <typename Type>
+static const Type&
+_hb_ot_layout_load_table (hb_face_t *face, hb_blob_t **blob_slot, const Type **table_slot)
+{
+  hb_blob_t *blob = _hb_ot_layout_sanitize_shared<Type> (face);
+
+  /* Another thread may have loaded it meanwhile; keep whichever came first */
+  if (!hb_atomic_ptr_cmpexch (blob_slot, NULL, blob)) {
+    _hb_ot_layout_destroy_shared (blob);
+    blob = (hb_blob_t *) hb_atomic_ptr_get (blob_slot);
+  }
+
+  /* Every thread finds the same instance in the blob that won */
+  const Type *table = Sanitizer<Type>::lock_instance (blob);
+  hb_atomic_ptr_cmpexch (table_slot, NULL, table);
+  return *table;
+}
+
 static inline const GDEF&
 _get_gdef (hb_face_t *face)
 {
-  return likely (face->ot_layout && face->ot_layout->gdef) ? *face->ot_layout->gdef : Null(GDEF);
+  if (unlikely (!face->ot_layout)) return Null(GDEF);
+  const GDEF *gdef = (const GDEF *) hb_atomic_ptr_get (&face->ot_layout->gdef);
+  return likely (gdef) ? *gdef : _hb_ot_layout_load_table (face, &face->ot_layout->gdef_blob, &face->ot_layout->gdef);
 }
 static inline const GSUB&
 _get_gsub (hb_face_t *face)
 {
-  return likely (face->ot_layout && face->ot_layout->gsub) ? *face->ot_layout->gsub : Null(GSUB);
+  if (unlikely (!face->ot_layout)) return Null(GSUB);
+  const GSUB *gsub = (const GSUB *) hb_atomic_ptr_get (&face->ot_layout->gsub);
+  return likely (gsub) ? *gsub : _hb_ot_layout_load_table (face, &face->ot_layout->gsub_blob, &face->ot_layout->gsub);
 }
 static inline const GPOS&
 _get_gpos (hb_face_t *face)
 {
-  return likely (face->ot_layout && face->ot_layout->gpos) ? *face->ot_layout->gpos : Null(GPOS);
+  if (unlikely (!face->ot_layout)) return Null(GPOS);
+  const GPOS *gpos = (const GPOS *) hb_atomic_ptr_get (&face->ot_layout->gpos);
+  return likely (gpos) ? *gpos : _hb_ot_layout_load_table (face, &face->ot_layout->gpos_blob, &face->ot_layout->gpos);
+}
+
+
+/*
+ * Lookup digests
+ */
+
+template <typename Table>
+static hb_ot_layout_lookup_digests_t *
+_hb_ot_layout_build_lookup_digests (const Table &table)
+{
+  hb_ot_layout_lookup_digests_t *digests = (hb_ot_layout_lookup_digests_t *) calloc (1, sizeof (hb_ot_layout_lookup_digests_t));
+  if (unlikely (!digests))
+    return NULL;
+
+  unsigned int num_lookups = table.get_lookup_count ();
+  unsigned int num_subtables = 0;
+  for (unsigned int i = 0; i < num_lookups; i++)
+    num_subtables += table.get_lookup (i).get_subtable_count ();
+
+  digests->num_lookups = num_lookups;
+  digests->digests = (hb_set_digest_t *) calloc (num_lookups + 1, sizeof (hb_set_digest_t));
+  digests->first_subtable = (unsigned int *) calloc (num_lookups + 1, sizeof (unsigned int));
+  digests->subtable_digests = (hb_set_digest_t *) calloc (num_subtables + 1, sizeof (hb_set_digest_t));
+  if (unlikely (!digests->digests || !digests->first_subtable || !digests->subtable_digests)) {
+    _hb_ot_layout_lookup_digests_destroy (digests);
+    return NULL;
+  }
+
+  unsigned int first = 0;
+  for (unsigned int i = 0; i < num_lookups; i++) {
+    digests->first_subtable[i] = first;
+    table.get_lookup (i).collect_digests (&digests->digests[i], &digests->subtable_digests[first]);
+    first += table.get_lookup (i).get_subtable_count ();
+  }
+
+  return digests;
+}
+
+const hb_ot_layout_lookup_digests_t *
+_hb_ot_layout_get_lookup_digests (hb_face_t *face, unsigned int table_index)
+{
+  hb_ot_layout_t *layout = face->ot_layout;
+  if (unlikely (!layout))
+    return NULL;
+
+  hb_ot_layout_lookup_digests_t **slot = &layout->digests[table_index];
+  hb_ot_layout_lookup_digests_t *digests = (hb_ot_layout_lookup_digests_t *) hb_atomic_ptr_get (slot);
+  if (likely (digests))
+    return digests;
+
+  digests = table_index ? _hb_ot_layout_build_lookup_digests (_get_gpos (face))
+			: _hb_ot_layout_build_lookup_digests (_get_gsub (face));
+  if (unlikely (!digests))
+    return NULL;
+
+  /* Another thread may have built them meanwhile; keep whichever came first */
+  if (!hb_atomic_ptr_cmpexch (slot, NULL, digests)) {
+    _hb_ot_layout_lookup_digests_destroy (digests);
+    digests = (hb_ot_layout_lookup_digests_t *) hb_atomic_ptr_get (slot);
+  }
+  return digests;
+}
+
+/*
+ * Accelerators
+ */
+
+static unsigned int
+_hb_ot_layout_eytzinger_fill (const hb_ot_layout_range_t *sorted,
+			      hb_ot_layout_range_t *tree,
+			      unsigned int count,
+			      unsigned int i,
+			      unsigned int k)
+{
+  if (k <= count) {
+    i = _hb_ot_layout_eytzinger_fill (sorted, tree, count, i, 2 * k);
+    tree[k] = sorted[i++];
+    i = _hb_ot_layout_eytzinger_fill (sorted, tree, count, i, 2 * k + 1);
+  }
+  return i;
+}
+
+/* Builds the trie breadth-first, so the children of each node are
+ * contiguous.  Leaves accel->nodes NULL if it does not fit in budget. */
+static void
+_hb_ot_layout_build_ligature_trie (hb_ot_layout_accelerator_t *accel,
+				   unsigned int budget)
+{
+  hb_ot_layout_ligature_array_t ligatures;
+  if (unlikely (!reinterpret_cast<const LigatureSet *> (accel->table)->get_ligatures (ligatures) || !ligatures.len)) {
+    ligatures.finish ();
+    return;
+  }
+  ligatures.sort ();
+
+  /* At most a node per component, plus the root */
+  unsigned int max_nodes = 1;
+  for (unsigned int i = 0; i < ligatures.len; i++)
+    max_nodes += ligatures[i].num_components;
+
+  hb_ot_layout_trie_node_t *nodes = NULL;
+  unsigned int *scratch = NULL;
+  if (max_nodes * sizeof (hb_ot_layout_trie_node_t) <= budget) {
+    nodes = (hb_ot_layout_trie_node_t *) calloc (max_nodes, sizeof (hb_ot_layout_trie_node_t));
+    scratch = (unsigned int *) malloc (3 * max_nodes * sizeof (unsigned int));
+  }
+  if (unlikely (!nodes || !scratch)) {
+    free (nodes);
+    free (scratch);
+    ligatures.finish ();
+    return;
+  }
+
+  /* The ligatures below node n are ligatures[lo[n]..hi[n]), all sharing
+   * their first depth[n] components */
+  unsigned int *lo = scratch, *hi = scratch + max_nodes, *depth = scratch + 2 * max_nodes;
+  unsigned int num_nodes = 1;
+  lo[0] = 0;
+  hi[0] = ligatures.len;
+  depth[0] = 0;
+  for (unsigned int n = 0; n < num_nodes; n++)
+  {
+    unsigned int d = depth[n];
+    unsigned int i = lo[n];
+
+    /* Ligatures ending here sort first, the most preferred leading */
+    nodes[n].ligature = i < hi[n] && ligatures[i].num_components == d ? ligatures[i].index : 0xFFFF;
+    while (i < hi[n] && ligatures[i].num_components == d)
+      i++;
+
+    nodes[n].first_child = num_nodes;
+    while (i < hi[n]) {
+      uint16_t glyph = hb_be_uint16 (ligatures[i].components_be[d]);
+      unsigned int j = i + 1;
+      while (j < hi[n] && hb_be_uint16 (ligatures[j].components_be[d]) == glyph)
+	j++;
+      nodes[num_nodes].glyph = glyph;
+      lo[num_nodes] = i;
+      hi[num_nodes] = j;
+      depth[num_nodes] = d + 1;
+      num_nodes++;
+      i = j;
+    }
+    nodes[n].num_children = num_nodes - nodes[n].first_child;
+  }
+
+  /* Children come after their parents */
+  for (unsigned int n = num_nodes; n--;) {
+    unsigned int min_ligature = nodes[n].ligature;
+    for (unsigned int c = 0; c < nodes[n].num_children; c++)
+      min_ligature = MIN (min_ligature, (unsigned int) nodes[nodes[n].first_child + c].min_ligature);
+    nodes[n].min_ligature = min_ligature;
+  }
+
+  free (scratch);
+  ligatures.finish ();
+
+  hb_ot_layout_trie_node_t *shrunk = (hb_ot_layout_trie_node_t *) realloc (nodes, num_nodes * sizeof (hb_ot_layout_trie_node_t));
+  accel->nodes = likely (shrunk) ? shrunk : nodes;
+  accel->num_nodes = num_nodes;
+}
+
+bool
+_hb_ot_layout_kern_pair_map_init (hb_ot_layout_kern_pair_map_t *map,
+				  const hb_ot_layout_kern_pair_array_t &pairs,
+				  unsigned int budget)
+{
+  map->pairs = NULL;
+  if (unlikely (!pairs.len))
+    return false;
+
+  unsigned int bits = 1;
+  while ((1u << bits) < 2 * pairs.len)
+    bits++;
+  unsigned int size = 1u << bits;
+  if (size * sizeof (hb_ot_layout_kern_pair_t) > budget)
+    return false;
+  map->pairs = (hb_ot_layout_kern_pair_t *) malloc (size * sizeof (hb_ot_layout_kern_pair_t));
+  if (unlikely (!map->pairs))
+    return false;
+
+  memset (map->pairs, 0xFF, size * sizeof (hb_ot_layout_kern_pair_t));
+  map->bits = bits;
+  for (unsigned int p = 0; p < pairs.len; p++) {
+    uint32_t key = pairs[p].key;
+    if (unlikely (key == 0xFFFFFFFF))
+      continue;
+    unsigned int i = (key * 2654435761u) >> (32 - bits);
+    while (map->pairs[i].key != 0xFFFFFFFF && map->pairs[i].key != key)
+      i = (i + 1) & (size - 1);
+    if (map->pairs[i].key == 0xFFFFFFFF)
+      map->pairs[i] = pairs[p];
+  }
+  return true;
+}
+
+/* Sparse tables still get a direct array up to this size */
+#define HB_OT_LAYOUT_ACCELERATOR_DIRECT_BYTES (16 * 1024)
+
+/* Builds the native form of table, or an in-place marker if it would not
+ * fit in the budget left.  Returns NULL only on allocation failure. */
+static hb_ot_layout_accelerator_t *
+_hb_ot_layout_build_accelerator (const void *table,
+				 hb_ot_layout_accelerator_t::kind_t kind,
+				 unsigned int budget)
+{
+  hb_ot_layout_accelerator_t *accel = (hb_ot_layout_accelerator_t *) calloc (1, sizeof (hb_ot_layout_accelerator_t));
+  if (unlikely (!accel))
+    return NULL;
+  accel->table = table;
+  accel->kind = kind;
+
+  if (kind == hb_ot_layout_accelerator_t::LIGATURE_SET) {
+    _hb_ot_layout_build_ligature_trie (accel, budget);
+    accel->in_place = !accel->nodes;
+    return accel;
+  }
+
+  if (kind == hb_ot_layout_accelerator_t::PAIR_POS_1) {
+    hb_ot_layout_kern_pair_array_t pairs;
+    accel->in_place = !reinterpret_cast<const PairPosFormat1 *> (table)->get_kern_pairs (pairs) ||
+		      !_hb_ot_layout_kern_pair_map_init (&accel->pair_map, pairs, budget);
+    pairs.finish ();
+    return accel;
+  }
+
+  if (kind == hb_ot_layout_accelerator_t::PAIR_POS_2) {
+    const PairPosFormat2 *pair_pos = reinterpret_cast<const PairPosFormat2 *> (table);
+    unsigned int count = pair_pos->get_kern_count ();
+    if (count && count * sizeof (int16_t) <= budget)
+      accel->kerns = (int16_t *) malloc (count * sizeof (int16_t));
+    if (likely (accel->kerns)) {
+      pair_pos->get_kerns (accel->kerns);
+      accel->num_kerns = count;
+    }
+    accel->in_place = !accel->kerns;
+    return accel;
+  }
+
+  accel->incremental = kind == hb_ot_layout_accelerator_t::COVERAGE;
+  accel->miss = accel->incremental ? NOT_COVERED : 0;
+
+  hb_ot_layout_range_array_t ranges;
+  bool ok = accel->incremental ? reinterpret_cast<const Coverage *> (table)->add_ranges (ranges)
+			       : reinterpret_cast<const ClassDef *> (table)->add_ranges (ranges);
+  unsigned int count = ranges.len;
+  if (unlikely (!ok || !count)) {
+    ranges.finish ();
+    accel->in_place = true;
+    return accel;
+  }
+
+  /* Dense or small tables get a direct array, as long as no value collides
+   * with the 0xFFFF used for gaps */
+  unsigned int span = ranges[count - 1].end - ranges[0].start + 1;
+  unsigned int covered = 0;
+  bool has_ffff = false;
+  for (unsigned int i = 0; i < count; i++) {
+    covered += ranges[i].end - ranges[i].start + 1;
+    has_ffff = has_ffff || (!accel->incremental && ranges[i].value == 0xFFFF);
+  }
+  unsigned int direct_bytes = span * sizeof (uint16_t);
+  unsigned int range_bytes = (count + 1) * sizeof (hb_ot_layout_range_t);
+  bool direct = !has_ffff && (span <= 4 * covered || direct_bytes <= HB_OT_LAYOUT_ACCELERATOR_DIRECT_BYTES);
+
+  if (direct && direct_bytes <= budget) {
+    accel->values = (uint16_t *) malloc (direct_bytes);
+    if (likely (accel->values)) {
+      memset (accel->values, 0xFF, direct_bytes);
+      accel->first = ranges[0].start;
+      accel->span = span;
+      for (unsigned int i = 0; i < count; i++)
+	for (unsigned int g = ranges[i].start; g <= ranges[i].end; g++)
+	  accel->values[g - accel->first] = accel->incremental ? ranges[i].value + (g - ranges[i].start) : ranges[i].value;
+    }
+  } else if (range_bytes <= budget) {
+    accel->ranges = (hb_ot_layout_range_t *) calloc (count + 1, sizeof (hb_ot_layout_range_t));
+    if (likely (accel->ranges)) {
+      accel->num_ranges = count;
+      _hb_ot_layout_eytzinger_fill (ranges.array, accel->ranges, count, 0, 1);
+    }
+  }
+  if (!accel->values && !accel->ranges)
+    accel->in_place = true;
+
+  ranges.finish ();
+  return accel;
+}
+
+static inline unsigned int
+_hb_ot_layout_accelerator_bytes (const hb_ot_layout_accelerator_t *accel)
+{
+  return sizeof (*accel) +
+	 accel->span * sizeof (uint16_t) +
+	 (accel->ranges ? (accel->num_ranges + 1) * sizeof (hb_ot_layout_range_t) : 0) +
+	 accel->num_nodes * sizeof (hb_ot_layout_trie_node_t) +
+	 accel->pair_map.get_size () * sizeof (hb_ot_layout_kern_pair_t) +
+	 accel->num_kerns * sizeof (int16_t);
+}
+
+#define HB_OT_LAYOUT_ACCELERATOR_MAX_PROBES 8
+
+const hb_ot_layout_accelerator_t *
+_hb_ot_layout_get_accelerator_slow (hb_face_t *face,
+				    const void *table,
+				    hb_ot_layout_accelerator_t::kind_t kind)
+{
+  hb_ot_layout_t *layout = face->ot_layout;
+  if (unlikely (!layout))
+    return NULL;
+
+  hb_ot_layout_accelerators_t *accelerators = (hb_ot_layout_accelerators_t *) hb_atomic_ptr_get (&layout->accelerators);
+  if (unlikely (!accelerators)) {
+    accelerators = (hb_ot_layout_accelerators_t *) calloc (1, sizeof (hb_ot_layout_accelerators_t));
+    if (unlikely (!accelerators))
+      return NULL;
+    if (!hb_atomic_ptr_cmpexch (&layout->accelerators, NULL, accelerators)) {
+      free (accelerators);
+      accelerators = (hb_ot_layout_accelerators_t *) hb_atomic_ptr_get (&layout->accelerators);
+    }
+  }
+
+  unsigned int hash = _hb_ot_layout_accelerator_hash (table, kind);
+  hb_ot_layout_accelerator_t *built = NULL;
+  for (unsigned int probe = 0; probe < HB_OT_LAYOUT_ACCELERATOR_MAX_PROBES; probe++)
+  {
+    hb_ot_layout_accelerator_t **slot = &accelerators->slots[(hash + probe) & (HB_OT_LAYOUT_ACCELERATOR_SLOTS - 1)];
+    hb_ot_layout_accelerator_t *accel = (hb_ot_layout_accelerator_t *) hb_atomic_ptr_get (slot);
+
+    if (!accel) {
+      if (!built) {
+	int used = hb_atomic_int_get (accelerators->bytes);
+	unsigned int budget = used < HB_OT_LAYOUT_MAX_ACCELERATOR_BYTES ? HB_OT_LAYOUT_MAX_ACCELERATOR_BYTES - used : 0;
+	built = _hb_ot_layout_build_accelerator (table, kind, budget);
+	if (unlikely (!built))
+	  return NULL;
+      }
+      if (hb_atomic_ptr_cmpexch (slot, NULL, built)) {
+	hb_atomic_int_add (accelerators->bytes, (int) _hb_ot_layout_accelerator_bytes (built));
+	return built->in_place ? NULL : built;
+      }
+      /* Lost the slot to another thread; see what it put there */
+      accel = (hb_ot_layout_accelerator_t *) hb_atomic_ptr_get (slot);
+    }
+
+    if (accel->table == table && accel->kind == kind) {
+      if (built)
+	_hb_ot_layout_accelerator_destroy (built);
+      return accel->in_place ? NULL : accel;
+    }
+  }
+
+  /* Neighbourhood full; search in place */
+  if (built)
+    _hb_ot_layout_accelerator_destroy (built);
+  return NULL;
+}
+
+
+/*
+ * kern
+ */
+
+static hb_ot_layout_kern_t *
+_hb_ot_layout_build_kern (hb_face_t *face)
+{
+  hb_ot_layout_kern_t *kern = (hb_ot_layout_kern_t *) calloc (1, sizeof (hb_ot_layout_kern_t));
+  if (unlikely (!kern))
+    return NULL;
+
+  kern->blob = _hb_ot_layout_sanitize_shared<struct kern> (face);
+  const struct kern &table = *Sanitizer<struct kern>::lock_instance (kern->blob);
+
+  unsigned int count = table.get_subtable_count ();
+  kern->subtables = (hb_ot_layout_kern_subtable_t *) calloc (count, sizeof (hb_ot_layout_kern_subtable_t));
+  if (unlikely (count && !kern->subtables)) {
+    _hb_ot_layout_kern_destroy (kern);
+    return NULL;
+  }
+
+  const KernSubTable *subtable = &table.get_first_subtable ();
+  for (unsigned int i = 0; i < count; i++, subtable = &table.get_next_subtable (*subtable))
+  {
+    if (!subtable->is_horizontal_kerning ())
+      continue;
+
+    hb_ot_layout_kern_subtable_t *native = &kern->subtables[kern->num_subtables];
+    native->override = subtable->is_override ();
+    switch (subtable->get_format ()) {
+    case 0: {
+      hb_ot_layout_kern_pair_array_t pairs;
+      bool ok = subtable->get_pairs (pairs);
+      if (ok && pairs.len)
+	ok = _hb_ot_layout_kern_pair_map_init (&native->pair_map, pairs, (unsigned int) -1);
+      pairs.finish ();
+      if (unlikely (!ok)) {
+	_hb_ot_layout_kern_destroy (kern);
+	return NULL;
+      }
+      break;
+    }
+    case 2:
+      native->table = subtable;
+      break;
+    default:
+      continue;
+    }
+    kern->num_subtables++;
+  }
+
+  return kern;
+}
+
+const hb_ot_layout_kern_t *
+_hb_ot_layout_get_kern (hb_face_t *face)
+{
+  hb_ot_layout_t *layout = face->ot_layout;
+  if (unlikely (!layout))
+    return NULL;
+
+  hb_ot_layout_kern_t *kern = (hb_ot_layout_kern_t *) hb_atomic_ptr_get (&layout->kern);
+  if (unlikely (!kern)) {
+    kern = _hb_ot_layout_build_kern (face);
+    if (unlikely (!kern))
+      return NULL;
+
+    /* Another thread may have built it meanwhile; keep whichever came first */
+    if (!hb_atomic_ptr_cmpexch (&layout->kern, NULL, kern)) {
+      _hb_ot_layout_kern_destroy (kern);
+      kern = (hb_ot_layout_kern_t *) hb_atomic_ptr_get (&layout->kern);
+    }
+  }
+  return kern->num_subtables ? kern : NULL;
+}
+
+int
+_hb_ot_layout_get_kerning (const hb_ot_layout_kern_t *kern,
+			   hb_codepoint_t             left,
+			   hb_codepoint_t             right)
+{
+  if (unlikely ((left | right) > 0xFFFF))
+    return 0;
+
+  int v = 0;
+  for (unsigned int i = 0; i < kern->num_subtables; i++)
+  {
+    const hb_ot_layout_kern_subtable_t &subtable = kern->subtables[i];
+    int value = 0;
+    bool found;
+    if (subtable.table) {
+      value = subtable.table->get_kerning (left, right);
+      found = value != 0;
+    } else
+      found = subtable.pair_map.pairs && subtable.pair_map.get ((left << 16) | right, &value);
+    if (!found)
+      continue;
+    v = subtable.override ? value : v + value;
+  }
+
+  /* Kerning values are FWORDs; keep the sum one too */
+  return MAX (-32768, MIN (v, 32767));
+}
+
+
+/* Whether any glyph the lookup would visit is possibly in its digest */
+static inline bool
+_hb_ot_layout_buffer_may_apply (const hb_buffer_t     *buffer,
+				const hb_set_digest_t &digest,
+				hb_mask_t              mask)
+{
+  unsigned int count = buffer->len;
+  for (unsigned int i = 0; i < count; i++)
+    if ((buffer->info[i].mask & mask) && digest.may_have (buffer->info[i].codepoint))
+      return true;
+  return false;
 }
 
 
@@ -94,15 +966,47 @@ hb_ot_layout_has_glyph_classes (hb_face_t *face)
   return _get_gdef (face).has_glyph_classes ();
 }
 
+static const uint16_t *
+_hb_ot_layout_fill_glyph_props (hb_face_t *face, unsigned int page_index)
+{
+  const GDEF &gdef = _get_gdef (face);
+  uint16_t *page = (uint16_t *) malloc (256 * sizeof (uint16_t));
+  if (unlikely (!page))
+    return NULL;
+  for (unsigned int i = 0; i < 256; i++)
+    page[i] = gdef.get_glyph_props ((page_index << 8) + i);
+
+  uint16_t **slot = &face->ot_layout->glyph_props[page_index];
+  if (!hb_atomic_ptr_cmpexch (slot, NULL, page)) {
+    free (page);
+    page = (uint16_t *) hb_atomic_ptr_get (slot);
+  }
+  return page;
+}
+
+static inline unsigned int
+_hb_ot_layout_lookup_glyph_props (hb_face_t *face, hb_codepoint_t glyph)
+{
+  const GDEF &gdef = _get_gdef (face);
+  /* Without glyph classes every glyph is unclassified */
+  if (unlikely (!gdef.has_glyph_classes () || glyph > 0xFFFF))
+    return gdef.get_glyph_props (glyph);
+
+  const uint16_t *page = (const uint16_t *) hb_atomic_ptr_get (&face->ot_layout->glyph_props[glyph >> 8]);
+  if (unlikely (!page)) {
+    page = _hb_ot_layout_fill_glyph_props (face, glyph >> 8);
+    if (unlikely (!page))
+      return gdef.get_glyph_props (glyph);
+  }
+  return page[glyph & 0xFF];
+}
+
 unsigned int
 _hb_ot_layout_get_glyph_property (hb_face_t       *face,
 				  hb_glyph_info_t *info)
 {
   if (!info->props_cache())
-  {
-    const GDEF &gdef = _get_gdef (face);
-    info->props_cache() = gdef.get_glyph_props (info->codepoint);
-  }
+    info->props_cache() = _hb_ot_layout_lookup_glyph_props (face, info->codepoint);
 
   return info->props_cache();
 }
@@ -451,7 +1355,19 @@ hb_ot_layout_substitute_lookup (hb_face_t    *face,
 				unsigned int  lookup_index,
 				hb_mask_t     mask)
 {
-  return _get_gsub (face).substitute_lookup (face, buffer, lookup_index, mask);
+  HB_PROBE3 (gsub_lookup_entry, face, lookup_index, buffer->len);
+  const hb_set_digest_t *subtable_digests = NULL;
+  const hb_ot_layout_lookup_digests_t *digests = _hb_ot_layout_get_lookup_digests (face, 0);
+  if (likely (digests && lookup_index < digests->num_lookups)) {
+    if (!_hb_ot_layout_buffer_may_apply (buffer, digests->digests[lookup_index], mask)) {
+      HB_PROBE3 (gsub_lookup_return, face, lookup_index, FALSE);
+      return FALSE;
+    }
+    subtable_digests = digests->get_subtable_digests (lookup_index);
+  }
+  hb_bool_t ret = _get_gsub (face).substitute_lookup (face, buffer, lookup_index, mask, subtable_digests);
+  HB_PROBE3 (gsub_lookup_return, face, lookup_index, ret);
+  return ret;
 }
 
 void
@@ -460,6 +1376,80 @@ hb_ot_layout_substitute_finish (hb_buffer_t  *buffer HB_UNUSED)
   GSUB::substitute_finish (buffer);
 }
 
+hb_bool_t
+_hb_ot_layout_lookup_is_fusable (hb_face_t    *face,
+				 unsigned int  lookup_index)
+{
+  const SubstLookup &l = _get_gsub (face).get_lookup (lookup_index);
+  /* Without these flags _hb_ot_layout_match_properties() accepts every glyph */
+  if (l.get_props () & (LookupFlag::IgnoreFlags | LookupFlag::UseMarkFilteringSet | LookupFlag::MarkAttachmentType))
+    return FALSE;
+  return l.is_single ();
+}
+
+hb_ot_layout_fused_subst_t *
+_hb_ot_layout_fused_subst_create (hb_face_t          *face,
+				  const unsigned int *lookup_indices,
+				  unsigned int        num_lookups)
+{
+  const GSUB &gsub = _get_gsub (face);
+
+  /* Glyphs no lookup covers pass through the whole run unchanged */
+  hb_codepoint_t first = (hb_codepoint_t) -1, last = 0;
+  for (unsigned int i = 0; i < num_lookups; i++)
+    gsub.get_lookup (lookup_indices[i]).add_bounds (&first, &last);
+
+  unsigned int num_glyphs = first <= last ? last - first + 1 : 0;
+  if (num_glyphs > HB_OT_LAYOUT_MAX_FUSED_GLYPHS)
+    num_glyphs = 0;
+
+  hb_ot_layout_fused_subst_t *fused = (hb_ot_layout_fused_subst_t *) malloc (sizeof (hb_ot_layout_fused_subst_t) +
+									     num_glyphs * sizeof (fused->map[0]));
+  if (unlikely (!fused))
+    return NULL;
+
+  fused->first = first;
+  fused->num_glyphs = num_glyphs;
+  for (unsigned int g = 0; g < num_glyphs; g++) {
+    hb_codepoint_t glyph = first + g;
+    for (unsigned int i = 0; i < num_lookups; i++)
+      gsub.get_lookup (lookup_indices[i]).get_single_substitute (glyph, &glyph);
+    fused->map[g] = glyph;
+  }
+
+  return fused;
+}
+
+void
+_hb_ot_layout_fused_subst_destroy (hb_ot_layout_fused_subst_t *fused)
+{
+  free (fused);
+}
+
+hb_bool_t
+_hb_ot_layout_substitute_fused (const hb_ot_layout_fused_subst_t *fused,
+				hb_buffer_t  *buffer,
+				hb_mask_t     mask)
+{
+  if (unlikely (!fused->num_glyphs))
+    return FALSE;
+
+  /* Matches what the lookups, run one by one in place, leave behind */
+  buffer->clear_output_in_place ();
+
+  hb_glyph_info_t *info = buffer->info;
+  unsigned int count = buffer->len;
+  for (unsigned int i = 0; i < count; i++) {
+    unsigned int g = info[i].codepoint - fused->first;
+    if ((info[i].mask & mask) && g < fused->num_glyphs && fused->map[g] != info[i].codepoint) {
+      info[i].codepoint = fused->map[g];
+      info[i].props_cache() = 0;
+    }
+  }
+
+  return TRUE;
+}
+
 
 /*
  * GPOS
@@ -483,7 +1473,19 @@ hb_ot_layout_position_lookup   (hb_font_t    *font,
 				unsigned int  lookup_index,
 				hb_mask_t     mask)
 {
-  return _get_gpos (font->face).position_lookup (font, buffer, lookup_index, mask);
+  HB_PROBE3 (gpos_lookup_entry, font->face, lookup_index, buffer->len);
+  const hb_set_digest_t *subtable_digests = NULL;
+  const hb_ot_layout_lookup_digests_t *digests = _hb_ot_layout_get_lookup_digests (font->face, 1);
+  if (likely (digests && lookup_index < digests->num_lookups)) {
+    if (!_hb_ot_layout_buffer_may_apply (buffer, digests->digests[lookup_index], mask)) {
+      HB_PROBE3 (gpos_lookup_return, font->face, lookup_index, FALSE);
+      return FALSE;
+    }
+    subtable_digests = digests->get_subtable_digests (lookup_index);
+  }
+  hb_bool_t ret = _get_gpos (font->face).position_lookup (font, buffer, lookup_index, mask, subtable_digests);
+  HB_PROBE3 (gpos_lookup_return, font->face, lookup_index, ret);
+  return ret;
 }
 
 void
@@ -180,6 +180,11 @@ hb_ot_layout_substitute_lookup (hb_face_t    *face,
 void
 hb_ot_layout_substitute_finish (hb_buffer_t  *buffer);
 
+/* Number of fused runs of GSUB lookups applied so far in this process.
+ * For testing lookup fusion; see HB_FUSE_LOOKUPS. */
+unsigned int
+hb_ot_layout_get_fused_run_count (void);
+
 /*
  * GPOS
  */
@@ -31,7 +31,7 @@
 
 #include "hb-buffer-private.hh"
 
-#include "hb-ot-layout.h"
+#include "hb-ot-layout-private.hh"
 
 
 
@@ -75,6 +75,10 @@ struct hb_ot_map_t
     lookups[1].finish ();
     pauses[0].finish ();
     pauses[1].finish ();
+    for (unsigned int i = 0; i < fused_runs.len; i++)
+      if (fused_runs[i].fused)
+	_hb_ot_layout_fused_subst_destroy (fused_runs[i].fused);
+    fused_runs.finish ();
   }
 
   private:
@@ -110,6 +114,14 @@ struct hb_ot_map_t
     pause_callback_t callback;
   };
 
+  /* GSUB lookups lookups[0][start..start+count) fuse into one pass */
+  struct fused_run_t {
+    enum { MAX_LOOKUPS = 32 };
+    unsigned int start;
+    unsigned int count; /* 2..MAX_LOOKUPS */
+    mutable hb_ot_layout_fused_subst_t *fused; /* Built on first use; published with a compare-and-swap */
+  };
+
   typedef hb_bool_t (*apply_lookup_func_t) (void *face_or_font,
 					    hb_buffer_t  *buffer,
 					    unsigned int  lookup_index,
@@ -120,17 +132,32 @@ struct hb_ot_map_t
 				unsigned int  feature_index,
 				hb_mask_t     mask);
 
+  HB_INTERNAL void add_fused_runs (hb_face_t *face);
+
   HB_INTERNAL void apply (unsigned int table_index,
 			  hb_ot_map_t::apply_lookup_func_t apply_lookup_func,
 			  void *face_or_font,
 			  hb_buffer_t *buffer) const;
 
+  HB_INTERNAL void apply_lookups (unsigned int table_index,
+				  hb_ot_map_t::apply_lookup_func_t apply_lookup_func,
+				  void *face_or_font,
+				  hb_buffer_t *buffer,
+				  unsigned int start,
+				  unsigned int end,
+				  unsigned int *run_index) const;
+
+  HB_INTERNAL bool substitute_fused (const fused_run_t *run,
+				     hb_face_t *face,
+				     hb_buffer_t *buffer) const;
+
   hb_mask_t global_mask;
 
   hb_tag_t chosen_script[2];
   hb_prealloced_array_t<feature_map_t, 8> features;
   hb_prealloced_array_t<lookup_map_t, 32> lookups[2]; /* GSUB/GPOS */
   hb_prealloced_array_t<pause_map_t, 1> pauses[2]; /* GSUB/GPOS */
+  hb_prealloced_array_t<fused_run_t, 1> fused_runs; /* GSUB only; in lookup order */
 };
 
 
@@ -29,6 +29,19 @@
 #include "hb-ot-map-private.hh"
 
 #include "hb-ot-shape-private.hh"
+#include "hb-probe-private.hh"
+
+#ifndef HB_DEBUG_FUSED
+#define HB_DEBUG_FUSED (HB_DEBUG+0)
+#endif
+
+static hb_atomic_int_t fused_run_count;
+
+unsigned int
+hb_ot_layout_get_fused_run_count (void)
+{
+  return hb_atomic_int_get (fused_run_count);
+}
 
 
 
@@ -76,23 +89,149 @@ void hb_ot_map_builder_t::add_feature (hb_tag_t tag, unsigned int value, bool gl
   info->stage[1] = current_stage[1];
 }
 
+void
+hb_ot_map_t::add_fused_runs (hb_face_t *face)
+{
+  /* HB_FUSE_LOOKUPS=0 turns fusion off for plans compiled from then on,
+   * so that fused and unfused output can be compared. */
+  const char *env = getenv ("HB_FUSE_LOOKUPS");
+  if (env && 0 == strcmp (env, "0"))
+    return;
+
+  unsigned int pause_index = 0;
+  unsigned int i = 0;
+  while (i < lookups[0].len)
+  {
+    /* Runs don't cross pauses */
+    while (pause_index < pauses[0].len && pauses[0][pause_index].num_lookups <= i)
+      pause_index++;
+    unsigned int limit = pause_index < pauses[0].len ? pauses[0][pause_index].num_lookups : lookups[0].len;
+    limit = MIN (limit, i + fused_run_t::MAX_LOOKUPS);
+
+    unsigned int end = i;
+    while (end < limit &&
+	   lookups[0][end].mask == lookups[0][i].mask &&
+	   _hb_ot_layout_lookup_is_fusable (face, lookups[0][end].index))
+      end++;
+
+    if (end - i >= 2) {
+      fused_run_t *run = fused_runs.push ();
+      if (unlikely (!run))
+	return;
+      run->start = i;
+      run->count = end - i;
+      run->fused = NULL;
+    }
+
+    i = MAX (end, i + 1);
+  }
+}
+
+bool
+hb_ot_map_t::substitute_fused (const fused_run_t *run,
+			       hb_face_t *face,
+			       hb_buffer_t *buffer) const
+{
+  hb_ot_layout_fused_subst_t *fused = (hb_ot_layout_fused_subst_t *) hb_atomic_ptr_get (&run->fused);
+  if (unlikely (!fused))
+  {
+    unsigned int lookup_indices[fused_run_t::MAX_LOOKUPS];
+    for (unsigned int i = 0; i < run->count; i++)
+      lookup_indices[i] = lookups[0][run->start + i].index;
+
+    fused = _hb_ot_layout_fused_subst_create (face, lookup_indices, run->count);
+    if (unlikely (!fused))
+      return false;
+
+    if (!hb_atomic_ptr_cmpexch (&run->fused, NULL, fused)) {
+      _hb_ot_layout_fused_subst_destroy (fused);
+      fused = (hb_ot_layout_fused_subst_t *) hb_atomic_ptr_get (&run->fused);
+    }
+  }
+
+  hb_mask_t mask = lookups[0][run->start].mask;
+
+#if HB_DEBUG_FUSED
+  /* Check the fused map against running the lookups one by one */
+  if (fused->num_glyphs)
+  {
+    unsigned int len = buffer->len;
+    hb_glyph_info_t *saved = (hb_glyph_info_t *) malloc (len * sizeof (hb_glyph_info_t));
+    hb_codepoint_t *expected = (hb_codepoint_t *) malloc (len * sizeof (hb_codepoint_t));
+    bool checked = saved && expected;
+    if (checked)
+    {
+      memcpy (saved, buffer->info, len * sizeof (hb_glyph_info_t));
+      for (unsigned int i = 0; i < run->count; i++)
+	hb_ot_layout_substitute_lookup (face, buffer, lookups[0][run->start + i].index, mask);
+      assert (buffer->len == len);
+      for (unsigned int i = 0; i < len; i++)
+	expected[i] = buffer->info[i].codepoint;
+      memcpy (buffer->info, saved, len * sizeof (hb_glyph_info_t));
+
+      _hb_ot_layout_substitute_fused (fused, buffer, mask);
+      for (unsigned int i = 0; i < len; i++)
+	assert (buffer->info[i].codepoint == expected[i]);
+      DEBUG_MSG (FUSED, buffer, "fused %u lookups over %u glyphs", run->count, len);
+    }
+    free (saved);
+    free (expected);
+    if (checked)
+      return true;
+  }
+#endif
+
+  return _hb_ot_layout_substitute_fused (fused, buffer, mask);
+}
+
+void hb_ot_map_t::apply_lookups (unsigned int table_index,
+				 hb_ot_map_t::apply_lookup_func_t apply_lookup_func,
+				 void *face_or_font,
+				 hb_buffer_t *buffer,
+				 unsigned int start,
+				 unsigned int end,
+				 unsigned int *run_index) const
+{
+  for (unsigned int i = start; i < end; i++)
+  {
+    if (table_index == 0 && *run_index < fused_runs.len && fused_runs[*run_index].start == i)
+    {
+      const fused_run_t *run = &fused_runs[(*run_index)++];
+      /* A fused run stands in for its lookups, so it gets probes of its own,
+       * carrying the first and last lookup index it covers. */
+      unsigned int first_lookup = lookups[0][run->start].index;
+      unsigned int last_lookup = lookups[0][run->start + run->count - 1].index;
+      HB_PROBE4 (gsub_fused_entry, face_or_font, first_lookup, last_lookup, buffer->len);
+      bool fused = substitute_fused (run, (hb_face_t *) face_or_font, buffer);
+      HB_PROBE4 (gsub_fused_return, face_or_font, first_lookup, last_lookup, fused);
+      if (fused) {
+	hb_atomic_int_add (fused_run_count, 1);
+	i += run->count - 1;
+	continue;
+      }
+    }
+
+    apply_lookup_func (face_or_font, buffer, lookups[table_index][i].index, lookups[table_index][i].mask);
+  }
+}
+
 void hb_ot_map_t::apply (unsigned int table_index,
 			 hb_ot_map_t::apply_lookup_func_t apply_lookup_func,
 			 void *face_or_font,
 			 hb_buffer_t *buffer) const
 {
   unsigned int i = 0;
+  unsigned int run_index = 0;
 
   for (unsigned int pause_index = 0; pause_index < pauses[table_index].len; pause_index++) {
     const pause_map_t *pause = &pauses[table_index][pause_index];
-    for (; i < pause->num_lookups; i++)
-      apply_lookup_func (face_or_font, buffer, lookups[table_index][i].index, lookups[table_index][i].mask);
+    apply_lookups (table_index, apply_lookup_func, face_or_font, buffer, i, pause->num_lookups, &run_index);
+    i = pause->num_lookups;
 
     pause->callback.func (this, face_or_font, buffer, pause->callback.user_data);
   }
 
-  for (; i < lookups[table_index].len; i++)
-    apply_lookup_func (face_or_font, buffer, lookups[table_index][i].index, lookups[table_index][i].mask);
+  apply_lookups (table_index, apply_lookup_func, face_or_font, buffer, i, lookups[table_index].len, &run_index);
 }
 
 
@@ -269,6 +408,8 @@ hb_ot_map_builder_t::compile (hb_face_t *face,
       }
     }
   }
+
+  m.add_fused_runs (face);
 }
 
 
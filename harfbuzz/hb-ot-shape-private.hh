@@ -73,6 +73,22 @@ struct hb_ot_shape_planner_t
 };
 
 
+/* Compiled plans are cached on the face, one per set of segment properties
+ * and user features.  Only what the plan depends on is kept of the features:
+ * their tag, value, and whether they apply to the whole buffer. */
+struct hb_ot_shape_plan_cache_entry_t
+{
+  hb_ot_shape_plan_cache_entry_t *next;
+  hb_segment_properties_t props;
+  unsigned int num_user_features;
+  hb_feature_t *user_features;
+  hb_ot_shape_plan_t plan;
+};
+
+HB_INTERNAL void
+_hb_ot_shape_plans_destroy (hb_ot_shape_plan_cache_entry_t *plans);
+
+
 struct hb_ot_shape_context_t
 {
   /* Input to hb_ot_shape_execute() */
@@ -30,6 +30,7 @@
 #include "hb-ot-shape-complex-private.hh"
 
 #include "hb-font-private.hh"
+#include "hb-probe-private.hh"
 
 
 
@@ -314,13 +315,23 @@ static void
 hb_truetype_kern (hb_ot_shape_context_t *c)
 {
   /* TODO Check for kern=0 */
+  /* Read the 'kern' table natively where we can, rather than asking the
+   * font funcs pair by pair */
+  const hb_ot_layout_kern_t *kern = HB_DIRECTION_IS_HORIZONTAL (c->buffer->props.direction) ?
+				    _hb_ot_layout_get_kern (c->face) : NULL;
   unsigned int count = c->buffer->len;
   for (unsigned int i = 1; i < count; i++) {
     hb_position_t x_kern, y_kern, kern1, kern2;
-    hb_font_get_glyph_kerning_for_direction (c->font,
-					     c->buffer->info[i - 1].codepoint, c->buffer->info[i].codepoint,
-					     c->buffer->props.direction,
-					     &x_kern, &y_kern);
+    if (kern) {
+      x_kern = c->font->em_scale_x (_hb_ot_layout_get_kerning (kern,
+							       c->buffer->info[i - 1].codepoint,
+							       c->buffer->info[i].codepoint));
+      y_kern = 0;
+    } else
+      hb_font_get_glyph_kerning_for_direction (c->font,
+					       c->buffer->info[i - 1].codepoint, c->buffer->info[i].codepoint,
+					       c->buffer->props.direction,
+					       &x_kern, &y_kern);
 
     kern1 = x_kern >> 1;
     kern2 = x_kern - kern1;
@@ -408,6 +419,8 @@ hb_ot_shape_plan_internal (hb_ot_shape_plan_t       *plan,
 			   const hb_feature_t       *user_features,
 			   unsigned int              num_user_features)
 {
+  HB_PROBE2 (plan_entry, face, num_user_features);
+
   hb_ot_shape_planner_t planner;
 
   planner.shaper = hb_ot_shape_complex_categorize (props);
@@ -415,6 +428,8 @@ hb_ot_shape_plan_internal (hb_ot_shape_plan_t       *plan,
   hb_ot_shape_collect_features (&planner, props, user_features, num_user_features);
 
   planner.compile (face, props, *plan);
+
+  HB_PROBE1 (plan_return, face);
 }
 
 static void
@@ -428,6 +443,119 @@ hb_ot_shape_execute (hb_ot_shape_plan_t *plan,
   hb_ot_shape_execute_internal (&c);
 }
 
+/* Plan cache */
+
+static inline bool
+_hb_feature_is_global (const hb_feature_t *feature)
+{
+  return feature->start == 0 && feature->end == (unsigned int) -1;
+}
+
+static bool
+hb_ot_shape_plan_matches (const hb_ot_shape_plan_cache_entry_t *entry,
+			  const hb_segment_properties_t        *props,
+			  const hb_feature_t                   *user_features,
+			  unsigned int                          num_user_features)
+{
+  if (entry->props.direction != props->direction ||
+      entry->props.script != props->script ||
+      entry->props.language != props->language ||
+      entry->num_user_features != num_user_features)
+    return false;
+  for (unsigned int i = 0; i < num_user_features; i++)
+    if (entry->user_features[i].tag != user_features[i].tag ||
+	entry->user_features[i].value != user_features[i].value ||
+	_hb_feature_is_global (&entry->user_features[i]) != _hb_feature_is_global (&user_features[i]))
+      return false;
+  return true;
+}
+
+/* Searches the entries from first up to, but not including, last */
+static hb_ot_shape_plan_cache_entry_t *
+hb_ot_shape_plan_find (hb_ot_shape_plan_cache_entry_t *first,
+		       hb_ot_shape_plan_cache_entry_t *last,
+		       const hb_segment_properties_t  *props,
+		       const hb_feature_t             *user_features,
+		       unsigned int                    num_user_features)
+{
+  for (hb_ot_shape_plan_cache_entry_t *entry = first; entry != last; entry = entry->next)
+    if (hb_ot_shape_plan_matches (entry, props, user_features, num_user_features))
+      return entry;
+  return NULL;
+}
+
+static void
+hb_ot_shape_plan_entry_destroy (hb_ot_shape_plan_cache_entry_t *entry)
+{
+  entry->plan.map.finish ();
+  free (entry->user_features);
+  free (entry);
+}
+
+void
+_hb_ot_shape_plans_destroy (hb_ot_shape_plan_cache_entry_t *plans)
+{
+  while (plans) {
+    hb_ot_shape_plan_cache_entry_t *next = plans->next;
+    hb_ot_shape_plan_entry_destroy (plans);
+    plans = next;
+  }
+}
+
+/* Returns the cached plan for these properties and features, compiling and
+ * publishing it first if needed.  Lookups take no lock: entries are never
+ * changed or removed once published, and new ones are prepended with a
+ * compare-and-swap.  Two threads may compile the same plan at once; the
+ * loser of the race throws its copy away.  Returns NULL if the plan cannot be
+ * cached. */
+static hb_ot_shape_plan_t *
+hb_ot_shape_plan_get (hb_face_t                     *face,
+		      const hb_segment_properties_t *props,
+		      const hb_feature_t            *user_features,
+		      unsigned int                   num_user_features)
+{
+  if (unlikely (hb_object_is_inert (face)))
+    return NULL;
+
+  hb_ot_shape_plan_cache_entry_t *head = (hb_ot_shape_plan_cache_entry_t *) hb_atomic_ptr_get (&face->shape_plans);
+  hb_ot_shape_plan_cache_entry_t *found = hb_ot_shape_plan_find (head, NULL, props, user_features, num_user_features);
+  if (likely (found)) {
+    HB_PROBE1 (plan_cache_hit, face);
+    return &found->plan;
+  }
+
+  hb_ot_shape_plan_cache_entry_t *entry = (hb_ot_shape_plan_cache_entry_t *) calloc (1, sizeof (hb_ot_shape_plan_cache_entry_t));
+  if (unlikely (!entry))
+    return NULL;
+  if (num_user_features) {
+    entry->user_features = (hb_feature_t *) malloc (num_user_features * sizeof (hb_feature_t));
+    if (unlikely (!entry->user_features)) {
+      free (entry);
+      return NULL;
+    }
+    memcpy (entry->user_features, user_features, num_user_features * sizeof (hb_feature_t));
+  }
+  entry->num_user_features = num_user_features;
+  entry->props = *props;
+  hb_ot_shape_plan_internal (&entry->plan, face, props, user_features, num_user_features);
+
+  for (;;) {
+    entry->next = head;
+    if (hb_atomic_ptr_cmpexch (&face->shape_plans, head, entry))
+      return &entry->plan;
+
+    /* Somebody else published first; they may have compiled the same plan */
+    hb_ot_shape_plan_cache_entry_t *newer = (hb_ot_shape_plan_cache_entry_t *) hb_atomic_ptr_get (&face->shape_plans);
+    found = hb_ot_shape_plan_find (newer, head, props, user_features, num_user_features);
+    if (found) {
+      hb_ot_shape_plan_entry_destroy (entry);
+      return &found->plan;
+    }
+    head = newer;
+  }
+}
+
+
 hb_bool_t
 hb_ot_shape (hb_font_t          *font,
 	     hb_buffer_t        *buffer,
@@ -435,10 +563,15 @@ hb_ot_shape (hb_font_t          *font,
 	     unsigned int        num_features,
 	     const char * const *shaper_options)
 {
-  hb_ot_shape_plan_t plan;
-
   buffer->guess_properties ();
 
+  hb_ot_shape_plan_t *cached = hb_ot_shape_plan_get (font->face, &buffer->props, features, num_features);
+  if (likely (cached)) {
+    hb_ot_shape_execute (cached, font, buffer, features, num_features);
+    return TRUE;
+  }
+
+  hb_ot_shape_plan_t plan;
   hb_ot_shape_plan_internal (&plan, font->face, &buffer->props, features, num_features);
   hb_ot_shape_execute (&plan, font, buffer, features, num_features);
 
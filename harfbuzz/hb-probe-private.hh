@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2026  The gltext contributors
+ *
+ *  This is part of HarfBuzz, a text shaping library.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the
+ * above copyright notice and the following two paragraphs appear in
+ * all copies of this software.
+ *
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES
+ * ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN
+ * IF THE COPYRIGHT HOLDER HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * THE COPYRIGHT HOLDER SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE COPYRIGHT HOLDER HAS NO OBLIGATION TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ */
+
+#ifndef HB_PROBE_PRIVATE_HH
+#define HB_PROBE_PRIVATE_HH
+
+#include "hb-private.hh"
+
+
+
+/* Static tracepoints
+ *
+ * When built with HAVE_SYS_SDT_H these expand to USDT probes in the
+ * "harfbuzz" provider, which perf and bpftrace can attach to at runtime.
+ * An unattached probe is a single nop.  Otherwise they expand to nothing. */
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define HB_PROBE(name) DTRACE_PROBE (harfbuzz, name)
+#define HB_PROBE1(name, a) DTRACE_PROBE1 (harfbuzz, name, a)
+#define HB_PROBE2(name, a, b) DTRACE_PROBE2 (harfbuzz, name, a, b)
+#define HB_PROBE3(name, a, b, c) DTRACE_PROBE3 (harfbuzz, name, a, b, c)
+#define HB_PROBE4(name, a, b, c, d) DTRACE_PROBE4 (harfbuzz, name, a, b, c, d)
+
+#else
+
+#define HB_PROBE(name) HB_STMT_START {} HB_STMT_END
+#define HB_PROBE1(name, a) HB_STMT_START {} HB_STMT_END
+#define HB_PROBE2(name, a, b) HB_STMT_START {} HB_STMT_END
+#define HB_PROBE3(name, a, b, c) HB_STMT_START {} HB_STMT_END
+#define HB_PROBE4(name, a, b, c, d) HB_STMT_START {} HB_STMT_END
+
+#endif
+
+
+#endif /* HB_PROBE_PRIVATE_HH */
@@ -29,6 +29,7 @@
 #include "hb-shape.h"
 
 #include "hb-buffer-private.hh"
+#include "hb-probe-private.hh"
 
 #ifdef HAVE_GRAPHITE
 #include "hb-graphite2.h"
@@ -123,26 +124,33 @@ hb_shape_full (hb_font_t          *font,
 	       const char * const *shaper_options,
 	       const char * const *shaper_list)
 {
+  hb_bool_t ret = FALSE;
+  HB_PROBE2 (shape_entry, font, buffer->len);
+
   if (likely (!shaper_list)) {
     for (unsigned int i = 0; i < ARRAY_LENGTH (shapers); i++)
       if (likely (shapers[i].func (font, buffer,
 				   features, num_features,
-				   shaper_options)))
-        return TRUE;
+				   shaper_options))) {
+        ret = TRUE;
+        break;
+      }
   } else {
-    while (*shaper_list) {
+    while (!ret && *shaper_list) {
       for (unsigned int i = 0; i < ARRAY_LENGTH (shapers); i++)
 	if (0 == strcmp (*shaper_list, shapers[i].name)) {
 	  if (likely (shapers[i].func (font, buffer,
 				       features, num_features,
 				       shaper_options)))
-	    return TRUE;
+	    ret = TRUE;
 	  break;
 	}
       shaper_list++;
     }
   }
-  return FALSE;
+
+  HB_PROBE3 (shape_return, font, buffer->len, ret);
+  return ret;
 }
 
 void
@@ -0,0 +1,512 @@
+/*
+ * Copyright 2026 The gltext contributors
+ *
+ *  This is part of gltext, a text-rendering library.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the
+ * above copyright notice and the following two paragraphs appear in
+ * all copies of this software.
+ *
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES
+ * ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN
+ * IF THE COPYRIGHT HOLDER HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * THE COPYRIGHT HOLDER SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE COPYRIGHT HOLDER HAS NO OBLIGATION TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ */
+
+#include "itemize.hpp"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GLTEXT_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace gltext {
+
+enum BidiClass {
+    BIDI_L, BIDI_R, BIDI_AL,
+    BIDI_EN, BIDI_ES, BIDI_ET, BIDI_AN, BIDI_CS, BIDI_NSM, BIDI_BN,
+    BIDI_B, BIDI_S, BIDI_WS, BIDI_ON
+};
+
+struct Range {
+    unsigned first;
+    unsigned last;
+    int value;
+};
+
+static const unsigned char ascii_bidi[128] = {
+    BIDI_BN, BIDI_BN, BIDI_BN, BIDI_BN, BIDI_BN, BIDI_BN, BIDI_BN, BIDI_BN,  // 00
+    BIDI_BN, BIDI_S,  BIDI_B,  BIDI_S,  BIDI_WS, BIDI_B,  BIDI_BN, BIDI_BN,
+    BIDI_BN, BIDI_BN, BIDI_BN, BIDI_BN, BIDI_BN, BIDI_BN, BIDI_BN, BIDI_BN,  // 10
+    BIDI_BN, BIDI_BN, BIDI_BN, BIDI_BN, BIDI_B,  BIDI_B,  BIDI_B,  BIDI_S,
+    BIDI_WS, BIDI_ON, BIDI_ON, BIDI_ET, BIDI_ET, BIDI_ET, BIDI_ON, BIDI_ON,  // 20
+    BIDI_ON, BIDI_ON, BIDI_ON, BIDI_ES, BIDI_CS, BIDI_ES, BIDI_CS, BIDI_CS,
+    BIDI_EN, BIDI_EN, BIDI_EN, BIDI_EN, BIDI_EN, BIDI_EN, BIDI_EN, BIDI_EN,  // 30
+    BIDI_EN, BIDI_EN, BIDI_CS, BIDI_ON, BIDI_ON, BIDI_ON, BIDI_ON, BIDI_ON,
+    BIDI_ON, BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,   // 40
+    BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,
+    BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,   // 50
+    BIDI_L,  BIDI_L,  BIDI_L,  BIDI_ON, BIDI_ON, BIDI_ON, BIDI_ON, BIDI_ON,
+    BIDI_ON, BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,   // 60
+    BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,
+    BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,  BIDI_L,   // 70
+    BIDI_L,  BIDI_L,  BIDI_L,  BIDI_ON, BIDI_ON, BIDI_ON, BIDI_ON, BIDI_BN
+};
+
+// Bidi classes above U+007F that are not L. This is a reduced form of DerivedBidiClass.txt that covers
+// the right-to-left scripts, numbers, punctuation and the common combining marks.
+static const Range bidi_ranges[] = {
+    { 0x0085, 0x0085, BIDI_B },   { 0x00A0, 0x00A0, BIDI_CS },  { 0x00A1, 0x00A1, BIDI_ON },
+    { 0x00A2, 0x00A5, BIDI_ET },  { 0x00A6, 0x00A9, BIDI_ON },  { 0x00AB, 0x00AC, BIDI_ON },
+    { 0x00AD, 0x00AD, BIDI_BN },  { 0x00AE, 0x00AF, BIDI_ON },  { 0x00B0, 0x00B1, BIDI_ET },
+    { 0x00B2, 0x00B3, BIDI_EN },  { 0x00B4, 0x00B4, BIDI_ON },  { 0x00B6, 0x00B8, BIDI_ON },
+    { 0x00B9, 0x00B9, BIDI_EN },  { 0x00BB, 0x00BF, BIDI_ON },  { 0x00D7, 0x00D7, BIDI_ON },
+    { 0x00F7, 0x00F7, BIDI_ON },
+    { 0x0300, 0x036F, BIDI_NSM }, { 0x0483, 0x0489, BIDI_NSM },
+    { 0x0590, 0x0590, BIDI_R },   { 0x0591, 0x05BD, BIDI_NSM }, { 0x05BE, 0x05BE, BIDI_R },
+    { 0x05BF, 0x05BF, BIDI_NSM }, { 0x05C0, 0x05C0, BIDI_R },   { 0x05C1, 0x05C2, BIDI_NSM },
+    { 0x05C3, 0x05C3, BIDI_R },   { 0x05C4, 0x05C5, BIDI_NSM }, { 0x05C6, 0x05C6, BIDI_R },
+    { 0x05C7, 0x05C7, BIDI_NSM }, { 0x05C8, 0x05FF, BIDI_R },
+    { 0x0600, 0x0605, BIDI_AN },  { 0x0606, 0x0607, BIDI_ON },  { 0x0608, 0x0608, BIDI_AL },
+    { 0x0609, 0x060A, BIDI_ET },  { 0x060B, 0x060B, BIDI_AL },  { 0x060C, 0x060C, BIDI_CS },
+    { 0x060D, 0x060D, BIDI_AL },  { 0x060E, 0x060F, BIDI_ON },  { 0x0610, 0x061A, BIDI_NSM },
+    { 0x061B, 0x064A, BIDI_AL },  { 0x064B, 0x065F, BIDI_NSM }, { 0x0660, 0x0669, BIDI_AN },
+    { 0x066A, 0x066A, BIDI_ET },  { 0x066B, 0x066C, BIDI_AN },  { 0x066D, 0x066F, BIDI_AL },
+    { 0x0670, 0x0670, BIDI_NSM }, { 0x0671, 0x06D5, BIDI_AL },  { 0x06D6, 0x06DC, BIDI_NSM },
+    { 0x06DD, 0x06DD, BIDI_AN },  { 0x06DE, 0x06DE, BIDI_ON },  { 0x06DF, 0x06E4, BIDI_NSM },
+    { 0x06E5, 0x06E6, BIDI_AL },  { 0x06E7, 0x06E8, BIDI_NSM }, { 0x06E9, 0x06E9, BIDI_ON },
+    { 0x06EA, 0x06ED, BIDI_NSM }, { 0x06EE, 0x06EF, BIDI_AL },  { 0x06F0, 0x06F9, BIDI_EN },
+    { 0x06FA, 0x0710, BIDI_AL },  { 0x0711, 0x0711, BIDI_NSM }, { 0x0712, 0x072F, BIDI_AL },
+    { 0x0730, 0x074A, BIDI_NSM }, { 0x074B, 0x07A5, BIDI_AL },  { 0x07A6, 0x07B0, BIDI_NSM },
+    { 0x07B1, 0x07BF, BIDI_AL },  { 0x07C0, 0x07EA, BIDI_R },   { 0x07EB, 0x07F3, BIDI_NSM },
+    { 0x07F4, 0x07F5, BIDI_R },   { 0x07F6, 0x07F9, BIDI_ON },  { 0x07FA, 0x085F, BIDI_R },
+    { 0x0860, 0x08D3, BIDI_AL },  { 0x08D4, 0x08FF, BIDI_NSM },
+    { 0x1AB0, 0x1AFF, BIDI_NSM }, { 0x1DC0, 0x1DFF, BIDI_NSM },
+    { 0x2000, 0x200A, BIDI_WS },  { 0x200B, 0x200D, BIDI_BN },  { 0x200F, 0x200F, BIDI_R },
+    { 0x2010, 0x2027, BIDI_ON },  { 0x2028, 0x2028, BIDI_WS },  { 0x2029, 0x2029, BIDI_B },
+    { 0x202A, 0x202E, BIDI_BN },  { 0x202F, 0x202F, BIDI_CS },  { 0x2030, 0x2034, BIDI_ET },
+    { 0x2035, 0x205E, BIDI_ON },  { 0x205F, 0x205F, BIDI_WS },  { 0x2060, 0x206F, BIDI_BN },
+    { 0x2070, 0x2070, BIDI_EN },  { 0x2074, 0x2079, BIDI_EN },  { 0x207A, 0x207B, BIDI_ES },
+    { 0x207C, 0x207E, BIDI_ON },  { 0x2080, 0x2089, BIDI_EN },  { 0x208A, 0x208B, BIDI_ES },
+    { 0x208C, 0x208E, BIDI_ON },  { 0x20A0, 0x20CF, BIDI_ET },  { 0x20D0, 0x20F0, BIDI_NSM },
+    { 0x2190, 0x2335, BIDI_ON },  { 0x237B, 0x2394, BIDI_ON },  { 0x2396, 0x2487, BIDI_ON },
+    { 0x2488, 0x249B, BIDI_EN },  { 0x24EA, 0x26AB, BIDI_ON },  { 0x26AD, 0x27FF, BIDI_ON },
+    { 0x2900, 0x2BFF, BIDI_ON },
+    { 0x3000, 0x3000, BIDI_WS },  { 0x3001, 0x3004, BIDI_ON },  { 0x3008, 0x3020, BIDI_ON },
+    { 0xFB1D, 0xFB1D, BIDI_R },   { 0xFB1E, 0xFB1E, BIDI_NSM }, { 0xFB1F, 0xFB28, BIDI_R },
+    { 0xFB29, 0xFB29, BIDI_ES },  { 0xFB2A, 0xFB4F, BIDI_R },   { 0xFB50, 0xFD3D, BIDI_AL },
+    { 0xFD3E, 0xFD3F, BIDI_ON },  { 0xFD40, 0xFDFF, BIDI_AL },  { 0xFE00, 0xFE0F, BIDI_NSM },
+    { 0xFE20, 0xFE2F, BIDI_NSM }, { 0xFE70, 0xFEFE, BIDI_AL },  { 0xFEFF, 0xFEFF, BIDI_BN },
+    { 0xFF01, 0xFF02, BIDI_ON },  { 0xFF03, 0xFF05, BIDI_ET },  { 0xFF06, 0xFF0A, BIDI_ON },
+    { 0xFF0B, 0xFF0B, BIDI_ES },  { 0xFF0C, 0xFF0C, BIDI_CS },  { 0xFF0D, 0xFF0D, BIDI_ES },
+    { 0xFF0E, 0xFF0F, BIDI_CS },  { 0xFF10, 0xFF19, BIDI_EN },  { 0xFF1A, 0xFF1A, BIDI_CS },
+    { 0x10800, 0x10FFF, BIDI_R }, { 0x1E800, 0x1EFFF, BIDI_R }, { 0xE0001, 0xE007F, BIDI_BN },
+    { 0xE0100, 0xE01EF, BIDI_NSM }
+};
+
+// Scripts of the letters above U+007F. Anything not listed is Common.
+static const Range script_ranges[] = {
+    { 0x00AA, 0x00AA, HB_SCRIPT_LATIN },      { 0x00BA, 0x00BA, HB_SCRIPT_LATIN },
+    { 0x00C0, 0x00D6, HB_SCRIPT_LATIN },      { 0x00D8, 0x00F6, HB_SCRIPT_LATIN },
+    { 0x00F8, 0x02AF, HB_SCRIPT_LATIN },      { 0x0300, 0x036F, HB_SCRIPT_INHERITED },
+    { 0x0370, 0x0373, HB_SCRIPT_GREEK },      { 0x0375, 0x037D, HB_SCRIPT_GREEK },
+    { 0x0384, 0x0384, HB_SCRIPT_GREEK },      { 0x0386, 0x0386, HB_SCRIPT_GREEK },
+    { 0x0388, 0x03E1, HB_SCRIPT_GREEK },      { 0x03E2, 0x03EF, HB_SCRIPT_COPTIC },
+    { 0x03F0, 0x03FF, HB_SCRIPT_GREEK },      { 0x0400, 0x0484, HB_SCRIPT_CYRILLIC },
+    { 0x0485, 0x0486, HB_SCRIPT_INHERITED },  { 0x0487, 0x052F, HB_SCRIPT_CYRILLIC },
+    { 0x0531, 0x0588, HB_SCRIPT_ARMENIAN },   { 0x058A, 0x058F, HB_SCRIPT_ARMENIAN },
+    { 0x0591, 0x05FF, HB_SCRIPT_HEBREW },     { 0x0600, 0x060B, HB_SCRIPT_ARABIC },
+    { 0x060D, 0x061A, HB_SCRIPT_ARABIC },     { 0x061C, 0x061E, HB_SCRIPT_ARABIC },
+    { 0x0620, 0x063F, HB_SCRIPT_ARABIC },     { 0x0641, 0x064A, HB_SCRIPT_ARABIC },
+    { 0x064B, 0x0655, HB_SCRIPT_INHERITED },  { 0x0656, 0x065F, HB_SCRIPT_ARABIC },
+    { 0x066A, 0x066F, HB_SCRIPT_ARABIC },     { 0x0670, 0x0670, HB_SCRIPT_INHERITED },
+    { 0x0671, 0x06DC, HB_SCRIPT_ARABIC },     { 0x06DE, 0x06FF, HB_SCRIPT_ARABIC },
+    { 0x0700, 0x074F, HB_SCRIPT_SYRIAC },     { 0x0750, 0x077F, HB_SCRIPT_ARABIC },
+    { 0x0780, 0x07BF, HB_SCRIPT_THAANA },     { 0x07C0, 0x07FF, HB_SCRIPT_NKO },
+    { 0x0800, 0x083F, HB_SCRIPT_SAMARITAN },  { 0x0840, 0x085F, HB_SCRIPT_MANDAIC },
+    { 0x08A0, 0x08FF, HB_SCRIPT_ARABIC },     { 0x0900, 0x0950, HB_SCRIPT_DEVANAGARI },
+    { 0x0951, 0x0952, HB_SCRIPT_INHERITED },  { 0x0953, 0x0963, HB_SCRIPT_DEVANAGARI },
+    { 0x0966, 0x097F, HB_SCRIPT_DEVANAGARI }, { 0x0980, 0x09FF, HB_SCRIPT_BENGALI },
+    { 0x0A00, 0x0A7F, HB_SCRIPT_GURMUKHI },   { 0x0A80, 0x0AFF, HB_SCRIPT_GUJARATI },
+    { 0x0B00, 0x0B7F, HB_SCRIPT_ORIYA },      { 0x0B80, 0x0BFF, HB_SCRIPT_TAMIL },
+    { 0x0C00, 0x0C7F, HB_SCRIPT_TELUGU },     { 0x0C80, 0x0CFF, HB_SCRIPT_KANNADA },
+    { 0x0D00, 0x0D7F, HB_SCRIPT_MALAYALAM },  { 0x0D80, 0x0DFF, HB_SCRIPT_SINHALA },
+    { 0x0E01, 0x0E3A, HB_SCRIPT_THAI },       { 0x0E40, 0x0E7F, HB_SCRIPT_THAI },
+    { 0x0E80, 0x0EFF, HB_SCRIPT_LAO },        { 0x0F00, 0x0FD4, HB_SCRIPT_TIBETAN },
+    { 0x0FD9, 0x0FFF, HB_SCRIPT_TIBETAN },    { 0x1000, 0x109F, HB_SCRIPT_MYANMAR },
+    { 0x10A0, 0x10FA, HB_SCRIPT_GEORGIAN },   { 0x10FC, 0x10FF, HB_SCRIPT_GEORGIAN },
+    { 0x1100, 0x11FF, HB_SCRIPT_HANGUL },     { 0x1200, 0x139F, HB_SCRIPT_ETHIOPIC },
+    { 0x13A0, 0x13FF, HB_SCRIPT_CHEROKEE },   { 0x1680, 0x169F, HB_SCRIPT_OGHAM },
+    { 0x16A0, 0x16EA, HB_SCRIPT_RUNIC },      { 0x16EE, 0x16FF, HB_SCRIPT_RUNIC },
+    { 0x1700, 0x171F, HB_SCRIPT_TAGALOG },    { 0x1720, 0x1734, HB_SCRIPT_HANUNOO },
+    { 0x1740, 0x175F, HB_SCRIPT_BUHID },      { 0x1760, 0x177F, HB_SCRIPT_TAGBANWA },
+    { 0x1780, 0x17FF, HB_SCRIPT_KHMER },      { 0x1800, 0x1801, HB_SCRIPT_MONGOLIAN },
+    { 0x1804, 0x1804, HB_SCRIPT_MONGOLIAN },  { 0x1806, 0x18AF, HB_SCRIPT_MONGOLIAN },
+    { 0x1900, 0x194F, HB_SCRIPT_LIMBU },      { 0x1A00, 0x1A1F, HB_SCRIPT_BUGINESE },
+    { 0x1AB0, 0x1AFF, HB_SCRIPT_INHERITED },  { 0x1B00, 0x1B7F, HB_SCRIPT_BALINESE },
+    { 0x1B80, 0x1BBF, HB_SCRIPT_SUNDANESE },  { 0x1BC0, 0x1BFF, HB_SCRIPT_BATAK },
+    { 0x1C00, 0x1C4F, HB_SCRIPT_LEPCHA },     { 0x1D00, 0x1D25, HB_SCRIPT_LATIN },
+    { 0x1D26, 0x1D2A, HB_SCRIPT_GREEK },      { 0x1D2B, 0x1D2B, HB_SCRIPT_CYRILLIC },
+    { 0x1D2C, 0x1D5C, HB_SCRIPT_LATIN },      { 0x1D5D, 0x1D61, HB_SCRIPT_GREEK },
+    { 0x1D62, 0x1D65, HB_SCRIPT_LATIN },      { 0x1D66, 0x1D6A, HB_SCRIPT_GREEK },
+    { 0x1D6B, 0x1DBF, HB_SCRIPT_LATIN },      { 0x1DC0, 0x1DFF, HB_SCRIPT_INHERITED },
+    { 0x1E00, 0x1EFF, HB_SCRIPT_LATIN },      { 0x1F00, 0x1FFF, HB_SCRIPT_GREEK },
+    { 0x200C, 0x200D, HB_SCRIPT_INHERITED },  { 0x2071, 0x2071, HB_SCRIPT_LATIN },
+    { 0x207F, 0x207F, HB_SCRIPT_LATIN },      { 0x2090, 0x209C, HB_SCRIPT_LATIN },
+    { 0x20D0, 0x20F0, HB_SCRIPT_INHERITED },  { 0x2126, 0x2126, HB_SCRIPT_GREEK },
+    { 0x212A, 0x212B, HB_SCRIPT_LATIN },      { 0x2132, 0x2132, HB_SCRIPT_LATIN },
+    { 0x214E, 0x214E, HB_SCRIPT_LATIN },      { 0x2160, 0x2188, HB_SCRIPT_LATIN },
+    { 0x2800, 0x28FF, HB_SCRIPT_BRAILLE },    { 0x2C00, 0x2C5F, HB_SCRIPT_GLAGOLITIC },
+    { 0x2C60, 0x2C7F, HB_SCRIPT_LATIN },      { 0x2C80, 0x2CFF, HB_SCRIPT_COPTIC },
+    { 0x2D00, 0x2D2F, HB_SCRIPT_GEORGIAN },   { 0x2D30, 0x2D7F, HB_SCRIPT_TIFINAGH },
+    { 0x2D80, 0x2DDF, HB_SCRIPT_ETHIOPIC },   { 0x2DE0, 0x2DFF, HB_SCRIPT_CYRILLIC },
+    { 0x2E80, 0x2FDF, HB_SCRIPT_HAN },        { 0x3005, 0x3005, HB_SCRIPT_HAN },
+    { 0x3007, 0x3007, HB_SCRIPT_HAN },        { 0x3021, 0x3029, HB_SCRIPT_HAN },
+    { 0x302A, 0x302D, HB_SCRIPT_INHERITED },  { 0x3038, 0x303B, HB_SCRIPT_HAN },
+    { 0x3041, 0x3096, HB_SCRIPT_HIRAGANA },   { 0x3099, 0x309A, HB_SCRIPT_INHERITED },
+    { 0x309D, 0x309F, HB_SCRIPT_HIRAGANA },   { 0x30A1, 0x30FA, HB_SCRIPT_KATAKANA },
+    { 0x30FD, 0x30FF, HB_SCRIPT_KATAKANA },   { 0x3105, 0x312F, HB_SCRIPT_BOPOMOFO },
+    { 0x3131, 0x318E, HB_SCRIPT_HANGUL },     { 0x31A0, 0x31BF, HB_SCRIPT_BOPOMOFO },
+    { 0x31F0, 0x31FF, HB_SCRIPT_KATAKANA },   { 0x3200, 0x321E, HB_SCRIPT_HANGUL },
+    { 0x3260, 0x327E, HB_SCRIPT_HANGUL },     { 0x32D0, 0x32FE, HB_SCRIPT_KATAKANA },
+    { 0x3300, 0x3357, HB_SCRIPT_KATAKANA },   { 0x3400, 0x4DBF, HB_SCRIPT_HAN },
+    { 0x4E00, 0x9FFF, HB_SCRIPT_HAN },        { 0xA000, 0xA4CF, HB_SCRIPT_YI },
+    { 0xA4D0, 0xA4FF, HB_SCRIPT_LISU },       { 0xA500, 0xA63F, HB_SCRIPT_VAI },
+    { 0xA640, 0xA69F, HB_SCRIPT_CYRILLIC },   { 0xA6A0, 0xA6FF, HB_SCRIPT_BAMUM },
+    { 0xA722, 0xA787, HB_SCRIPT_LATIN },      { 0xA78B, 0xA7FF, HB_SCRIPT_LATIN },
+    { 0xA800, 0xA82F, HB_SCRIPT_SYLOTI_NAGRI }, { 0xA880, 0xA8DF, HB_SCRIPT_SAURASHTRA },
+    { 0xA900, 0xA92F, HB_SCRIPT_KAYAH_LI },   { 0xA930, 0xA95F, HB_SCRIPT_REJANG },
+    { 0xA980, 0xA9DF, HB_SCRIPT_JAVANESE },   { 0xAA00, 0xAA5F, HB_SCRIPT_CHAM },
+    { 0xAC00, 0xD7FF, HB_SCRIPT_HANGUL },     { 0xF900, 0xFAFF, HB_SCRIPT_HAN },
+    { 0xFB00, 0xFB06, HB_SCRIPT_LATIN },      { 0xFB13, 0xFB17, HB_SCRIPT_ARMENIAN },
+    { 0xFB1D, 0xFB4F, HB_SCRIPT_HEBREW },     { 0xFB50, 0xFD3D, HB_SCRIPT_ARABIC },
+    { 0xFD50, 0xFDFD, HB_SCRIPT_ARABIC },     { 0xFE00, 0xFE0F, HB_SCRIPT_INHERITED },
+    { 0xFE20, 0xFE2F, HB_SCRIPT_INHERITED },  { 0xFE70, 0xFEFC, HB_SCRIPT_ARABIC },
+    { 0xFF21, 0xFF3A, HB_SCRIPT_LATIN },      { 0xFF41, 0xFF5A, HB_SCRIPT_LATIN },
+    { 0xFF66, 0xFF6F, HB_SCRIPT_KATAKANA },   { 0xFF71, 0xFF9D, HB_SCRIPT_KATAKANA },
+    { 0xFFA0, 0xFFDC, HB_SCRIPT_HANGUL },     { 0x20000, 0x2FA1F, HB_SCRIPT_HAN },
+    { 0xE0100, 0xE01EF, HB_SCRIPT_INHERITED }
+};
+
+// Bidi_Mirroring_Glyph pairs for the brackets and quotes that turn up in UI text. Each entry maps both ways.
+static const unsigned mirror_pairs[][2] = {
+    { 0x0028, 0x0029 }, { 0x003C, 0x003E }, { 0x005B, 0x005D }, { 0x007B, 0x007D },
+    { 0x00AB, 0x00BB }, { 0x2039, 0x203A }, { 0x2045, 0x2046 }, { 0x207D, 0x207E },
+    { 0x208D, 0x208E }, { 0x2264, 0x2265 }, { 0x3008, 0x3009 }, { 0x300A, 0x300B },
+    { 0x300C, 0x300D }, { 0x300E, 0x300F }, { 0x3010, 0x3011 }, { 0xFF08, 0xFF09 },
+    { 0xFF1C, 0xFF1E }, { 0xFF3B, 0xFF3D }, { 0xFF5B, 0xFF5D }
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static int lookupRange(const Range* ranges, unsigned count, unsigned c, int fallback) {
+    unsigned lo = 0;
+    unsigned hi = count;
+    while(lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if(c < ranges[mid].first)
+            hi = mid;
+        else if(c > ranges[mid].last)
+            lo = mid + 1;
+        else
+            return ranges[mid].value;
+    }
+    return fallback;
+}
+
+static BidiClass bidiClass(unsigned c) {
+    if(c < 0x80)
+        return BidiClass(ascii_bidi[c]);
+    return BidiClass(lookupRange(bidi_ranges, ARRAY_SIZE(bidi_ranges), c, BIDI_L));
+}
+
+static hb_script_t scriptOf(unsigned c) {
+    if(c < 0x80)
+        return ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') ? HB_SCRIPT_LATIN : HB_SCRIPT_COMMON;
+    return hb_script_t(lookupRange(script_ranges, ARRAY_SIZE(script_ranges), c, HB_SCRIPT_COMMON));
+}
+
+// Pure ASCII can only ever be a single left-to-right Latin run, so it needs no itemization at all
+static bool isAscii(const char* text, unsigned length) {
+    const unsigned char* p = (const unsigned char*)text;
+    const unsigned char* end = p + length;
+#ifdef GLTEXT_HAVE_SSE2
+    for(; end - p >= 16; p += 16) {
+        if(_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p)))
+            return false;
+    }
+#else
+    for(; end - p >= 8; p += 8) {
+        unsigned long long word;
+        memcpy(&word, p, 8);
+        if(word & 0x8080808080808080ull)
+            return false;
+    }
+#endif
+    for(; p < end; p++) {
+        if(*p & 0x80)
+            return false;
+    }
+    return true;
+}
+
+static bool isStrong(int t) {
+    return t == BIDI_L || t == BIDI_R || t == BIDI_AL;
+}
+
+static bool isNeutral(int t) {
+    return t == BIDI_B || t == BIDI_S || t == BIDI_WS || t == BIDI_ON;
+}
+
+// Direction of a resolved type for the neutral rules, where numbers count as R
+static int strongDirection(int t) {
+    return t == BIDI_L ? BIDI_L : BIDI_R;
+}
+
+void itemizeParagraph(const std::string& text, unsigned offset, unsigned length, std::vector<ScriptRun>& runs) {
+    runs.clear();
+    if(!length)
+        return;
+    if(isAscii(text.data() + offset, length)) {
+        ScriptRun run = { offset, length, 0, HB_SCRIPT_LATIN };
+        runs.push_back(run);
+        return;
+    }
+
+    std::vector<unsigned> starts;
+    std::vector<unsigned char> original;
+    std::vector<hb_script_t> scripts;
+    size_t i = offset;
+    while(i < offset + length) {
+        starts.push_back(i);
+        unsigned c = decodeUtf8(text, i);
+        original.push_back(bidiClass(c));
+        scripts.push_back(scriptOf(c));
+    }
+    starts.push_back(offset + length);
+    unsigned n = original.size();
+    std::vector<unsigned char> types(original);
+
+    // P2, P3: the paragraph level comes from the first strong character
+    unsigned char para = 0;
+    for(unsigned k = 0; k < n; k++) {
+        if(isStrong(types[k])) {
+            para = types[k] == BIDI_L ? 0 : 1;
+            break;
+        }
+    }
+    int sos = para ? BIDI_R : BIDI_L;
+
+    // W1: marks take the type of what they attach to. Boundary neutrals are treated the same way, in place of X9.
+    int prev = sos;
+    for(unsigned k = 0; k < n; k++) {
+        if(types[k] == BIDI_NSM || types[k] == BIDI_BN)
+            types[k] = prev;
+        prev = types[k];
+    }
+
+    // W2, W3: European numbers after Arabic letters are Arabic numbers, and Arabic letters are R
+    int last_strong = sos;
+    for(unsigned k = 0; k < n; k++) {
+        if(isStrong(types[k]))
+            last_strong = types[k];
+        else if(types[k] == BIDI_EN && last_strong == BIDI_AL)
+            types[k] = BIDI_AN;
+    }
+    for(unsigned k = 0; k < n; k++) {
+        if(types[k] == BIDI_AL)
+            types[k] = BIDI_R;
+    }
+
+    // W4: a single separator between two numbers of the same kind joins them
+    for(unsigned k = 1; k + 1 < n; k++) {
+        if(types[k] == BIDI_ES && types[k-1] == BIDI_EN && types[k+1] == BIDI_EN)
+            types[k] = BIDI_EN;
+        else if(types[k] == BIDI_CS && types[k-1] == types[k+1] && (types[k-1] == BIDI_EN || types[k-1] == BIDI_AN))
+            types[k] = types[k-1];
+    }
+
+    // W5: terminators next to European numbers become part of them
+    for(unsigned k = 0; k < n; k++) {
+        if(types[k] != BIDI_ET)
+            continue;
+        unsigned end = k;
+        while(end < n && types[end] == BIDI_ET)
+            end++;
+        if((k > 0 && types[k-1] == BIDI_EN) || (end < n && types[end] == BIDI_EN)) {
+            for(unsigned j = k; j < end; j++)
+                types[j] = BIDI_EN;
+        }
+        k = end - 1;
+    }
+
+    // W6, W7: leftover separators and terminators are neutral, and European numbers in left-to-right context are L
+    last_strong = sos;
+    for(unsigned k = 0; k < n; k++) {
+        if(types[k] == BIDI_ES || types[k] == BIDI_ET || types[k] == BIDI_CS)
+            types[k] = BIDI_ON;
+        if(types[k] == BIDI_L || types[k] == BIDI_R)
+            last_strong = types[k];
+        else if(types[k] == BIDI_EN && last_strong == BIDI_L)
+            types[k] = BIDI_L;
+    }
+
+    // N1, N2: neutrals between text of the same direction take that direction, others take the paragraph direction
+    for(unsigned k = 0; k < n; k++) {
+        if(!isNeutral(types[k]))
+            continue;
+        unsigned end = k;
+        while(end < n && isNeutral(types[end]))
+            end++;
+        int before = k > 0 ? strongDirection(types[k-1]) : sos;
+        int after = end < n ? strongDirection(types[end]) : sos;
+        int resolved = before == after ? before : sos;
+        for(unsigned j = k; j < end; j++)
+            types[j] = resolved;
+        k = end - 1;
+    }
+
+    // I1, I2
+    std::vector<unsigned char> levels(n);
+    for(unsigned k = 0; k < n; k++) {
+        unsigned char level = para;
+        if(para & 1) {
+            if(types[k] == BIDI_L || types[k] == BIDI_EN || types[k] == BIDI_AN)
+                level++;
+        } else {
+            if(types[k] == BIDI_R)
+                level++;
+            else if(types[k] == BIDI_AN || types[k] == BIDI_EN)
+                level += 2;
+        }
+        levels[k] = level;
+    }
+
+    // L1: separators, and whitespace before them or at the end of the line, go back to the paragraph level
+    bool trailing = true;
+    for(unsigned k = n; k > 0; k--) {
+        int t = original[k-1];
+        if(t == BIDI_S || t == BIDI_B) {
+            levels[k-1] = para;
+            trailing = true;
+        } else if(trailing && (t == BIDI_WS || t == BIDI_BN)) {
+            levels[k-1] = para;
+        } else {
+            trailing = false;
+        }
+    }
+
+    // Common and inherited characters take the script before them, or after them at the start of the text
+    hb_script_t current = HB_SCRIPT_COMMON;
+    for(unsigned k = 0; k < n; k++) {
+        if(scripts[k] != HB_SCRIPT_COMMON && scripts[k] != HB_SCRIPT_INHERITED) {
+            current = scripts[k];
+            break;
+        }
+    }
+    for(unsigned k = 0; k < n; k++) {
+        if(scripts[k] == HB_SCRIPT_COMMON || scripts[k] == HB_SCRIPT_INHERITED)
+            scripts[k] = current;
+        else
+            current = scripts[k];
+    }
+
+    for(unsigned k = 0; k < n; k++) {
+        if(runs.empty() || runs.back().level != levels[k] || runs.back().script != scripts[k]) {
+            ScriptRun run = { starts[k], 0, levels[k], scripts[k] };
+            runs.push_back(run);
+        }
+        runs.back().length = starts[k+1] - runs.back().offset;
+    }
+}
+
+void reorderRuns(const std::vector<unsigned char>& levels, std::vector<unsigned>& order) {
+    unsigned n = levels.size();
+    order.resize(n);
+    unsigned char highest = 0;
+    unsigned char lowest_odd = 0xff;
+    for(unsigned k = 0; k < n; k++) {
+        order[k] = k;
+        if(levels[k] > highest)
+            highest = levels[k];
+        if((levels[k] & 1) && levels[k] < lowest_odd)
+            lowest_odd = levels[k];
+    }
+
+    // L2: from the highest level down to the lowest odd level, reverse every sequence at that level or higher
+    for(int level = highest; level >= lowest_odd && level > 0; level--) {
+        for(unsigned k = 0; k < n; k++) {
+            if(levels[order[k]] < level)
+                continue;
+            unsigned end = k;
+            while(end < n && levels[order[end]] >= level)
+                end++;
+            for(unsigned a = k, b = end - 1; a < b; a++, b--) {
+                unsigned t = order[a];
+                order[a] = order[b];
+                order[b] = t;
+            }
+            k = end;
+        }
+    }
+}
+
+static hb_unicode_general_category_t generalCategory(hb_unicode_funcs_t*, hb_codepoint_t c, void*) {
+    switch(bidiClass(c)) {
+    case BIDI_NSM:
+        return HB_UNICODE_GENERAL_CATEGORY_NON_SPACING_MARK;
+    case BIDI_BN:
+        return c < 0x80 ? HB_UNICODE_GENERAL_CATEGORY_CONTROL : HB_UNICODE_GENERAL_CATEGORY_FORMAT;
+    case BIDI_B:
+    case BIDI_S:
+        return HB_UNICODE_GENERAL_CATEGORY_CONTROL;
+    case BIDI_WS:
+        return HB_UNICODE_GENERAL_CATEGORY_SPACE_SEPARATOR;
+    case BIDI_EN:
+    case BIDI_AN:
+        return HB_UNICODE_GENERAL_CATEGORY_DECIMAL_NUMBER;
+    case BIDI_ON:
+    case BIDI_CS:
+    case BIDI_ES:
+    case BIDI_ET:
+        return HB_UNICODE_GENERAL_CATEGORY_OTHER_PUNCTUATION;
+    default:
+        return HB_UNICODE_GENERAL_CATEGORY_OTHER_LETTER;
+    }
+}
+
+static hb_codepoint_t mirroring(hb_unicode_funcs_t*, hb_codepoint_t c, void*) {
+    for(unsigned k = 0; k < ARRAY_SIZE(mirror_pairs); k++) {
+        if(mirror_pairs[k][0] == c)
+            return mirror_pairs[k][1];
+        if(mirror_pairs[k][1] == c)
+            return mirror_pairs[k][0];
+    }
+    return c;
+}
+
+static hb_script_t script(hb_unicode_funcs_t*, hb_codepoint_t c, void*) {
+    return scriptOf(c);
+}
+
+hb_unicode_funcs_t* createUnicodeFuncs() {
+    hb_unicode_funcs_t* funcs = hb_unicode_funcs_create(0);
+    hb_unicode_funcs_set_general_category_func(funcs, generalCategory, 0, 0);
+    hb_unicode_funcs_set_mirroring_func(funcs, mirroring, 0, 0);
+    hb_unicode_funcs_set_script_func(funcs, script, 0, 0);
+    hb_unicode_funcs_make_immutable(funcs);
+    return funcs;
+}
+
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2026 The gltext contributors
+ *
+ *  This is part of gltext, a text-rendering library.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the
+ * above copyright notice and the following two paragraphs appear in
+ * all copies of this software.
+ *
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES
+ * ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN
+ * IF THE COPYRIGHT HOLDER HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * THE COPYRIGHT HOLDER SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE COPYRIGHT HOLDER HAS NO OBLIGATION TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ */
+
+// Internal to gltext: splits text into runs of a single bidi level and script before shaping
+
+#ifndef GLTEXT_ITEMIZE_HPP
+#define GLTEXT_ITEMIZE_HPP
+
+#include <string>
+#include <vector>
+
+#include "harfbuzz/hb.h"
+
+namespace gltext {
+
+/// A span of UTF-8 text with a single embedding level and script
+struct ScriptRun {
+    unsigned offset;
+    unsigned length;
+    unsigned char level; ///< Odd levels are right-to-left
+    hb_script_t script;
+};
+
+/**
+ * @brief Split one paragraph into runs, in logical order
+ *
+ * This implements the parts of UAX #9 that matter for single lines of UI text: the paragraph level comes
+ * from the first strong character, and the weak, neutral and implicit rules are applied. Explicit embeddings
+ * and overrides are ignored, and brackets are not paired. Common and inherited characters take the script
+ * of the text around them.
+ */
+void itemizeParagraph(const std::string& text, unsigned offset, unsigned length, std::vector<ScriptRun>& runs);
+
+/**
+ * @brief Visual order of a line's runs, given their levels in logical order (rule L2)
+ */
+void reorderRuns(const std::vector<unsigned char>& levels, std::vector<unsigned>& order);
+
+/**
+ * @brief Unicode callbacks for HarfBuzz, backed by the itemizer's tables
+ *
+ * These give HarfBuzz scripts, mirrored brackets, and the general categories it needs to tell marks from
+ * letters. The returned object is immutable and may be shared between threads.
+ */
+hb_unicode_funcs_t* createUnicodeFuncs();
+
+/// Decode one UTF-8 sequence starting at text[i] and advance i past it. Malformed input decodes as U+FFFD.
+inline unsigned decodeUtf8(const std::string& text, size_t& i) {
+    unsigned char c = text[i++];
+    if(c < 0x80)
+        return c;
+    unsigned extra, cp;
+    if((c & 0xe0) == 0xc0) {
+        extra = 1;
+        cp = c & 0x1f;
+    } else if((c & 0xf0) == 0xe0) {
+        extra = 2;
+        cp = c & 0x0f;
+    } else if((c & 0xf8) == 0xf0) {
+        extra = 3;
+        cp = c & 0x07;
+    } else {
+        return 0xfffd;
+    }
+    if(i + extra > text.size())
+        return 0xfffd;
+    for(unsigned n = 0; n < extra; n++) {
+        unsigned char cc = text[i];
+        if((cc & 0xc0) != 0x80)
+            return 0xfffd;
+        cp = (cp << 6) | (cc & 0x3f);
+        i++;
+    }
+    return cp;
+}
+
+}
+
+#endif // GLTEXT_ITEMIZE_HPP
@@ -0,0 +1,47 @@
+# Builds fuse.ttf, the font fusecheck runs on under ctest: boxes for a-z, and GSUB lookups that the plan compiler
+# fuses. ccmp rotates a -> b -> c -> a through three single substitutions, so applying them out of order or all at
+# once gives different glyphs; smcp swaps o and x through two. Needs fontTools.
+# usage: python makefusefont.py fuse.ttf
+import sys
+from fontTools.fontBuilder import FontBuilder
+from fontTools.pens.ttGlyphPen import TTGlyphPen
+from fontTools.feaLib.builder import addOpenTypeFeaturesFromString
+
+letters = [chr(c) for c in range(ord('a'), ord('z') + 1)]
+glyphs = ['.notdef', 'space'] + letters
+
+def box(width):
+    pen = TTGlyphPen(None)
+    pen.moveTo((50, 0))
+    pen.lineTo((50, 500))
+    pen.lineTo((width - 50, 500))
+    pen.lineTo((width - 50, 0))
+    pen.closePath()
+    return pen.glyph()
+
+fb = FontBuilder(1000, isTTF=True)
+fb.setupGlyphOrder(glyphs)
+fb.setupCharacterMap(dict([(ord(' '), 'space')] + [(ord(l), l) for l in letters]))
+outlines = {'.notdef': box(500), 'space': TTGlyphPen(None).glyph()}
+metrics = {'.notdef': (500, 50), 'space': (300, 0)}
+for i, l in enumerate(letters):
+    outlines[l] = box(400 + 10 * i)
+    metrics[l] = (400 + 10 * i, 50)
+fb.setupGlyf(outlines)
+fb.setupHorizontalMetrics(metrics)
+fb.setupHorizontalHeader(ascent=800, descent=-200)
+fb.setupNameTable({'familyName': 'gltext fuse test', 'styleName': 'Regular'})
+fb.setupOS2(sTypoAscender=800, sTypoDescender=-200, usWinAscent=800, usWinDescent=200)
+fb.setupPost()
+addOpenTypeFeaturesFromString(fb.font, '''
+languagesystem DFLT dflt;
+languagesystem latn dflt;
+lookup ab { sub a by b; } ab;
+lookup bc { sub b by c; } bc;
+lookup ca { sub c by a; } ca;
+lookup ox { sub o by x; } ox;
+lookup xo { sub x by o; } xo;
+feature ccmp { lookup ab; lookup bc; lookup ca; } ccmp;
+feature smcp { lookup ox; lookup xo; } smcp;
+''')
+fb.save(sys.argv[1])